@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 #include "light_sampler.h"
 #include "hal/adc.h"
+#include "hal/threadPolicy.h"
 #include "periodTimer.h"
 
 #include <pthread.h>
@@ -52,6 +53,7 @@ static void *sampler_thread_func(void *arg)
 {
     (void)arg;
     (void)Period_init;
+    ThreadPolicy_apply("sampler");
 
     Period_init();
 
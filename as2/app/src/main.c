@@ -10,6 +10,15 @@
 #include "hal/adc.h"
 #include "hal/pwmLed.h"
 #include "hal/encoder.h"
+#include "hal/threadPolicy.h"
+
+// Scheduling for the time-critical threads. Without CAP_SYS_NICE these
+// fall back to SCHED_OTHER and say so at startup.
+static const ThreadPolicy_config_t threadPolicies[] = {
+    // name       prio  cpu  lockMemory
+    { "sampler",  70,   3,   true  },
+    { "encoder",  50,   -1,  false },
+};
 
 // Volatile flag to safely stop the main loop from a signal handler
 static volatile int keepRunning = 1;
@@ -28,6 +37,7 @@ int main(void)
     printf(" Light Sampling and Dip Detection System\n");
     printf("============================================\n");
     printf("Starting modules...\n");
+    ThreadPolicy_init(threadPolicies, sizeof(threadPolicies) / sizeof(threadPolicies[0]));
 
     // Initialize all modules
     ADC_init();
@@ -81,6 +91,9 @@ int main(void)
     }
 
     printf("\nShutting down...\n");
+    char threadReport[512];
+    ThreadPolicy_report(threadReport, sizeof(threadReport));
+    printf("%s", threadReport);
 
     // Clean up all modules in reverse order
     UDPServer_cleanup();
@@ -88,6 +101,7 @@ int main(void)
     PWM_cleanup();
     ADC_cleanup();
     LightSampler_cleanup();
+    ThreadPolicy_cleanup();
     printf("Goodbye!\n");
     return 0;
 }
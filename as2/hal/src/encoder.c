@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 #include "hal/encoder.h"
 #include "hal/pwmLed.h"
+#include "hal/threadPolicy.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -35,6 +36,7 @@ static void invoke_callback(int f) {
 // The background thread that polls the rotary encoder
 static void *encoder_thread(void *arg) {
     (void)arg;
+    ThreadPolicy_apply("encoder");
     struct gpiod_chip *chip = NULL;
     struct gpiod_line_request *req = NULL;
     struct gpiod_line_settings *settings = NULL;
@@ -0,0 +1,38 @@
+// IMA-ADPCM codec for samples held compressed in memory (4 bits per
+// sample, about 4:1 over 16-bit PCM). Samples are encoded once at load
+// time and decoded by the mixer, a period at a time, as voices play them.
+//
+// The stream is a run of fixed-size blocks. Each block starts with the
+// decoder state at its first sample, so decoding can begin at any block;
+// within a block the state carries over from sample to sample.
+#ifndef ADPCM_H
+#define ADPCM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADPCM_BLOCK_FRAMES 256
+// Predictor (16-bit LE), step index, pad, then two samples per byte.
+#define ADPCM_BLOCK_HEADER_BYTES 4
+#define ADPCM_BLOCK_BYTES (ADPCM_BLOCK_HEADER_BYTES + ADPCM_BLOCK_FRAMES / 2)
+
+// Where a voice is in an encoded stream.
+typedef struct {
+    int position;       // Next sample to decode
+    int predictor;
+    int stepIndex;
+} adpcmDecoder_t;
+
+size_t Adpcm_getEncodedBytes(int numSamples);
+
+// Encode numSamples samples into pBlocks (Adpcm_getEncodedBytes() long).
+void Adpcm_encode(const short *pSamples, int numSamples, uint8_t *pBlocks);
+
+// Position the decoder at sample `position`, starting from the header of
+// the block containing it.
+void Adpcm_seek(adpcmDecoder_t *pDecoder, const uint8_t *pBlocks, int position);
+
+// Decode the next `count` samples into pOut and advance the decoder.
+void Adpcm_decode(adpcmDecoder_t *pDecoder, const uint8_t *pBlocks, short *pOut, int count);
+
+#endif
@@ -2,16 +2,33 @@
 #define AUDIOLOGIC_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 // Initialize/Cleanup
+// The beat patterns are played by Sequencer_renderPeriod(), which must be
+// the mixer's render callback: init() before AudioMixer_initWithConfig(),
+// cleanup() after AudioMixer_cleanup().
 void Beatbox_init(void);
 void Beatbox_cleanup(void);
 
 // Control
+// Mode 0 is silence; mode k plays pattern k of the bank, which starts out
+// holding the built-in Rock (1) and Custom (2).
 void Beatbox_setMode(int mode);
 int Beatbox_getMode(void);
 void Beatbox_cycleMode(void);
 
+// Patterns, in the text format of pattern.h. define() adds a pattern to the
+// bank, or replaces the one of the same name (from its next step, if it is
+// playing), and returns its mode; on failure it returns -1 with the reason
+// in error. load() defines each line of a file, skipping blank lines and
+// '#' comments, and returns false if any line was rejected.
+int Beatbox_definePattern(const char *text, char *error, size_t errorSize);
+bool Beatbox_loadPatterns(const char *fileName);
+// Modes 1 .. getNumPatterns(); describe() writes one as pattern text.
+int Beatbox_getNumPatterns(void);
+bool Beatbox_describePattern(int mode, char *buffer, size_t bufferSize);
+
 void Beatbox_setBPM(int bpm);
 int Beatbox_getBPM(void);
 void Beatbox_changeBPM(int amount);
@@ -20,7 +37,25 @@ void Beatbox_setVolume(int volume);
 int Beatbox_getVolume(void);
 void Beatbox_changeVolume(int amount);
 
+// Play any sound in the kit, ids 0 .. getNumSounds()-1 (0-2 are the base
+// drum, snare and hi-hat). Unknown ids are ignored.
 void Beatbox_playSound(int soundIndex);
+// ... as a live hit whose trigger was read at triggerNs (CLOCK_MONOTONIC),
+// counted in the hit latency statistics (see hitLatency.h).
+void Beatbox_playHit(int soundIndex, long long triggerNs);
+// ... at `rate` times its recorded speed (see AudioMixer_queueSoundAtRate()):
+// one sample tuned up or down, e.g. for toms.
+void Beatbox_playSoundAtRate(int soundIndex, double rate);
+int Beatbox_getNumSounds(void);
+
+// A backing track or announcement, streamed from disk (see audioStream.h).
+// playStream() stops the one playing, if any, then opens `name` in the
+// kit directory and plays it once. The name must be a bare "<name>.wav"
+// (see WaveFile_isPlainName()): it may come from a remote client. Returns
+// false if it is not, or the file cannot be opened. stopStream() cuts it
+// off. One stream at a time.
+bool Beatbox_playStream(const char *name);
+void Beatbox_stopStream(void);
 
 void Beatbox_markStopping(void);
 bool Beatbox_isStopping(void);
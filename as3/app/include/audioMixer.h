@@ -3,31 +3,282 @@
 #ifndef AUDIO_MIXER_H
 #define AUDIO_MIXER_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Samples per entry of wavedata_t.pPeaks.
+#define AUDIOMIXER_PEAK_BLOCK 64
+
 typedef struct {
 	int numSamples;
 	short *pData;
+	// Set when pData points into a memory-mapped WAV file (read-only).
+	void *pMapping;
+	size_t mappingSize;
+	// Set instead of pData when the samples are held IMA-ADPCM compressed
+	// (see WaveFile_compress()); the mixer decodes them as they play.
+	uint8_t *pAdpcm;
+	// Set instead of pData for a sound played from disk (see audioStream.h).
+	struct audioStream *pStream;
+	// Loudest |sample| of each AUDIOMIXER_PEAK_BLOCK samples, scanned at
+	// load. While the peaks of the voices in a period add up to no more
+	// than full scale, the mixer skips the 32-bit bus and all clamping; at
+	// the sound's own rate, it skips silent blocks altogether.
+	// NULL (a stream, or not scanned) means the sound could be anything.
+	uint16_t *pPeaks;
+	// Number of mixer voices (queued or playing) still reading pData.
+	// The sample must not be freed while this is non-zero.
+	atomic_int voiceRefs;
+	// Voice allocation. When the mixer is full a new voice may only steal
+	// from voices of equal or lower priority. Starting a sound cuts off any
+	// voice of the same non-zero choke group (e.g. open vs closed hi-hat).
+	// Set by the owner after loading, before the sound is first queued.
+	int priority;
+	int chokeGroup;
 } wavedata_t;
 
 #define AUDIOMIXER_MAX_VOLUME 100
+// Upper bound for AudioMixer_config_t.maxVoices.
+#define AUDIOMIXER_MAX_VOICES 64
+// Upper bound for AudioMixer_config_t.renderAhead.
+#define AUDIOMIXER_MAX_RENDER_AHEAD 4
+
+typedef enum {
+	// Mix into a private buffer and copy it to ALSA with snd_pcm_writei().
+	AUDIOMIXER_OUTPUT_WRITEI,
+	// Mix straight into ALSA's mmap'd ring buffer (no intermediate copy).
+	AUDIOMIXER_OUTPUT_MMAP,
+} AudioMixer_outputMode_t;
+
+typedef enum {
+	// Play through the ALSA PCM in `device`, paced by the sound card.
+	AUDIOMIXER_SINK_ALSA,
+	// Discard the output. Runs unthrottled: for measuring the mixer itself.
+	AUDIOMIXER_SINK_NULL,
+	// Write a WAV file to `outputFile`. Runs unthrottled (offline render).
+	AUDIOMIXER_SINK_WAVE_FILE,
+	// Stream RTP over UDP to `netTarget` (see netAudio.h), paced by the
+	// wall clock with numPeriods periods sent ahead of it.
+	AUDIOMIXER_SINK_NETWORK,
+} AudioMixer_sink_t;
+
+// Which voice gives way when a sound starts and all voices are busy.
+// Only voices of equal or lower priority are candidates; with none, or
+// with AUDIOMIXER_STEAL_NONE, the new sound is dropped.
+typedef enum {
+	AUDIOMIXER_STEAL_NONE,
+	// The voice that has played longest.
+	AUDIOMIXER_STEAL_OLDEST,
+	// The voice with the lowest peak over its next few samples.
+	AUDIOMIXER_STEAL_QUIETEST,
+} AudioMixer_stealPolicy_t;
+
+// Called by the playback thread at the start of every period, before any
+// newly queued sounds are picked up. firstFrame is the period's position
+// on the sample clock (frames rendered since init). Must not block.
+typedef void (*AudioMixer_renderCallback_t)(long long firstFrame, unsigned long numFrames, void *pContext);
+// Playback thread: true while the render callback has nothing to schedule
+// until something calls AudioMixer_wake() (e.g. the sequencer with no
+// pattern).
+typedef bool (*AudioMixer_idleCallback_t)(void *pContext);
+
+typedef struct {
+	// ALSA PCM name: "default", or "hw:0,0" / "plughw:0,0" to bypass dmix.
+	const char *device;
+	AudioMixer_outputMode_t outputMode;
+	// Requested period size and count; the device may round them.
+	// Output latency is roughly periodFrames * numPeriods / 44100 s.
+	unsigned int periodFrames;
+	unsigned int numPeriods;
+	// Pipelined output: mix up to this many periods ahead on the playback
+	// thread while a separate "audio-out" thread blocks writing to the sink
+	// (0 = mix and write in series). The lookahead comes out of numPeriods
+	// (the device keeps at least 2), so total latency stays the same.
+	int renderAhead;
+	// Polyphony (at most AUDIOMIXER_MAX_VOICES) and what happens beyond it.
+	int maxVoices;
+	AudioMixer_stealPolicy_t stealPolicy;
+	AudioMixer_sink_t sink;
+	const char *outputFile;
+	// "host[:port]" for the network sink.
+	const char *netTarget;
+	// Stop rendering after this many frames (0 = run until cleanup()).
+	long long renderFrames;
+	AudioMixer_renderCallback_t renderCallback;
+	void *pRenderContext;
+	// With a render callback the mixer only parks while this says it is
+	// idle; without one, never.
+	AudioMixer_idleCallback_t idleCallback;
+	// Park after this long with nothing playing (0 = never): the playback
+	// thread stops the sink and sleeps instead of writing silence every
+	// period, until a sound is queued or wake() is called. The sample clock
+	// stands still meanwhile. Only sinks that can stop (ALSA, network)
+	// park, not in render-ahead mode, and not while recording.
+	int idleParkMs;
+} AudioMixer_config_t;
+
+// What the device actually granted.
+typedef struct {
+	unsigned long periodFrames;
+	unsigned long bufferFrames;
+	unsigned int rate;
+	// Device buffer plus any render-ahead periods.
+	double latencyMs;
+} AudioMixer_latencyInfo_t;
 
 // init() must be called before any other functions,
 // cleanup() must be called last to stop playback threads and free memory.
+// init() uses the defaults from getDefaultConfig().
+void AudioMixer_getDefaultConfig(AudioMixer_config_t *pConfig);
 void AudioMixer_init(void);
+void AudioMixer_initWithConfig(const AudioMixer_config_t *pConfig);
 void AudioMixer_cleanup(void);
 
-// Read the contents of a wave file into the pSound structure. Note that
-// the pData pointer in this structure will be dynamically allocated in
-// readWaveFileIntoMemory(), and is freed by calling freeWaveFileData().
+// Set periodFrames/numPeriods from a named preset: "default" (~50 ms),
+// "low" (~17 ms) or "ultra" (~6 ms). Returns false for an unknown name.
+bool AudioMixer_setLatencyProfile(AudioMixer_config_t *pConfig, const char *profileName);
+void AudioMixer_getLatencyInfo(AudioMixer_latencyInfo_t *pInfo);
+
+// Frames rendered since init: the mixer's sample clock. With a non-realtime
+// sink this runs as fast as the CPU allows rather than at 44.1 kHz.
+long long AudioMixer_getFramesRendered(void);
+
+// Block until config.renderFrames frames have been rendered (or the mixer
+// is stopped). Call before cleanup() to finish an offline render.
+void AudioMixer_waitForRender(void);
+
+// Read the contents of a wave file into the pSound structure. The file is
+// memory-mapped and pData points straight at its samples (read-only), so
+// nothing is copied; the mapping is released by calling freeWaveFileData().
+// The file must be PCM S16_LE mono 44.1 kHz; extra RIFF chunks are skipped.
+// The sound's block peaks are scanned as it loads.
 void AudioMixer_readWaveFileIntoMemory(char *fileName, wavedata_t *pSound);
 void AudioMixer_freeWaveFileData(wavedata_t *pSound);
 
 // Queue up another sound bite to play as soon as possible.
+// Lock-free and safe to call from any thread; it never waits on playback.
 void AudioMixer_queueSound(wavedata_t *pSound);
 
+// Queue a live hit as queueSound() does, stamped with when its trigger
+// was read (CLOCK_MONOTONIC ns): the mixer measures how long after that
+// the hit leaves the DAC (see hitLatency.h). Only with a realtime sink.
+void AudioMixer_queueHit(wavedata_t *pSound, long long triggerNs);
+
+// Queue a sound to start exactly at frameTime on the mixer's sample clock
+// (see getFramesRendered()). Sounds are picked up as each period starts,
+// so queue at least one period ahead of getFramesRendered() to be sample
+// accurate; a late sound starts at once. Same threading rules as queueSound().
+void AudioMixer_queueSoundAt(wavedata_t *pSound, long long frameTime);
+
+// Playback rates for queueSoundAtRate(): two octaves either way.
+#define AUDIOMIXER_MIN_RATE 0.25
+#define AUDIOMIXER_MAX_RATE 4.0
+
+// Queue a sound to play at `rate` times its recorded speed, from
+// frameTime as for queueSoundAt(): 2.0 is an octave up and half as long,
+// 2^(n/12) n semitones up. Clamped to [AUDIOMIXER_MIN_RATE,
+// AUDIOMIXER_MAX_RATE]; a stream always plays at 1.0. Any rate other than
+// 1.0 costs a linear-interpolation pass over the voice each period.
+void AudioMixer_queueSoundAtRate(wavedata_t *pSound, long long frameTime, double rate);
+
+// Start pSound `offset` samples in, at frameTime: for taking over part way
+// through a sound whose start another voice has already played (see
+// stopSoundAt()). Not for streams.
+void AudioMixer_queueSoundFrom(wavedata_t *pSound, long long frameTime, int offset);
+
+// End every voice of pSound at frameTime, without a fade, and drop any
+// queued to start after it: for a caller that carries the sound on from
+// there with other voices. Same timing and threading rules as
+// queueSoundAt().
+void AudioMixer_stopSoundAt(wavedata_t *pSound, long long frameTime);
+
+// Resume a parked mixer (see idleParkMs): for a render callback that has
+// been given something to play. Queueing a sound wakes it anyway. Safe
+// from any thread; cheap when the mixer is not parked.
+void AudioMixer_wake(void);
+
+// Estimated frame currently leaving the DAC, interpolated from the
+// device's delay as last measured by the playback thread. Always behind
+// getFramesRendered() by roughly getOutputDelay() frames.
+long long AudioMixer_getFramePosition(void);
+// Frames rendered but not yet played: the output latency right now.
+long AudioMixer_getOutputDelay(void);
+
+// Voice allocation counters since init, for sizing maxVoices.
+typedef struct {
+	int active;             // Voices playing or scheduled right now
+	int peakActive;         // Most voices in use at once
+	long long started;
+	long long stolen;       // Cut off to make room for a new sound
+	long long choked;       // Cut off by a sound in the same choke group
+	long long dropped;      // New sounds lost: no voice could be stolen
+	long long queueFull;    // New sounds lost: the start queue was full
+} AudioMixer_voiceStats_t;
+void AudioMixer_getVoiceStats(AudioMixer_voiceStats_t *pStats);
+
+// Mixer and output health. Interval fields cover the time since the
+// reader's previous call; totals run from AudioMixer_init().
+typedef struct {
+	int renderAhead;        // As configured (0 = not pipelined)
+	int numPeriods;         // Periods mixed
+	double avgRenderMs;     // Time to mix one period
+	double maxRenderMs;
+	double avgDspLoad;      // Mix time as a fraction of the period's duration
+	double maxDspLoad;
+	int minQueueDepth;      // Fewest mixed periods waiting for the writer
+	double avgQueueDepth;
+	long long xruns;        // Device underruns in the interval
+	double seconds;         // Length of the interval
+	long long totalXruns;
+	long long recoveries;   // Output errors recovered (xruns included)
+	long long shortWrites;  // Periods the device only partly accepted
+	long long clippedSamples; // Samples saturated to the 16-bit range
+	long long unclampedPeriods; // Mixed in 16 bits: the peaks ruled out clipping
+	int peakVoices;         // Most voices mixed in one period
+	long long streamUnderruns; // Frames of silence: a stream's reads fell behind
+	long long packetsSent;  // Network sink: datagrams sent
+	long long sendErrors;   // ... and dropped by a failed send
+	double sendKbps;        // Bitrate sent in the interval, headers included
+	long long idlePeriods;  // Periods with nothing playing: zeros, no mix
+	long long parks;        // Times the output was parked
+	double parkedSeconds;
+} AudioMixer_stats_t;
+
+// Each reader of the interval fields keeps its own baseline, so readers
+// polling at different rates do not cut each other's intervals short.
+// Start one zeroed (static, or = {0}) and pass it to every call. The first
+// AUDIOMIXER_MAX_STATS_READERS baselines get their own interval max/min;
+// any more share the last reader's.
+#define AUDIOMIXER_MAX_STATS_READERS 4
+typedef struct {
+	int reader;             // Max/min slot, from 1 (0 = not yet assigned)
+	int generation;         // AudioMixer_init() the counts below are from
+	long long periods;
+	long long renderNs;
+	long long loadPpm;
+	long long depthSamples;
+	long long depthSum;
+	long long xruns;
+	long long bytesSent;
+	long long timeNs;
+} AudioMixer_statsBaseline_t;
+void AudioMixer_getStatsSince(AudioMixer_statsBaseline_t *pBaseline, AudioMixer_stats_t *pStats);
+
+// The same, against a baseline of the mixer's own: for a lone reader.
+void AudioMixer_getStatsAndClear(AudioMixer_stats_t *pStats);
+
 // Get/set the volume.
 // setVolume() function posted by StackOverflow user "trenki" at:
 // http://stackoverflow.com/questions/6787318/set-alsa-master-volume-from-c-code
+// The ALSA mixer control is opened once in init() and kept for reuse.
 int  AudioMixer_getVolume();
 void AudioMixer_setVolume(int newVolume);
 
+// Apply the volume as a gain inside the mix (ramped, so changes are
+// click-free) instead of through the ALSA control. Selected automatically
+// when the device has no "Speaker" or "PCM" control.
+void AudioMixer_setSoftwareVolume(bool enable);
+
 #endif
@@ -0,0 +1,53 @@
+// Output backends for the mixer. The playback thread renders each period
+// into a buffer obtained from the sink and hands it back; the sink decides
+// where the samples go (an ALSA PCM, nowhere, a WAV file or the network)
+// and whether the loop is paced by a device clock.
+#ifndef AUDIO_SINK_H
+#define AUDIO_SINK_H
+
+#include <stdbool.h>
+#include "audioMixer.h"
+
+typedef struct {
+	const char *name;
+	// True when acquire() blocks on a device clock. Otherwise the playback
+	// loop runs as fast as it can, on a virtual clock of frames rendered.
+	bool realtime;
+	// Get space for up to *pFrames frames (at most one period); *pFrames
+	// is lowered when less is contiguous. Returns NULL if nothing could be
+	// obtained this time (e.g. after recovering from an xrun); it has
+	// waited on the device first, so the caller may simply try again.
+	short *(*acquire)(unsigned long *pFrames);
+	// Hand back the frames written into the buffer from acquire().
+	void (*commit)(short *pBuffer, unsigned long frames);
+	// Output frames rendered elsewhere (any length), blocking as needed.
+	// Used by the pipelined mixer instead of acquire/commit.
+	void (*write)(const short *pBuffer, unsigned long frames);
+	// Frames committed that have not reached the output yet. Called by
+	// the playback thread only.
+	long (*getDelay)(void);
+	// Stop the output while the mixer is idle (true) and restart it (false),
+	// from the playback thread. Only called once everything queued is
+	// silence. NULL for sinks that have nothing to stop.
+	void (*pause)(bool paused);
+	// Flush and release everything opened by AudioSink_open().
+	void (*close)(void);
+} audioSink_t;
+
+// Open the sink selected by pConfig->sink and report the period and buffer
+// it settled on. Prints a message and exits on failure, like the mixer.
+const audioSink_t *AudioSink_open(const AudioMixer_config_t *pConfig, AudioMixer_latencyInfo_t *pInfo);
+
+// Output faults since open: the ALSA sink's, or for the network sink its
+// packets and the times it fell behind the wall clock (as xruns).
+typedef struct {
+	long long xruns;        // Underruns (-EPIPE)
+	long long recoveries;   // snd_pcm_recover() calls, for any error
+	long long shortWrites;  // Device took fewer frames than offered
+	long long packetsSent;
+	long long bytesSent;
+	long long sendErrors;   // Packets dropped by a failed send
+} audioSinkCounters_t;
+void AudioSink_getCounters(audioSinkCounters_t *pCounters);
+
+#endif
@@ -0,0 +1,42 @@
+// Long sounds (backing loops, announcements) played straight from disk.
+// To the mixer a stream is a wavedata_t like any other, but its samples
+// come through a bounded per-stream ring that a read-ahead thread refills
+// from the file in large sequential reads. The first stretch of the file
+// is read at open and kept, so a stream starts as promptly as a sample in
+// memory while the reader catches up behind it.
+//
+// A stream plays in one voice at a time: queueing it while it is still
+// playing is ignored.
+#ifndef AUDIO_STREAM_H
+#define AUDIO_STREAM_H
+
+#include <stdbool.h>
+#include "audioMixer.h"
+
+// Read at open and kept resident (~0.75 s).
+#define AUDIOSTREAM_HEAD_FRAMES 32768
+// One disk read (~0.37 s); the ring holds four.
+#define AUDIOSTREAM_CHUNK_FRAMES 16384
+#define AUDIOSTREAM_RING_FRAMES (4 * AUDIOSTREAM_CHUNK_FRAMES)
+
+// Open fileName (PCM S16_LE mono 44.1 kHz, as for
+// AudioMixer_readWaveFileIntoMemory()) and point pSound->pStream at it.
+// Memory per stream is fixed, whatever the file's length. The read-ahead
+// thread runs while any stream is open. Prints a message and returns
+// false on failure.
+bool AudioStream_open(const char *fileName, wavedata_t *pSound);
+
+// The stream must not be playing or queued (voiceRefs == 0).
+void AudioStream_close(wavedata_t *pSound);
+
+// Playback thread only; none of these block.
+// Start over from the beginning, for a new voice.
+void AudioStream_rewind(struct audioStream *pStream);
+// Copy frames [position, position + count) into pOut without consuming
+// them. Returns how many leading frames were available (fewer than count
+// when the reader is behind).
+int AudioStream_copy(struct audioStream *pStream, int position, short *pOut, int count);
+// Everything before `position` has been played; the reader may reuse it.
+void AudioStream_advance(struct audioStream *pStream, int position);
+
+#endif
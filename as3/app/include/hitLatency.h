@@ -0,0 +1,41 @@
+// Sensor-to-speaker latency of live hits. A hit is stamped when its
+// trigger is read (see AudioMixer_queueHit()) and measured by the mixer
+// when its voice is mixed, against when that frame will leave the DAC
+// (snd_pcm_delay() at that moment). Each hit's latency goes into a
+// histogram, split into the stages it passed through:
+//   queue  - trigger to queued: sample cache lookup, pushing the command
+//   wait   - queued to mixed: waiting for the next period to start
+//   output - mixed to the DAC: the period itself and what is buffered
+//            ahead of it (device buffer, render-ahead periods)
+// How long the crossing went unseen before the read (up to one poll
+// interval) cannot be known, and is not included.
+#ifndef HIT_LATENCY_H
+#define HIT_LATENCY_H
+
+// Histogram resolution and range; slower hits count in the last bucket.
+#define HITLATENCY_BUCKET_US 100
+#define HITLATENCY_NUM_BUCKETS 1000
+
+// Playback thread: one hit, all times CLOCK_MONOTONIC in ns.
+void HitLatency_record(long long triggerNs, long long queuedNs, long long mixedNs, long long dacNs);
+
+typedef struct {
+    long long hits;
+    double p50Ms;           // To the bucket's upper edge
+    double p99Ms;
+    double maxMs;
+    double avgQueueMs;      // Stages, as above
+    double avgWaitMs;
+    double avgOutputMs;
+    double maxWaitMs;
+    double maxOutputMs;
+} HitLatency_stats_t;
+// Of the hits since start (or reset).
+void HitLatency_getStats(HitLatency_stats_t *pStats);
+
+// Copy out the histogram: pCounts[i] hits took from i to i + 1 buckets.
+void HitLatency_getHistogram(long long pCounts[HITLATENCY_NUM_BUCKETS]);
+
+void HitLatency_reset(void);
+
+#endif
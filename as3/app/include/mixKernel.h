@@ -0,0 +1,57 @@
+// Vectorized inner loops for the audio mixer.
+// Voices are summed into a 32-bit bus so the sum can never wrap, and the bus
+// is saturated back to 16-bit once per period instead of once per voice.
+// Uses NEON on ARM (BeagleY-AI), AVX2 or SSE2 on x86, else plain C.
+#ifndef MIX_KERNEL_H
+#define MIX_KERNEL_H
+
+#include <stdint.h>
+
+// pBus[i] += pSrc[i] for i in [0, count)
+void MixKernel_accumulate(int32_t *pBus, const short *pSrc, int count);
+
+// pOut[i] = clamp(pBus[i], SHRT_MIN, SHRT_MAX) for i in [0, count)
+// Returns how many samples had to be clamped.
+int MixKernel_saturate(short *pOut, const int32_t *pBus, int count);
+
+// Unity gain for MixKernel_applyGainRamp(), in Q16 fixed point.
+#define MIX_KERNEL_UNITY_GAIN (1 << 16)
+
+// Scale the bus by a gain that moves linearly from gainStart to gainEnd
+// (Q16) across the block, so volume changes never step mid-waveform.
+void MixKernel_applyGainRamp(int32_t *pBus, int count, int32_t gainStart, int32_t gainEnd);
+
+// pBus[i] += pSrc[i] * gain, the gain moving linearly from gainStart to
+// gainEnd (Q16). Scalar: only used for the short fade of a cut-off voice.
+void MixKernel_accumulateRamp(int32_t *pBus, const short *pSrc, int count, int32_t gainStart, int32_t gainEnd);
+
+// Playback rate for MixKernel_resample(): source samples per output
+// frame, in Q16 fixed point.
+#define MIX_KERNEL_UNITY_RATE (1 << 16)
+
+// pOut[i] = pSrc at position (phase + i * rate) / 65536, for i in
+// [0, count): a Q16 phase accumulator with linear interpolation (Q14
+// weights) between the two samples either side. phase is the fraction of
+// a sample to start from (below 65536); rate must be below 16.0. Reads the
+// sample after the last position too, so that one must exist.
+void MixKernel_resample(short *pOut, const short *pSrc, int count, uint32_t phase, uint32_t rate);
+
+// The 16-bit path, for a period the caller has proven cannot clip (see
+// wavedata_t.pPeaks): voices are summed straight into the output with
+// plain wrapping adds, twice the lanes per instruction and no bus to
+// clear, widen or saturate. Each gives exactly what the 32-bit path would.
+
+// pOut[i] += pSrc[i] for i in [0, count); the sums must fit.
+void MixKernel_add(short *pOut, const short *pSrc, int count);
+
+// MixKernel_accumulateRamp() into the 16-bit output; the sums must fit.
+void MixKernel_addRamp(short *pOut, const short *pSrc, int count, int32_t gainStart, int32_t gainEnd);
+
+// MixKernel_applyGainRamp() on the 16-bit output. Gains must not exceed
+// MIX_KERNEL_UNITY_GAIN.
+void MixKernel_applyGainRamp16(short *pOut, int count, int32_t gainStart, int32_t gainEnd);
+
+// Name of the instruction set compiled in (for logs and benchmarks).
+const char *MixKernel_name(void);
+
+#endif
@@ -0,0 +1,50 @@
+// The mixed output as RTP (RFC 3550) over UDP, for the network sink and
+// tools/netReceiver. Payload type 11: L16, 44.1 kHz mono, big-endian
+// samples, so any RTP player that knows the static payload types can
+// also play the stream. The RTP timestamp is the mixer's sample clock.
+//
+// Every packet carries one header extension (profile NETAUDIO_EXTENSION)
+// holding the sender's CLOCK_REALTIME when the packet was sent, so the
+// receiver can measure latency. Latencies across machines are only as
+// good as their clock sync; over loopback they are exact.
+#ifndef NET_AUDIO_H
+#define NET_AUDIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#define NETAUDIO_DEFAULT_PORT 5004
+#define NETAUDIO_PAYLOAD_TYPE 11
+#define NETAUDIO_EXTENSION 0x4242
+// 12 bytes of RTP header, 4 of extension header, 8 of send time.
+#define NETAUDIO_HEADER_BYTES 24
+// 1152 bytes of samples: a packet fits a 1500-byte Ethernet MTU.
+#define NETAUDIO_MAX_FRAMES 576
+#define NETAUDIO_MAX_PACKET (NETAUDIO_HEADER_BYTES + NETAUDIO_MAX_FRAMES * 2)
+
+typedef struct {
+    uint16_t sequence;
+    uint32_t timestamp;     // Sample clock of the first frame
+    uint32_t ssrc;          // Changes when the sender restarts
+    long long sentNs;       // CLOCK_REALTIME at the sender
+    int numFrames;
+} NetAudio_header_t;
+
+// Write a packet of pHeader->numFrames samples (at most
+// NETAUDIO_MAX_FRAMES) into packet, which holds NETAUDIO_MAX_PACKET bytes.
+// Returns its length.
+size_t NetAudio_pack(const NetAudio_header_t *pHeader, const short *samples, uint8_t *packet);
+
+// Read back a packet of `size` bytes. samples holds NETAUDIO_MAX_FRAMES.
+// Returns false for anything not from NetAudio_pack().
+bool NetAudio_parse(const uint8_t *packet, size_t size, NetAudio_header_t *pHeader, short *samples);
+
+// "host", "host:port" or ":port" (any local address), resolved to IPv4.
+// Prints a message and returns false on failure.
+bool NetAudio_parseAddress(const char *text, struct sockaddr_in *pAddress);
+
+long long NetAudio_getRealTimeNs(void);
+
+#endif
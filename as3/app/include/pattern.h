@@ -0,0 +1,40 @@
+// Drum patterns as text, for pattern files and the UDP "pattern" command.
+// One pattern per line:
+//     name stepsPerBeat sound:steps [sound:steps ...]
+// for example
+//     rock 2 2:x.x.x.x. 0:x...x... 1:..x...x.
+// Each track names a kit sound id and spells out its bar, one character
+// per step: 'x' for a hit, '.' for a rest. Every track of a pattern has
+// the same number of steps.
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sequencer.h"
+
+#define PATTERN_MAX_NAME 16
+#define PATTERN_MAX_STEPS_PER_BEAT 16
+
+// As Sequencer_pattern_t, with tracks naming kit sound ids.
+typedef struct {
+    char name[PATTERN_MAX_NAME];
+    int numSteps;
+    int stepsPerBeat;
+    int numTracks;
+    struct {
+        int soundId;
+        uint64_t steps;
+    } tracks[SEQUENCER_MAX_TRACKS];
+} Pattern_def_t;
+
+// Parse one line. On failure writes why into error and returns false.
+// Sound ids are only checked for being non-negative.
+bool Pattern_parse(const char *text, Pattern_def_t *pPattern, char *error, size_t errorSize);
+
+// The text Pattern_parse() reads back into *pPattern. Returns false if it
+// did not fit in bufferSize.
+bool Pattern_format(const Pattern_def_t *pPattern, char *buffer, size_t bufferSize);
+
+#endif
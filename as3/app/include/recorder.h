@@ -0,0 +1,39 @@
+// Recording tap on the mixer's output: everything played, pattern and
+// live hits alike, written to a WAV file as it happens.
+//
+// The playback thread copies each period it outputs into a single-producer
+// / single-consumer ring and goes on; it never waits on the disk. A
+// low-priority "record" thread takes the frames out in large sequential
+// writes. If the disk falls so far behind that a period does not fit in
+// the ring, that period is left out of the recording and counted.
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdbool.h>
+
+// About 6 s of output, to ride out slow writes to an SD card.
+#define RECORDER_RING_FRAMES (1 << 18)
+
+// Start recording to fileName, replacing it. Returns false if already
+// recording or the file cannot be created.
+bool Recorder_start(const char *fileName);
+// Write out what is left, finish the WAV header and close the file.
+// Does nothing if not recording.
+void Recorder_stop(void);
+// Stops any recording.
+void Recorder_cleanup(void);
+
+typedef struct {
+    bool recording;
+    long long framesWritten;
+    long long droppedPeriods;   // Left out: the ring was full
+    long long droppedFrames;
+    bool writeFailed;           // The file could not be written; stopped
+} Recorder_stats_t;
+// Of the current recording, or the last one.
+void Recorder_getStats(Recorder_stats_t *pStats);
+
+// Playback thread: offer a period just mixed. Never blocks.
+void Recorder_capture(const short *pFrames, unsigned long frames);
+
+#endif
@@ -0,0 +1,44 @@
+// Bounded single-producer / single-consumer queue of mixed periods, for
+// pipelining the mixer: the render thread fills preallocated buffers while
+// the writer thread hands earlier ones to the output. Each side blocks on a
+// semaphore when it gets too far ahead of (or runs dry behind) the other,
+// so the render thread is never more than numBuffers - 1 periods ahead.
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define RENDER_QUEUE_MAX_BUFFERS 8
+
+typedef struct {
+    short *pBuffers[RENDER_QUEUE_MAX_BUFFERS];
+    unsigned long frames[RENDER_QUEUE_MAX_BUFFERS];
+    int numBuffers;
+    sem_t freeBuffers;
+    sem_t filledBuffers;
+    // Each index is owned by one side.
+    int writeIndex;
+    int readIndex;
+    atomic_int depth;
+} renderQueue_t;
+
+// Allocates numBuffers buffers of maxFrames frames. Returns false on failure.
+bool RenderQueue_init(renderQueue_t *pQueue, int numBuffers, unsigned long maxFrames);
+void RenderQueue_cleanup(renderQueue_t *pQueue);
+
+// Producer: wait for a free buffer, fill it, then publish `frames` of it.
+// Publishing 0 frames marks the end of the stream.
+short *RenderQueue_beginWrite(renderQueue_t *pQueue);
+void RenderQueue_endWrite(renderQueue_t *pQueue, unsigned long frames);
+
+// Consumer: wait for the next filled buffer, or NULL at the end of the
+// stream; release it when done with it.
+const short *RenderQueue_beginRead(renderQueue_t *pQueue, unsigned long *pFrames);
+void RenderQueue_endRead(renderQueue_t *pQueue);
+
+// Filled buffers waiting for the consumer.
+int RenderQueue_getDepth(renderQueue_t *pQueue);
+
+#endif
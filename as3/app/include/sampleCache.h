@@ -0,0 +1,40 @@
+// Memory-budgeted cache of drum kit samples, keyed by sound id.
+// Samples are loaded on first use and stay resident while they are hot.
+// When the resident total exceeds the byte budget, the least recently used
+// samples that are neither pinned nor still playing are unloaded.
+#ifndef SAMPLE_CACHE_H
+#define SAMPLE_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "audioMixer.h"
+
+typedef struct {
+    const char *fileName;
+    // Copied into the wavedata_t on load; see audioMixer.h.
+    int priority;
+    int chokeGroup;
+    // Hold the sample IMA-ADPCM compressed (about 4x less memory, a little
+    // decode work per voice and some added noise). Suits long cymbals.
+    bool compress;
+    // Drop leading samples no louder than this (see
+    // WaveFile_trimLeadingSilence()); 0 keeps the sample as recorded.
+    int trimThreshold;
+} SampleCache_sound_t;
+
+// sounds[id] describes sound id; the array must outlive the cache.
+void SampleCache_init(const SampleCache_sound_t *sounds, int numSounds, size_t budgetBytes);
+void SampleCache_cleanup(void);
+
+int SampleCache_getNumSounds(void);
+
+// Pin a sound, loading it if needed. Returns NULL for an unknown id or a
+// file that fails to load. A pinned sound is never evicted; queue it with
+// AudioMixer_queueSound() and then release it (the mixer keeps its own
+// reference for as long as the voice plays).
+wavedata_t *SampleCache_acquire(int soundId);
+void SampleCache_release(wavedata_t *pSound);
+
+size_t SampleCache_getResidentBytes(void);
+
+#endif
@@ -0,0 +1,76 @@
+// Drum pattern sequencer driven by the mixer's sample clock.
+// Sequencer_renderPeriod() is installed as the mixer's render callback: at
+// the start of every period it works out which pattern steps fall inside
+// the period and queues their hits at the exact frame. Timing comes from
+// the frame counter alone, so no thread sleeps between beats and no
+// wake-up or queueing delay can accumulate into tempo drift.
+//
+// The playing pattern is published through an atomic pointer. Replacing it
+// never makes the playback thread wait: the old copy is only freed once
+// the playback thread is known to be done with it.
+//
+// Bar cache: while the pattern and tempo stay the same, a background
+// thread mixes one bar of it, tails included, into a single sound, and
+// from the next bar on the sequencer queues that one sound per bar instead
+// of every hit. A change of pattern or tempo ends the cached bar at the
+// next step and carries on any hits still ringing in it as voices of their
+// own, so the output is the same either way (steps may land a frame
+// apart). Hits from the cached bar still choke other voices in their choke
+// group, but are not choked by them. The bar is queued as the stretches of
+// it between silences, so the mixer still idles where the hits would, and
+// only cached where that leaves fewer frames to mix than the hits: where
+// they overlap.
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "audioMixer.h"
+
+#define SEQUENCER_MAX_TRACKS 16
+// Steps are bits of a uint64_t.
+#define SEQUENCER_MAX_STEPS 64
+
+// One bar. Track t plays its sound on every step s with bit s of
+// tracks[t].steps set; steps are 1/stepsPerBeat of a beat long.
+typedef struct {
+    int numSteps;
+    int stepsPerBeat;
+    int numTracks;
+    struct {
+        wavedata_t *pSound;
+        uint64_t steps;
+    } tracks[SEQUENCER_MAX_TRACKS];
+} Sequencer_pattern_t;
+
+// Call before the mixer starts rendering; cleanup() after it has stopped.
+// The sounds of every pattern played must stay loaded until then. init()
+// starts the "bars" thread, which renders the bar cache.
+void Sequencer_init(int bpm);
+void Sequencer_cleanup(void);
+
+// On by default. Turning it off takes effect from the next bar.
+void Sequencer_setBarCache(bool enable);
+
+// Counters since init().
+typedef struct {
+    long long bars;         // Bars started
+    long long cachedBars;   // ... of which played from the bar cache
+    long long barsRendered; // Bars mixed into the cache
+    long long handovers;    // Cached bars cut short by a change
+} Sequencer_stats_t;
+void Sequencer_getStats(Sequencer_stats_t *pStats);
+
+// Play a copy of *pPattern (NULL for silence), from the top of its bar at
+// the next step boundary. Safe from any thread except the playback thread.
+void Sequencer_setPattern(const Sequencer_pattern_t *pPattern);
+// Safe from any thread; takes effect from the next step.
+void Sequencer_setBPM(int bpm);
+
+// AudioMixer_renderCallback_t. Playback thread only; never blocks.
+void Sequencer_renderPeriod(long long firstFrame, unsigned long numFrames, void *pContext);
+// AudioMixer_idleCallback_t: no pattern playing, so the mixer may park.
+// setPattern() wakes it.
+bool Sequencer_isIdle(void *pContext);
+
+#endif
@@ -0,0 +1,56 @@
+// Lock-free multi-producer / single-consumer queue of voice commands.
+// Any thread may push a command; only the audio playback thread pops them.
+// Neither side ever takes a lock or sleeps: a push into a full queue fails
+// immediately, and a pop stops at the first slot still being written.
+#ifndef VOICE_QUEUE_H
+#define VOICE_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "audioMixer.h"
+
+// Must be a power of two.
+#define VOICE_QUEUE_CAPACITY 64
+
+typedef struct {
+    wavedata_t *pSound;
+    // Mixer frame at which the sound starts; 0 (or any past frame) means
+    // as soon as possible.
+    long long startFrame;
+    // Sample of pSound the voice starts from (0 = the beginning).
+    int offset;
+    // Samples played per output frame, Q16 (MIX_KERNEL_UNITY_RATE); 0 also
+    // means the recorded rate.
+    uint32_t rate;
+    // Instead of starting a voice, end pSound's voices at startFrame.
+    bool stop;
+    // A live hit (see hitLatency.h): when its trigger was read and when it
+    // was queued (CLOCK_MONOTONIC ns). 0 for anything else.
+    long long triggerNs;
+    long long queuedNs;
+} voiceCommand_t;
+
+typedef struct {
+    atomic_size_t sequence;
+    voiceCommand_t command;
+} voiceQueueSlot_t;
+
+typedef struct {
+    voiceQueueSlot_t slots[VOICE_QUEUE_CAPACITY];
+    // Producers and the consumer each own a cache line for their cursor.
+    alignas(64) atomic_size_t enqueuePos;
+    alignas(64) size_t dequeuePos;
+} voiceQueue_t;
+
+void VoiceQueue_init(voiceQueue_t *pQueue);
+
+// Safe from any thread. Returns false (without blocking) if the queue is full.
+bool VoiceQueue_push(voiceQueue_t *pQueue, const voiceCommand_t *pCommand);
+
+// Consumer thread only. Returns false when no completed command is available.
+bool VoiceQueue_pop(voiceQueue_t *pQueue, voiceCommand_t *pCommand);
+
+#endif
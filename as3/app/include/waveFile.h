@@ -0,0 +1,61 @@
+// RIFF/WAVE file access in the mixer's native sample format:
+// 16-bit signed little-endian PCM, mono, 44.1 kHz.
+#ifndef WAVE_FILE_H
+#define WAVE_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "audioMixer.h"
+
+#define WAVEFILE_SAMPLE_RATE 44100
+#define WAVEFILE_NUM_CHANNELS 1
+#define WAVEFILE_BITS_PER_SAMPLE 16
+
+// Memory-map fileName and point pSound->pData at its "data" chunk (no copy;
+// the samples are read-only and shared with the page cache). The RIFF chunk
+// list is walked to find "fmt " and "data", and the format is validated.
+// Prints a message and returns false on any error.
+bool WaveFile_map(const char *fileName, wavedata_t *pSound);
+
+// Open fileName for reading its samples incrementally (see audioStream.h):
+// the file is validated as for WaveFile_map(), then *pFd is left open with
+// the samples at byte *pDataOffset. Prints a message and returns false on
+// any error.
+bool WaveFile_openData(const char *fileName, int *pFd, off_t *pDataOffset, int *pNumSamples);
+
+// Replace pSound's PCM with an IMA-ADPCM copy in pAdpcm (see adpcm.h) and
+// release the PCM. Prints a message and returns false, leaving the PCM in
+// place, if the memory cannot be allocated.
+bool WaveFile_compress(wavedata_t *pSound);
+
+// Drop the leading samples no louder than threshold (absolute value), so
+// the sound starts at its attack rather than after a few ms of near
+// silence. PCM only: call before WaveFile_compress(). Returns how many
+// samples were dropped; a threshold of 0 keeps the sound as recorded.
+int WaveFile_trimLeadingSilence(wavedata_t *pSound, int threshold);
+
+// Blocks of AUDIOMIXER_PEAK_BLOCK samples in a sound of numSamples.
+#define WAVEFILE_PEAK_BLOCKS(numSamples) \
+    (((numSamples) + AUDIOMIXER_PEAK_BLOCK - 1) / AUDIOMIXER_PEAK_BLOCK)
+
+// Fill in pSound->pPeaks from its samples, PCM or compressed (streams have
+// none). Prints a message and returns false, leaving pPeaks NULL, if the
+// memory cannot be allocated. Trimming and compressing keep them current.
+bool WaveFile_scanPeaks(wavedata_t *pSound);
+
+// Release whatever the functions above set up in pSound.
+void WaveFile_unmap(wavedata_t *pSound);
+
+// Whether name is safe to take from a remote client as a file in a fixed
+// directory: a bare "<name>.wav", with no directory part and not starting
+// with a dot (so neither ".." nor a hidden file).
+bool WaveFile_isPlainName(const char *name);
+
+// Write a 44-byte RIFF/WAVE header for numSamples samples in the native
+// format at the current position of pFile. Writers that don't know the
+// length up front write it with 0, then seek back and rewrite it at the end.
+bool WaveFile_writeHeader(FILE *pFile, uint32_t numSamples);
+
+#endif
@@ -0,0 +1,112 @@
+#include "adpcm.h"
+#include <string.h>
+
+#define MAX_STEP_INDEX 88
+
+static const int16_t stepTable[MAX_STEP_INDEX + 1] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31,
+    34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
+    157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+    724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024,
+    3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t indexTable[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+// One decoder step. The difference is computed as (2|code| + 1) * step / 8
+// rather than by the reference shift-and-add chain: same result to within
+// rounding, without the branches. The encoder runs this too, so both sides
+// always agree on the state.
+static inline int decodeSample(int *pPredictor, int *pStepIndex, int code)
+{
+    int step = stepTable[*pStepIndex];
+    int diff = ((2 * (code & 7) + 1) * step) >> 3;
+    int predictor = *pPredictor + ((code & 8) ? -diff : diff);
+    if (predictor > INT16_MAX) predictor = INT16_MAX;
+    if (predictor < INT16_MIN) predictor = INT16_MIN;
+    int stepIndex = *pStepIndex + indexTable[code];
+    if (stepIndex < 0) stepIndex = 0;
+    if (stepIndex > MAX_STEP_INDEX) stepIndex = MAX_STEP_INDEX;
+    *pPredictor = predictor;
+    *pStepIndex = stepIndex;
+    return predictor;
+}
+
+size_t Adpcm_getEncodedBytes(int numSamples)
+{
+    size_t numBlocks = ((size_t)numSamples + ADPCM_BLOCK_FRAMES - 1) / ADPCM_BLOCK_FRAMES;
+    return numBlocks * ADPCM_BLOCK_BYTES;
+}
+
+void Adpcm_encode(const short *pSamples, int numSamples, uint8_t *pBlocks)
+{
+    memset(pBlocks, 0, Adpcm_getEncodedBytes(numSamples));
+    int predictor = numSamples > 0 ? pSamples[0] : 0;
+    int stepIndex = 0;
+    uint8_t *pCodes = pBlocks;
+    for (int i = 0; i < numSamples; i++) {
+        int offset = i % ADPCM_BLOCK_FRAMES;
+        if (offset == 0) {
+            uint8_t *pHeader = pBlocks + (size_t)(i / ADPCM_BLOCK_FRAMES) * ADPCM_BLOCK_BYTES;
+            pHeader[0] = (uint8_t)predictor;
+            pHeader[1] = (uint8_t)(predictor >> 8);
+            pHeader[2] = (uint8_t)stepIndex;
+            pCodes = pHeader + ADPCM_BLOCK_HEADER_BYTES;
+        }
+
+        // The code whose reconstruction lands nearest the sample.
+        int diff = pSamples[i] - predictor;
+        int code = 0;
+        if (diff < 0) {
+            code = 8;
+            diff = -diff;
+        }
+        int magnitude = 4 * diff / stepTable[stepIndex];
+        code |= magnitude > 7 ? 7 : magnitude;
+        decodeSample(&predictor, &stepIndex, code);
+
+        pCodes[offset >> 1] |= (uint8_t)(code << ((offset & 1) * 4));
+    }
+}
+
+void Adpcm_seek(adpcmDecoder_t *pDecoder, const uint8_t *pBlocks, int position)
+{
+    int block = position / ADPCM_BLOCK_FRAMES;
+    const uint8_t *pHeader = pBlocks + (size_t)block * ADPCM_BLOCK_BYTES;
+    pDecoder->position = block * ADPCM_BLOCK_FRAMES;
+    pDecoder->predictor = (int16_t)(pHeader[0] | (pHeader[1] << 8));
+    pDecoder->stepIndex = pHeader[2];
+
+    // Decode up to the position within the block and throw it away.
+    short discard[ADPCM_BLOCK_FRAMES];
+    Adpcm_decode(pDecoder, pBlocks, discard, position - pDecoder->position);
+}
+
+void Adpcm_decode(adpcmDecoder_t *pDecoder, const uint8_t *pBlocks, short *pOut, int count)
+{
+    int position = pDecoder->position;
+    int predictor = pDecoder->predictor;
+    int stepIndex = pDecoder->stepIndex;
+    while (count > 0) {
+        // A block at a time. The state entering a block equals its header,
+        // so headers only need reading on a seek.
+        int offset = position % ADPCM_BLOCK_FRAMES;
+        int n = ADPCM_BLOCK_FRAMES - offset;
+        if (n > count) n = count;
+        const uint8_t *pCodes = pBlocks
+            + (size_t)(position / ADPCM_BLOCK_FRAMES) * ADPCM_BLOCK_BYTES + ADPCM_BLOCK_HEADER_BYTES;
+        for (int i = offset; i < offset + n; i++) {
+            int code = (pCodes[i >> 1] >> ((i & 1) * 4)) & 0xF;
+            *pOut++ = (short)decodeSample(&predictor, &stepIndex, code);
+        }
+        position += n;
+        count -= n;
+    }
+    pDecoder->position = position;
+    pDecoder->predictor = predictor;
+    pDecoder->stepIndex = stepIndex;
+}
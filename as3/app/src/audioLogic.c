@@ -1,9 +1,16 @@
 #include "audioLogic.h"
 #include "audioMixer.h"
+#include "audioStream.h"
+#include "pattern.h"
+#include "sampleCache.h"
+#include "sequencer.h"
+#include "waveFile.h"
 #include <pthread.h>
 #include <stdio.h>
-#include <unistd.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
 
 // Constants
 #define MIN_BPM 40
@@ -12,97 +19,284 @@
 #define MIN_VOL 0
 #define MAX_VOL 100
 #define DEFAULT_VOL 80
+#define MODE_NONE 0
+#define DEFAULT_MODE 1
+#define MAX_PATTERNS 16
+#define MAX_LINE 1024
+// How long stopStream() waits for the mixer to let go of the stream.
+#define STREAM_RELEASE_TIMEOUT_MS 1000
 
-// Files
-#define FILE_BASE "beatbox-wav-files/100051__menegass__gui-drum-bd-hard.wav"
-#define FILE_HIHAT "beatbox-wav-files/100053__menegass__gui-drum-cc.wav"
-#define FILE_SNARE "beatbox-wav-files/100059__menegass__gui-drum-snare-soft.wav"
+// Drum kit, indexed by sound id (as used by "play N" and patterns).
+// Ids 0-2 are the base drum, snare and hi-hat.
+// Drums outrank the long cymbal tails when the mixer runs out of voices,
+// and each hi-hat cuts off the previous one.
+#define KIT_DIR "beatbox-wav-files/"
+#define PRIORITY_CYMBAL 0
+#define PRIORITY_TOM 1
+#define PRIORITY_DRUM 2
+#define CHOKE_NONE 0
+#define CHOKE_HIHAT 1
+// Most menegass samples open with up to 9 ms of near silence (below about
+// -66 dBFS) before the attack: cut it, so hits sound when triggered.
+#define TRIM 16
+static const SampleCache_sound_t kit[] = {
+    // file                                                      priority         choke        adpcm   trim
+    { KIT_DIR "100051__menegass__gui-drum-bd-hard.wav",          PRIORITY_DRUM,   CHOKE_NONE,  false,  TRIM },
+    { KIT_DIR "100059__menegass__gui-drum-snare-soft.wav",       PRIORITY_DRUM,   CHOKE_NONE,  false,  TRIM },
+    { KIT_DIR "100053__menegass__gui-drum-cc.wav",               PRIORITY_CYMBAL, CHOKE_HIHAT, false,  TRIM },
+    { KIT_DIR "100052__menegass__gui-drum-bd-soft.wav",          PRIORITY_DRUM,   CHOKE_NONE,  false,  TRIM },
+    { KIT_DIR "100054__menegass__gui-drum-ch.wav",               PRIORITY_CYMBAL, CHOKE_HIHAT, false,  TRIM },
+    { KIT_DIR "100055__menegass__gui-drum-co.wav",               PRIORITY_CYMBAL, CHOKE_HIHAT, true,   TRIM },
+    { KIT_DIR "100056__menegass__gui-drum-cyn-hard.wav",         PRIORITY_CYMBAL, CHOKE_NONE,  true,   TRIM },
+    { KIT_DIR "100057__menegass__gui-drum-cyn-soft.wav",         PRIORITY_CYMBAL, CHOKE_NONE,  true,   TRIM },
+    { KIT_DIR "100058__menegass__gui-drum-snare-hard.wav",       PRIORITY_DRUM,   CHOKE_NONE,  false,  TRIM },
+    { KIT_DIR "100060__menegass__gui-drum-splash-hard.wav",      PRIORITY_CYMBAL, CHOKE_NONE,  true,   TRIM },
+    { KIT_DIR "100061__menegass__gui-drum-splash-soft.wav",      PRIORITY_CYMBAL, CHOKE_NONE,  true,   TRIM },
+    { KIT_DIR "100062__menegass__gui-drum-tom-hi-hard.wav",      PRIORITY_TOM,    CHOKE_NONE,  false,  TRIM },
+    { KIT_DIR "100063__menegass__gui-drum-tom-hi-soft.wav",      PRIORITY_TOM,    CHOKE_NONE,  false,  TRIM },
+    { KIT_DIR "100064__menegass__gui-drum-tom-lo-hard.wav",      PRIORITY_TOM,    CHOKE_NONE,  false,  TRIM },
+    { KIT_DIR "100065__menegass__gui-drum-tom-lo-soft.wav",      PRIORITY_TOM,    CHOKE_NONE,  false,  TRIM },
+    { KIT_DIR "100066__menegass__gui-drum-tom-mid-hard.wav",     PRIORITY_TOM,    CHOKE_NONE,  false,  TRIM },
+    { KIT_DIR "100067__menegass__gui-drum-tom-mid-soft.wav",     PRIORITY_TOM,    CHOKE_NONE,  false,  TRIM },
+};
+#define NUM_KIT_SOUNDS ((int)(sizeof(kit) / sizeof(kit[0])))
+
+// Modes 1 and 2, as the joystick and web UI have always had them.
+static const char *builtInPatterns[] = {
+    "rock   2 2:x.x.x.x. 0:x...x... 1:..x...x.",
+    "custom 2 0:x..xx... 1:..x...x. 2:xxxxxxxx",
+};
+
+// Resident sample memory; cold kit sounds beyond this are unloaded (LRU).
+#define SAMPLE_CACHE_BUDGET_BYTES (512 * 1024)
 
 static int bpm = DEFAULT_BPM;
 static int volume = DEFAULT_VOL;
-static int mode = 1; 
+static int mode = DEFAULT_MODE;
 static volatile bool stopping = false; // Controls the main application loop
-static pthread_t beatThreadId;
 static pthread_mutex_t beatMutex = PTHREAD_MUTEX_INITIALIZER;
 
-static wavedata_t baseDrum;
-static wavedata_t hiHat;
-static wavedata_t snare;
+// The pattern bank, under beatMutex. Every sound a pattern has used stays
+// pinned until cleanup, so the sequencer never plays an unloaded sample
+// (even from a pattern that has just been replaced).
+static Pattern_def_t patterns[MAX_PATTERNS];
+static int numPatterns = 0;
+static wavedata_t *pinnedSounds[NUM_KIT_SOUNDS];
+
+// The stream from playStream(), open while streamOpen; under streamMutex.
+static pthread_mutex_t streamMutex = PTHREAD_MUTEX_INITIALIZER;
+static wavedata_t stream;
+static bool streamOpen = false;
 
 void Beatbox_playSound(int soundIndex) {
-    switch (soundIndex) {
-        case 0: AudioMixer_queueSound(&baseDrum); break;
-        case 1: AudioMixer_queueSound(&snare); break;
-        case 2: AudioMixer_queueSound(&hiHat); break;
+    wavedata_t *pSound = SampleCache_acquire(soundIndex);
+    if (pSound) {
+        AudioMixer_queueSound(pSound);
+        SampleCache_release(pSound);
     }
 }
 
-static void* beatThread(void* arg) {
-    (void)arg;
-    while (!stopping) {
-        int currentMode, currentBPM;
-        
-        pthread_mutex_lock(&beatMutex);
-        currentMode = mode;
-        currentBPM = bpm;
-        pthread_mutex_unlock(&beatMutex);
+void Beatbox_playHit(int soundIndex, long long triggerNs) {
+    wavedata_t *pSound = SampleCache_acquire(soundIndex);
+    if (pSound) {
+        AudioMixer_queueHit(pSound, triggerNs);
+        SampleCache_release(pSound);
+    }
+}
 
-        if (currentMode == 0) {
-            usleep(100000); 
-            continue;
+void Beatbox_playSoundAtRate(int soundIndex, double rate) {
+    wavedata_t *pSound = SampleCache_acquire(soundIndex);
+    if (pSound) {
+        AudioMixer_queueSoundAtRate(pSound, 0, rate);
+        SampleCache_release(pSound);
+    }
+}
+
+int Beatbox_getNumSounds(void) { return SampleCache_getNumSounds(); }
+
+// Stop the stream and close it once the mixer has released it (at its
+// next period). Caller holds streamMutex. Returns false, leaving it open,
+// if the mixer never does.
+static bool closeStream(void) {
+    if (!streamOpen) return true;
+    AudioMixer_stopSoundAt(&stream, 0);
+    for (int ms = 0; atomic_load(&stream.voiceRefs) != 0; ms++) {
+        if (ms == STREAM_RELEASE_TIMEOUT_MS) {
+            fprintf(stderr, "ERROR: Stream still playing; not closed.\n");
+            return false;
+        }
+        struct timespec wait = { 0, 1000000 };
+        nanosleep(&wait, NULL);
+    }
+    AudioStream_close(&stream);
+    streamOpen = false;
+    return true;
+}
+
+bool Beatbox_playStream(const char *name) {
+    char fileName[MAX_LINE];
+    if (!WaveFile_isPlainName(name)
+            || snprintf(fileName, sizeof(fileName), KIT_DIR "%s", name) >= (int)sizeof(fileName)) {
+        return false;
+    }
+    pthread_mutex_lock(&streamMutex);
+    bool ok = closeStream() && AudioStream_open(fileName, &stream);
+    if (ok) {
+        streamOpen = true;
+        AudioMixer_queueSound(&stream);
+    }
+    pthread_mutex_unlock(&streamMutex);
+    return ok;
+}
+
+void Beatbox_stopStream(void) {
+    pthread_mutex_lock(&streamMutex);
+    closeStream();
+    pthread_mutex_unlock(&streamMutex);
+}
+
+// Hand the current mode's pattern to the sequencer. Caller holds beatMutex.
+static void publishMode(void) {
+    if (mode == MODE_NONE) {
+        Sequencer_setPattern(NULL);
+        return;
+    }
+    const Pattern_def_t *pDef = &patterns[mode - 1];
+    Sequencer_pattern_t pattern = {
+        .numSteps = pDef->numSteps,
+        .stepsPerBeat = pDef->stepsPerBeat,
+        .numTracks = pDef->numTracks,
+    };
+    for (int t = 0; t < pDef->numTracks; t++) {
+        pattern.tracks[t].pSound = pinnedSounds[pDef->tracks[t].soundId];
+        pattern.tracks[t].steps = pDef->tracks[t].steps;
+    }
+    Sequencer_setPattern(&pattern);
+}
+
+int Beatbox_definePattern(const char *text, char *error, size_t errorSize) {
+    Pattern_def_t def;
+    if (!Pattern_parse(text, &def, error, errorSize)) {
+        return -1;
+    }
+    for (int t = 0; t < def.numTracks; t++) {
+        if (def.tracks[t].soundId >= NUM_KIT_SOUNDS) {
+            snprintf(error, errorSize, "no sound %d (the kit has %d)", def.tracks[t].soundId, NUM_KIT_SOUNDS);
+            return -1;
         }
+    }
 
-        long delay_us = (60 * 1000 * 1000) / currentBPM / 2;
-
-        // 8 half-beats for standard rock
-        for (int i = 0; i < 8 && !stopping; i++) {
-            pthread_mutex_lock(&beatMutex);
-            if (mode != currentMode) {
-                pthread_mutex_unlock(&beatMutex);
-                break; 
-            }
-            currentBPM = bpm;
-            delay_us = (60 * 1000 * 1000) / currentBPM / 2;
+    pthread_mutex_lock(&beatMutex);
+    for (int t = 0; t < def.numTracks; t++) {
+        int id = def.tracks[t].soundId;
+        if (pinnedSounds[id] == NULL) {
+            pinnedSounds[id] = SampleCache_acquire(id);
+        }
+        if (pinnedSounds[id] == NULL) {
             pthread_mutex_unlock(&beatMutex);
+            snprintf(error, errorSize, "unable to load sound %d", id);
+            return -1;
+        }
+    }
+    int slot = 0;
+    while (slot < numPatterns && strcmp(patterns[slot].name, def.name) != 0) {
+        slot++;
+    }
+    if (slot == MAX_PATTERNS) {
+        pthread_mutex_unlock(&beatMutex);
+        snprintf(error, errorSize, "the bank is full (%d patterns)", MAX_PATTERNS);
+        return -1;
+    }
+    patterns[slot] = def;
+    if (slot == numPatterns) {
+        numPatterns++;
+    }
+    if (mode == slot + 1) {
+        publishMode();
+    }
+    pthread_mutex_unlock(&beatMutex);
+    return slot + 1;
+}
 
-            if (currentMode == 1) { // Rock
-                if(i==0 || i==2 || i==4 || i==6) AudioMixer_queueSound(&hiHat);
-                if(i==0 || i==4) AudioMixer_queueSound(&baseDrum);
-                if(i==2 || i==6) AudioMixer_queueSound(&snare);
-            } 
-            else if (currentMode == 2) { // Custom
-                if (i == 0 || i == 3 || i == 4) AudioMixer_queueSound(&baseDrum);
-                if (i == 2 || i == 6) AudioMixer_queueSound(&snare);
-                if (i == 0 || i == 1 || i == 2 || i == 3 || i == 4 || i == 5 || i == 6 || i == 7) AudioMixer_queueSound(&hiHat);
-            }
-
-            usleep(delay_us);
+bool Beatbox_loadPatterns(const char *fileName) {
+    FILE *pFile = fopen(fileName, "r");
+    if (pFile == NULL) {
+        fprintf(stderr, "ERROR: Unable to open pattern file %s.\n", fileName);
+        return false;
+    }
+    bool ok = true;
+    char line[MAX_LINE];
+    for (int lineNumber = 1; fgets(line, sizeof(line), pFile); lineNumber++) {
+        line[strcspn(line, "#\r\n")] = '\0';
+        if (line[strspn(line, " \t")] == '\0') {
+            continue;
+        }
+        char error[MAX_LINE];
+        if (Beatbox_definePattern(line, error, sizeof(error)) < 0) {
+            fprintf(stderr, "ERROR: %s:%d: %s.\n", fileName, lineNumber, error);
+            ok = false;
         }
     }
-    return NULL;
+    fclose(pFile);
+    return ok;
+}
+
+int Beatbox_getNumPatterns(void) {
+    pthread_mutex_lock(&beatMutex);
+    int count = numPatterns;
+    pthread_mutex_unlock(&beatMutex);
+    return count;
+}
+
+bool Beatbox_describePattern(int patternMode, char *buffer, size_t bufferSize) {
+    pthread_mutex_lock(&beatMutex);
+    bool ok = patternMode >= 1 && patternMode <= numPatterns
+        && Pattern_format(&patterns[patternMode - 1], buffer, bufferSize);
+    pthread_mutex_unlock(&beatMutex);
+    return ok;
 }
 
+// The patterns are played by the sequencer, from the mixer's render
+// callback (see sequencer.h).
 void Beatbox_init(void) {
-    AudioMixer_readWaveFileIntoMemory(FILE_BASE, &baseDrum);
-    AudioMixer_readWaveFileIntoMemory(FILE_HIHAT, &hiHat);
-    AudioMixer_readWaveFileIntoMemory(FILE_SNARE, &snare);
+    SampleCache_init(kit, NUM_KIT_SOUNDS, SAMPLE_CACHE_BUDGET_BYTES);
+    Sequencer_init(bpm);
+    for (size_t i = 0; i < sizeof(builtInPatterns) / sizeof(builtInPatterns[0]); i++) {
+        char error[MAX_LINE];
+        if (Beatbox_definePattern(builtInPatterns[i], error, sizeof(error)) < 0) {
+            fprintf(stderr, "ERROR: Unable to load the beat patterns: %s.\n", error);
+            exit(EXIT_FAILURE);
+        }
+    }
+    pthread_mutex_lock(&beatMutex);
+    publishMode();
+    pthread_mutex_unlock(&beatMutex);
     stopping = false;
-    pthread_create(&beatThreadId, NULL, beatThread, NULL);
 }
 
 void Beatbox_cleanup(void) {
-    stopping = true;
-    pthread_join(beatThreadId, NULL);
-    AudioMixer_freeWaveFileData(&baseDrum);
-    AudioMixer_freeWaveFileData(&hiHat);
-    AudioMixer_freeWaveFileData(&snare);
+    // The mixer has stopped, so nothing holds the stream any more.
+    if (streamOpen) {
+        AudioStream_close(&stream);
+        streamOpen = false;
+    }
+    Sequencer_cleanup();
+    for (int id = 0; id < NUM_KIT_SOUNDS; id++) {
+        if (pinnedSounds[id]) {
+            SampleCache_release(pinnedSounds[id]);
+            pinnedSounds[id] = NULL;
+        }
+    }
+    numPatterns = 0;
+    SampleCache_cleanup();
 }
 
 void Beatbox_setMode(int newMode) {
     pthread_mutex_lock(&beatMutex);
     mode = newMode;
-    // Mode 0=None, 1=Rock, 2=Custom. Cycle 0->1->2->0
-    if (mode > 2) mode = 0; 
+    // Cycle 0 -> 1 -> ... -> numPatterns -> 0
+    if (mode < MODE_NONE || mode > numPatterns) mode = MODE_NONE;
+    publishMode();
     pthread_mutex_unlock(&beatMutex);
 }
 int Beatbox_getMode(void) { return mode; }
@@ -113,6 +307,7 @@ void Beatbox_setBPM(int newBPM) {
     bpm = newBPM;
     if (bpm < MIN_BPM) bpm = MIN_BPM;
     if (bpm > MAX_BPM) bpm = MAX_BPM;
+    Sequencer_setBPM(bpm);
     pthread_mutex_unlock(&beatMutex);
 }
 int Beatbox_getBPM(void) { return bpm; }
@@ -1,67 +1,371 @@
 #include "audioMixer.h"
+#include "audioSink.h"
 #include "periodTimer.h" 
+#include "voiceQueue.h"
+#include "renderQueue.h"
+#include "mixKernel.h"
+#include "waveFile.h"
+#include "adpcm.h"
+#include "audioStream.h"
+#include "recorder.h"
+#include "hitLatency.h"
+#include "hal/threadPolicy.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <limits.h>
 #include <alsa/asoundlib.h>
 #include <stdbool.h>
 #include <pthread.h>
-#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <stdatomic.h>
 #include <alloca.h>
+#include <semaphore.h>
 
-static snd_pcm_t *handle;
+static AudioMixer_config_t config;
+static const audioSink_t *pSink = NULL;
 
 #define DEFAULT_VOLUME 80
-#define SAMPLE_RATE 44100
-#define NUM_CHANNELS 1
-#define SAMPLE_SIZE (sizeof(short)) 
 
-static unsigned long playbackBufferSize = 0;
-static short *playbackBuffer = NULL;
+// Negotiated with the sink at init: the mixer renders one period at a time.
+static AudioMixer_latencyInfo_t latencyInfo;
+// Sample clock: frames handed to the sink since init. Written by the
+// playback thread only.
+static atomic_llong framesRendered = 0;
+static pthread_mutex_t renderMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t renderDoneCond = PTHREAD_COND_INITIALIZER;
+static bool renderDone = false;
+// Where the output is, as of the last period: frame leaving the DAC at
+// positionTimeNs. Published by the playback thread under a sequence
+// counter (odd while being written) so readers never block it.
+static atomic_uint positionSeq = 0;
+static atomic_llong positionFrame = 0;
+static atomic_llong positionTimeNs = 0;
+// Wide intermediate bus: voices are summed here and saturated once.
+// Cleared on first use in a period (busCleared); a period whose voices'
+// peaks prove it cannot clip is mixed straight into the output instead.
+static int32_t *mixBus = NULL;
+static bool busCleared = false;
+// One period of a compressed or streamed voice, fetched just before it is
+// mixed: up to AUDIOMIXER_MAX_RATE periods' worth of samples for a voice
+// played fast, plus one more to interpolate towards.
+static short *decodeBuffer = NULL;
+// One period of a voice played at other than its recorded rate.
+static short *resampleBuffer = NULL;
 
-#define MAX_SOUND_BITES 30
-typedef struct {
-    wavedata_t *pSound;
-    int location;
-} playbackSound_t;
-static playbackSound_t soundBites[MAX_SOUND_BITES];
+// Active voices, packed into [0, activeCount) as parallel arrays so the
+// mix loop only visits sounds that are actually playing; the first free
+// voice is always activeCount. A negative location is a voice that starts
+// that many frames into the current buffer, from sample activeOffset
+// (normally 0). A voice ends at activeEnd (numSamples unless it was cut
+// off) and fades out from activeFadeStart. Sounds scheduled beyond the
+// current buffer wait in the pending list, as do stop commands, and only
+// take (or steal) a voice once they are due. A compressed sound's voice
+// also keeps its ADPCM decoder, which tracks activeLocation.
+// A voice plays activeRate samples per output frame (Q16; see
+// MixKernel_resample()): activeLocation and activePhase are the integer
+// sample and the fraction past it. Locations, ends and fades are all in
+// the sound's samples; a voice at MIX_KERNEL_UNITY_RATE never has a
+// fraction and is mixed straight from its samples. activeStartFrame is
+// the frame on the sample clock the voice started (or will start) at.
+// Owned exclusively by the playback thread; producers go through voiceQueue.
+#define DEFAULT_MAX_VOICES 30
+static wavedata_t *activeSound[AUDIOMIXER_MAX_VOICES];
+static int activeLocation[AUDIOMIXER_MAX_VOICES];
+static int activeOffset[AUDIOMIXER_MAX_VOICES];
+static int activeEnd[AUDIOMIXER_MAX_VOICES];
+static int activeFadeStart[AUDIOMIXER_MAX_VOICES];
+static adpcmDecoder_t activeDecoder[AUDIOMIXER_MAX_VOICES];
+static uint32_t activeRate[AUDIOMIXER_MAX_VOICES];
+static uint32_t activePhase[AUDIOMIXER_MAX_VOICES];
+static long long activeStartFrame[AUDIOMIXER_MAX_VOICES];
+static int activeCount = 0;
+static int maxVoices = DEFAULT_MAX_VOICES;
+static voiceQueue_t voiceQueue;
+#define MAX_PENDING VOICE_QUEUE_CAPACITY
+static wavedata_t *pendingSound[MAX_PENDING];
+static long long pendingStart[MAX_PENDING];
+static int pendingOffset[MAX_PENDING];
+static uint32_t pendingRate[MAX_PENDING];
+static bool pendingStop[MAX_PENDING];
+// Live hits: trigger and queue times, carried until the voice starts.
+static long long pendingTriggerNs[MAX_PENDING];
+static long long pendingQueuedNs[MAX_PENDING];
+static int pendingCount = 0;
+
+// A choked or stolen voice fades out over this many frames (~1.5 ms)
+// rather than stopping dead, which would click.
+#define CUT_FADE_FRAMES 64
+// AUDIOMIXER_STEAL_QUIETEST compares voices' peaks over this many frames.
+#define QUIET_SCAN_FRAMES 64
+
+// Allocation counters, updated by the playback thread (queueFull by
+// producers) and read by getVoiceStats().
+static atomic_int publishedActive = 0;
+static atomic_int peakActive = 0;
+static atomic_llong startedVoices = 0;
+static atomic_llong stolenVoices = 0;
+static atomic_llong chokedVoices = 0;
+static atomic_llong droppedVoices = 0;
+static atomic_llong queueFullVoices = 0;
+static atomic_llong clippedSamples = 0;
+static atomic_llong unclampedPeriods = 0;
+static atomic_llong streamUnderruns = 0;
+static atomic_llong idlePeriods = 0;
+static atomic_llong parks = 0;
+static atomic_llong parkedNs = 0;
+
+// Parking (config.idleParkMs): idleFrames counts the frames since anything
+// last played. While `parked` is set the playback thread sleeps on
+// wakeParked, which producers post after queueing.
+static long long idleFrames = 0;
+static atomic_bool parked = false;
+static sem_t wakeParked;
 
 void* playbackThread(void* arg);
 static _Bool stopping = false;
 static pthread_t playbackThreadId;
-static pthread_mutex_t audioMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Pipelined output (config.renderAhead > 0): the playback thread mixes
+// into renderQueue and writerThread passes the periods on to the sink.
+static renderQueue_t renderQueue;
+static pthread_t writerThreadId;
+
+// Counters behind AudioMixer_getStatsSince(). The playback and writer
+// threads only ever add to them or CAS-raise (lower) a reader's max (min),
+// so they never wait on a reader; readers diff the running totals against
+// their own baseline and swap their max/min slot back to its empty value.
+// A reader's loads may straddle one period. Reset by init, before the
+// threads start; generation tells baselines taken under an earlier init
+// to start over.
+static atomic_llong statPeriods;
+static atomic_llong statRenderNs;
+static atomic_llong statLoadPpm;        // DSP load in parts per million
+static atomic_llong statDepthSamples;
+static atomic_llong statDepthSum;
+static atomic_llong statMaxRenderNs[AUDIOMIXER_MAX_STATS_READERS];
+static atomic_llong statMaxLoadPpm[AUDIOMIXER_MAX_STATS_READERS];
+static atomic_int statMinDepth[AUDIOMIXER_MAX_STATS_READERS];   // INT_MAX: none yet
+static atomic_int statReaders;
+static int statGeneration = 0;
+static long long statInitXruns = 0;
+static long long statInitBytes = 0;
+static long long statInitNs = 0;
+static AudioMixer_statsBaseline_t ownBaseline;
 static int volume = 0;
 
+// ALSA volume control, opened once at init and reused by setVolume().
+// snd_mixer calls are not thread safe; the playback thread never takes this.
+static pthread_mutex_t volumeMutex = PTHREAD_MUTEX_INITIALIZER;
+static snd_mixer_t *mixerHandle = NULL;
+static snd_mixer_elem_t *volumeElem = NULL;
+static long volumeMin = 0;
+static long volumeMax = 0;
+
+// Software master gain (Q16), applied in the mix pass. The playback thread
+// ramps currentGain towards targetGain over GAIN_RAMP_FRAMES per full step.
+#define GAIN_RAMP_FRAMES 441  // 10 ms
+static atomic_bool useSoftwareVolume = false;
+static atomic_int targetGain = MIX_KERNEL_UNITY_GAIN;
+static int32_t currentGain = MIX_KERNEL_UNITY_GAIN;
+
+static void openVolumeControl(void);
+static void closeVolumeControl(void);
+static void resetStats(void);
+
+// Period size / count presets. "default" matches the original 50 ms buffer.
+typedef struct {
+    const char *name;
+    unsigned int periodFrames;
+    unsigned int numPeriods;
+} latencyProfile_t;
+static const latencyProfile_t latencyProfiles[] = {
+    { "default", 551, 4 },  // ~50 ms
+    { "low",     256, 3 },  // ~17 ms
+    { "ultra",   128, 2 },  // ~6 ms: use with hw:/plughw: and an RT thread
+};
+
+void AudioMixer_getDefaultConfig(AudioMixer_config_t *pConfig)
+{
+    pConfig->device = "default";
+    pConfig->outputMode = AUDIOMIXER_OUTPUT_WRITEI;
+    pConfig->renderAhead = 0;
+    pConfig->maxVoices = DEFAULT_MAX_VOICES;
+    pConfig->stealPolicy = AUDIOMIXER_STEAL_OLDEST;
+    pConfig->sink = AUDIOMIXER_SINK_ALSA;
+    pConfig->outputFile = NULL;
+    pConfig->netTarget = NULL;
+    pConfig->renderFrames = 0;
+    pConfig->renderCallback = NULL;
+    pConfig->pRenderContext = NULL;
+    pConfig->idleCallback = NULL;
+    pConfig->idleParkMs = 1000;
+    AudioMixer_setLatencyProfile(pConfig, "default");
+}
+
+bool AudioMixer_setLatencyProfile(AudioMixer_config_t *pConfig, const char *profileName)
+{
+    for (size_t i = 0; i < sizeof(latencyProfiles) / sizeof(latencyProfiles[0]); i++) {
+        if (strcmp(latencyProfiles[i].name, profileName) == 0) {
+            pConfig->periodFrames = latencyProfiles[i].periodFrames;
+            pConfig->numPeriods = latencyProfiles[i].numPeriods;
+            return true;
+        }
+    }
+    return false;
+}
+
+void AudioMixer_getLatencyInfo(AudioMixer_latencyInfo_t *pInfo)
+{
+    *pInfo = latencyInfo;
+    unsigned long aheadFrames = (unsigned long)config.renderAhead * latencyInfo.periodFrames;
+    pInfo->latencyMs = latencyInfo.rate
+        ? (latencyInfo.bufferFrames + aheadFrames) * 1000.0 / latencyInfo.rate : 0;
+}
+
+long long AudioMixer_getFramesRendered(void)
+{
+    return atomic_load_explicit(&framesRendered, memory_order_relaxed);
+}
+
+void AudioMixer_waitForRender(void)
+{
+    pthread_mutex_lock(&renderMutex);
+    while (!renderDone) {
+        pthread_cond_wait(&renderDoneCond, &renderMutex);
+    }
+    pthread_mutex_unlock(&renderMutex);
+}
+
+static long long getTimeInNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+// Playback thread only.
+static void publishPosition(long long frame)
+{
+    unsigned int seq = atomic_load_explicit(&positionSeq, memory_order_relaxed);
+    atomic_store_explicit(&positionSeq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&positionFrame, frame, memory_order_relaxed);
+    atomic_store_explicit(&positionTimeNs, getTimeInNs(), memory_order_relaxed);
+    atomic_store_explicit(&positionSeq, seq + 2, memory_order_release);
+}
+
+long long AudioMixer_getFramePosition(void)
+{
+    long long rendered = AudioMixer_getFramesRendered();
+    if (pSink == NULL || !pSink->realtime) {
+        return rendered;
+    }
+
+    unsigned int seq;
+    long long frame, timeNs;
+    do {
+        seq = atomic_load_explicit(&positionSeq, memory_order_acquire);
+        frame = atomic_load_explicit(&positionFrame, memory_order_relaxed);
+        timeNs = atomic_load_explicit(&positionTimeNs, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&positionSeq, memory_order_relaxed));
+
+    // The device has kept playing since the last measurement.
+    frame += (getTimeInNs() - timeNs) * (long long)latencyInfo.rate / 1000000000LL;
+    return frame < rendered ? frame : rendered;
+}
+
+long AudioMixer_getOutputDelay(void)
+{
+    return (long)(AudioMixer_getFramesRendered() - AudioMixer_getFramePosition());
+}
+
+static void markRenderDone(void)
+{
+    pthread_mutex_lock(&renderMutex);
+    renderDone = true;
+    pthread_cond_broadcast(&renderDoneCond);
+    pthread_mutex_unlock(&renderMutex);
+}
+
 void AudioMixer_init(void)
 {
-    AudioMixer_setVolume(DEFAULT_VOLUME);
-    for(int i = 0; i < MAX_SOUND_BITES; i++) {
-        soundBites[i].pSound = NULL;
-        soundBites[i].location = 0;
+    AudioMixer_config_t defaults;
+    AudioMixer_getDefaultConfig(&defaults);
+    AudioMixer_initWithConfig(&defaults);
+}
+
+void AudioMixer_initWithConfig(const AudioMixer_config_t *pConfig)
+{
+    config = *pConfig;
+    stopping = false;
+    if (config.sink == AUDIOMIXER_SINK_ALSA) {
+        openVolumeControl();
+    } else {
+        // Offline output has no device control: the volume is in the samples.
+        atomic_store(&useSoftwareVolume, true);
     }
+    AudioMixer_setVolume(DEFAULT_VOLUME);
+    // Nothing is playing yet, so start at the set volume without a ramp.
+    currentGain = atomic_load(&targetGain);
+    activeCount = 0;
+    pendingCount = 0;
+    maxVoices = config.maxVoices;
+    if (maxVoices < 1) maxVoices = 1;
+    if (maxVoices > AUDIOMIXER_MAX_VOICES) maxVoices = AUDIOMIXER_MAX_VOICES;
+    atomic_store(&publishedActive, 0);
+    atomic_store(&peakActive, 0);
+    atomic_store(&startedVoices, 0);
+    atomic_store(&stolenVoices, 0);
+    atomic_store(&chokedVoices, 0);
+    atomic_store(&droppedVoices, 0);
+    atomic_store(&queueFullVoices, 0);
+    atomic_store(&clippedSamples, 0);
+    atomic_store(&unclampedPeriods, 0);
+    atomic_store(&streamUnderruns, 0);
+    atomic_store(&idlePeriods, 0);
+    atomic_store(&parks, 0);
+    atomic_store(&parkedNs, 0);
+    idleFrames = 0;
+    atomic_store(&parked, false);
+    sem_init(&wakeParked, 0, 0);
+    VoiceQueue_init(&voiceQueue);
 
-    int err = snd_pcm_open(&handle, "default", SND_PCM_STREAM_PLAYBACK, 0);
-    if (err < 0) {
-        printf("Playback open error: %s\n", snd_strerror(err));
-        exit(EXIT_FAILURE);
+    atomic_store(&framesRendered, 0);
+    publishPosition(0);
+    renderDone = false;
+
+    // Render-ahead periods are taken out of the device buffer, not added.
+    if (config.renderAhead < 0) config.renderAhead = 0;
+    if (config.renderAhead > AUDIOMIXER_MAX_RENDER_AHEAD) config.renderAhead = AUDIOMIXER_MAX_RENDER_AHEAD;
+    AudioMixer_config_t sinkConfig = config;
+    if (config.renderAhead > 0) {
+        int devicePeriods = (int)config.numPeriods - config.renderAhead;
+        sinkConfig.numPeriods = devicePeriods < 2 ? 2 : devicePeriods;
     }
 
-    err = snd_pcm_set_params(handle,
-            SND_PCM_FORMAT_S16_LE,
-            SND_PCM_ACCESS_RW_INTERLEAVED,
-            NUM_CHANNELS,
-            SAMPLE_RATE,
-            1,
-            50000);
-    if (err < 0) {
-        printf("Playback open error: %s\n", snd_strerror(err));
+    pSink = AudioSink_open(&sinkConfig, &latencyInfo);
+    mixBus = malloc(latencyInfo.periodFrames * sizeof(*mixBus));
+    decodeBuffer = malloc(((size_t)(latencyInfo.periodFrames * AUDIOMIXER_MAX_RATE) + 2) * sizeof(*decodeBuffer));
+    resampleBuffer = malloc(latencyInfo.periodFrames * sizeof(*resampleBuffer));
+    if (mixBus == NULL || decodeBuffer == NULL || resampleBuffer == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate playback buffers.\n");
         exit(EXIT_FAILURE);
     }
+    resetStats();
 
-    unsigned long unusedBufferSize = 0;
-    snd_pcm_get_params(handle, &unusedBufferSize, &playbackBufferSize);
-    playbackBuffer = malloc(playbackBufferSize * sizeof(*playbackBuffer));
+    if (config.renderAhead > 0) {
+        // One buffer being written plus up to renderAhead mixed ahead of it.
+        if (!RenderQueue_init(&renderQueue, config.renderAhead + 1, latencyInfo.periodFrames)) {
+            fprintf(stderr, "ERROR: Unable to allocate render-ahead buffers.\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("Rendering %d period(s) ahead of the device (%u device periods)\n",
+            config.renderAhead, sinkConfig.numPeriods);
+    }
 
     pthread_create(&playbackThreadId, NULL, playbackThread, NULL);
 }
@@ -69,138 +373,1100 @@ void AudioMixer_init(void)
 void AudioMixer_readWaveFileIntoMemory(char *fileName, wavedata_t *pSound)
 {
     assert(pSound);
-    const int PCM_DATA_OFFSET = 44;
-    FILE *file = fopen(fileName, "r");
-    if (file == NULL) {
-        fprintf(stderr, "ERROR: Unable to open file %s.\n", fileName);
+    if (!WaveFile_map(fileName, pSound) || !WaveFile_scanPeaks(pSound)) {
         exit(EXIT_FAILURE);
     }
-    fseek(file, 0, SEEK_END);
-    int sizeInBytes = ftell(file) - PCM_DATA_OFFSET;
-    pSound->numSamples = sizeInBytes / SAMPLE_SIZE;
-    fseek(file, PCM_DATA_OFFSET, SEEK_SET);
-    pSound->pData = malloc(sizeInBytes);
-    if (pSound->pData == 0) {
-        fprintf(stderr, "ERROR: Unable to allocate %d bytes.\n", sizeInBytes);
-        exit(EXIT_FAILURE);
-    }
-    int samplesRead = fread(pSound->pData, SAMPLE_SIZE, pSound->numSamples, file);
-    if (samplesRead != pSound->numSamples) {
-        fprintf(stderr, "ERROR: Unable to read samples.\n");
-        exit(EXIT_FAILURE);
-    }
-    fclose(file);
 }
 
 void AudioMixer_freeWaveFileData(wavedata_t *pSound)
 {
-    pSound->numSamples = 0;
-    free(pSound->pData);
-    pSound->pData = NULL;
+    WaveFile_unmap(pSound);
 }
 
 void AudioMixer_queueSound(wavedata_t *pSound)
 {
     if (pSound == NULL || pSound->numSamples <= 0) return;
 
-    pthread_mutex_lock(&audioMutex);
-    int foundSlot = 0;
-    for (int i = 0; i < MAX_SOUND_BITES; i++) {
-        if (soundBites[i].pSound == NULL) {
-            soundBites[i].pSound = pSound;
-            soundBites[i].location = 0;
-            foundSlot = 1;
-            break;
-        }
+    AudioMixer_queueSoundAt(pSound, 0);
+}
+
+// Never blocks: the playback thread picks this up at its next period. A
+// stop command holds a reference too, until it has been applied.
+static void pushCommand(const voiceCommand_t *pCommand)
+{
+    wavedata_t *pSound = pCommand->pSound;
+    atomic_fetch_add_explicit(&pSound->voiceRefs, 1, memory_order_relaxed);
+    if (!VoiceQueue_push(&voiceQueue, pCommand)) {
+        atomic_fetch_sub_explicit(&pSound->voiceRefs, 1, memory_order_release);
+        atomic_fetch_add_explicit(&queueFullVoices, 1, memory_order_relaxed);
+        return;
     }
-    pthread_mutex_unlock(&audioMutex);
+    AudioMixer_wake();
+}
 
-    // FIX: Use the foundSlot variable to check for errors
-    if (!foundSlot) {
-        fprintf(stderr, "ERROR: Audio Mixer is full (too many sounds playing)\n");
+void AudioMixer_wake(void)
+{
+    // Pairs with the fence in park(): either this sees `parked`, or the
+    // playback thread sees what was published before the call.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&parked, memory_order_relaxed)) {
+        sem_post(&wakeParked);
     }
 }
 
+void AudioMixer_queueHit(wavedata_t *pSound, long long triggerNs)
+{
+    if (pSound == NULL || pSound->numSamples <= 0) return;
+
+    voiceCommand_t command = { .pSound = pSound, .triggerNs = triggerNs, .queuedNs = getTimeInNs() };
+    pushCommand(&command);
+}
+
+void AudioMixer_queueSoundAt(wavedata_t *pSound, long long frameTime)
+{
+    if (pSound == NULL || pSound->numSamples <= 0) return;
+
+    voiceCommand_t command = { .pSound = pSound, .startFrame = frameTime };
+    pushCommand(&command);
+}
+
+void AudioMixer_queueSoundFrom(wavedata_t *pSound, long long frameTime, int offset)
+{
+    if (pSound == NULL || offset < 0 || offset >= pSound->numSamples || pSound->pStream) return;
+
+    voiceCommand_t command = { .pSound = pSound, .startFrame = frameTime, .offset = offset };
+    pushCommand(&command);
+}
+
+void AudioMixer_queueSoundAtRate(wavedata_t *pSound, long long frameTime, double rate)
+{
+    if (pSound == NULL || pSound->numSamples <= 0) return;
+
+    // Written this way round, a NaN rate comes out as the minimum.
+    if (!(rate >= AUDIOMIXER_MIN_RATE)) rate = AUDIOMIXER_MIN_RATE;
+    if (rate > AUDIOMIXER_MAX_RATE) rate = AUDIOMIXER_MAX_RATE;
+    voiceCommand_t command = {
+        .pSound = pSound,
+        .startFrame = frameTime,
+        // A stream is read ahead at its recorded rate.
+        .rate = pSound->pStream ? 0 : (uint32_t)(rate * MIX_KERNEL_UNITY_RATE + 0.5),
+    };
+    pushCommand(&command);
+}
+
+void AudioMixer_stopSoundAt(wavedata_t *pSound, long long frameTime)
+{
+    if (pSound == NULL) return;
+
+    voiceCommand_t command = { .pSound = pSound, .startFrame = frameTime, .stop = true };
+    pushCommand(&command);
+}
+
+static void resetStats(void)
+{
+    audioSinkCounters_t counters;
+    AudioSink_getCounters(&counters);
+    atomic_store(&statPeriods, 0);
+    atomic_store(&statRenderNs, 0);
+    atomic_store(&statLoadPpm, 0);
+    atomic_store(&statDepthSamples, 0);
+    atomic_store(&statDepthSum, 0);
+    for (int i = 0; i < AUDIOMIXER_MAX_STATS_READERS; i++) {
+        atomic_store(&statMaxRenderNs[i], 0);
+        atomic_store(&statMaxLoadPpm[i], 0);
+        atomic_store(&statMinDepth[i], INT_MAX);
+    }
+    statGeneration++;
+    statInitXruns = counters.xruns;
+    statInitBytes = counters.bytesSent;
+    statInitNs = getTimeInNs();
+}
+
+void AudioMixer_getStatsSince(AudioMixer_statsBaseline_t *pBaseline, AudioMixer_stats_t *pStats)
+{
+    long long now = getTimeInNs();
+    audioSinkCounters_t counters;
+    AudioSink_getCounters(&counters);
+
+    if (pBaseline->reader == 0) {
+        int reader = atomic_fetch_add(&statReaders, 1);
+        pBaseline->reader = reader < AUDIOMIXER_MAX_STATS_READERS
+            ? reader + 1 : AUDIOMIXER_MAX_STATS_READERS;
+    }
+    int slot = pBaseline->reader - 1;
+    if (pBaseline->generation != statGeneration) {
+        AudioMixer_statsBaseline_t fresh = {
+            .reader = pBaseline->reader,
+            .generation = statGeneration,
+            .xruns = statInitXruns,
+            .bytesSent = statInitBytes,
+            .timeNs = statInitNs,
+        };
+        *pBaseline = fresh;
+    }
+
+    AudioMixer_statsBaseline_t current = *pBaseline;
+    current.periods = atomic_load_explicit(&statPeriods, memory_order_relaxed);
+    current.renderNs = atomic_load_explicit(&statRenderNs, memory_order_relaxed);
+    current.loadPpm = atomic_load_explicit(&statLoadPpm, memory_order_relaxed);
+    current.depthSamples = atomic_load_explicit(&statDepthSamples, memory_order_relaxed);
+    current.depthSum = atomic_load_explicit(&statDepthSum, memory_order_relaxed);
+    current.xruns = counters.xruns;
+    current.bytesSent = counters.bytesSent;
+    current.timeNs = now;
+    long long maxRenderNs = atomic_exchange_explicit(&statMaxRenderNs[slot], 0, memory_order_relaxed);
+    long long maxLoadPpm = atomic_exchange_explicit(&statMaxLoadPpm[slot], 0, memory_order_relaxed);
+    int minDepth = atomic_exchange_explicit(&statMinDepth[slot], INT_MAX, memory_order_relaxed);
+
+    long long periods = current.periods - pBaseline->periods;
+    long long depthSamples = current.depthSamples - pBaseline->depthSamples;
+    pStats->renderAhead = config.renderAhead;
+    pStats->numPeriods = periods;
+    pStats->avgRenderMs = periods ? (current.renderNs - pBaseline->renderNs) / 1e6 / periods : 0;
+    pStats->maxRenderMs = maxRenderNs / 1e6;
+    pStats->avgDspLoad = periods ? (current.loadPpm - pBaseline->loadPpm) / 1e6 / periods : 0;
+    pStats->maxDspLoad = maxLoadPpm / 1e6;
+    pStats->minQueueDepth = depthSamples && minDepth != INT_MAX ? minDepth : 0;
+    pStats->avgQueueDepth = depthSamples
+        ? (double)(current.depthSum - pBaseline->depthSum) / depthSamples : 0;
+    pStats->xruns = current.xruns - pBaseline->xruns;
+    pStats->seconds = pBaseline->timeNs ? (now - pBaseline->timeNs) / 1e9 : 0;
+    pStats->sendKbps = pStats->seconds > 0
+        ? (current.bytesSent - pBaseline->bytesSent) * 8 / 1000.0 / pStats->seconds : 0;
+    *pBaseline = current;
+
+    pStats->totalXruns = counters.xruns;
+    pStats->recoveries = counters.recoveries;
+    pStats->shortWrites = counters.shortWrites;
+    pStats->packetsSent = counters.packetsSent;
+    pStats->sendErrors = counters.sendErrors;
+    pStats->clippedSamples = atomic_load_explicit(&clippedSamples, memory_order_relaxed);
+    pStats->unclampedPeriods = atomic_load_explicit(&unclampedPeriods, memory_order_relaxed);
+    pStats->peakVoices = atomic_load_explicit(&peakActive, memory_order_relaxed);
+    pStats->streamUnderruns = atomic_load_explicit(&streamUnderruns, memory_order_relaxed);
+    pStats->idlePeriods = atomic_load_explicit(&idlePeriods, memory_order_relaxed);
+    pStats->parks = atomic_load_explicit(&parks, memory_order_relaxed);
+    pStats->parkedSeconds = atomic_load_explicit(&parkedNs, memory_order_relaxed) / 1e9;
+}
+
+void AudioMixer_getStatsAndClear(AudioMixer_stats_t *pStats)
+{
+    AudioMixer_getStatsSince(&ownBaseline, pStats);
+}
+
+void AudioMixer_getVoiceStats(AudioMixer_voiceStats_t *pStats)
+{
+    pStats->active = atomic_load(&publishedActive);
+    pStats->peakActive = atomic_load(&peakActive);
+    pStats->started = atomic_load(&startedVoices);
+    pStats->stolen = atomic_load(&stolenVoices);
+    pStats->choked = atomic_load(&chokedVoices);
+    pStats->dropped = atomic_load(&droppedVoices);
+    pStats->queueFull = atomic_load(&queueFullVoices);
+}
+
 void AudioMixer_cleanup(void)
 {
     printf("Stopping audio...\n");
     stopping = true;
+    AudioMixer_wake();
     pthread_join(playbackThreadId, NULL);
-    snd_pcm_drain(handle);
-    snd_pcm_close(handle);
-    free(playbackBuffer);
-    playbackBuffer = NULL;
+    sem_destroy(&wakeParked);
+    markRenderDone();
+    if (config.renderAhead > 0) {
+        RenderQueue_cleanup(&renderQueue);
+    }
+    pSink->close();
+    pSink = NULL;
+    free(mixBus);
+    mixBus = NULL;
+    free(decodeBuffer);
+    decodeBuffer = NULL;
+    free(resampleBuffer);
+    resampleBuffer = NULL;
+    closeVolumeControl();
     printf("Done stopping audio...\n");
 }
 
 int AudioMixer_getVolume() { return volume; }
 
+static void openVolumeControl(void)
+{
+    const char *card = "default";
+    snd_mixer_selem_id_t *sid;
+
+    if (snd_mixer_open(&mixerHandle, 0) < 0) {
+        mixerHandle = NULL;
+    } else if (snd_mixer_attach(mixerHandle, card) < 0
+            || snd_mixer_selem_register(mixerHandle, NULL, NULL) < 0
+            || snd_mixer_load(mixerHandle) < 0) {
+        snd_mixer_close(mixerHandle);
+        mixerHandle = NULL;
+    }
+
+    if (mixerHandle) {
+        snd_mixer_selem_id_alloca(&sid);
+        snd_mixer_selem_id_set_index(sid, 0);
+        snd_mixer_selem_id_set_name(sid, "Speaker");
+        volumeElem = snd_mixer_find_selem(mixerHandle, sid);
+        if (volumeElem == NULL) {
+            snd_mixer_selem_id_set_name(sid, "PCM");
+            volumeElem = snd_mixer_find_selem(mixerHandle, sid);
+        }
+    }
+
+    if (volumeElem) {
+        snd_mixer_selem_get_playback_volume_range(volumeElem, &volumeMin, &volumeMax);
+    } else {
+        // No hardware control (e.g. a raw device): fall back to in-mixer gain.
+        printf("No ALSA volume control found; using software volume.\n");
+        atomic_store(&useSoftwareVolume, true);
+    }
+}
+
+static void closeVolumeControl(void)
+{
+    pthread_mutex_lock(&volumeMutex);
+    if (mixerHandle) {
+        snd_mixer_close(mixerHandle);
+    }
+    mixerHandle = NULL;
+    volumeElem = NULL;
+    pthread_mutex_unlock(&volumeMutex);
+}
+
+// Caller holds volumeMutex.
+static void setHardwareVolume(int newVolume)
+{
+    if (volumeElem) {
+        long value = volumeMin + (volumeMax - volumeMin) * newVolume / AUDIOMIXER_MAX_VOLUME;
+        snd_mixer_selem_set_playback_volume_all(volumeElem, value);
+    }
+}
+
+// Squared curve so equal volume steps sound roughly equally loud.
+static int32_t volumeToGain(int newVolume)
+{
+    int64_t gain = (int64_t)MIX_KERNEL_UNITY_GAIN * newVolume * newVolume;
+    return (int32_t)(gain / (AUDIOMIXER_MAX_VOLUME * AUDIOMIXER_MAX_VOLUME));
+}
+
 void AudioMixer_setVolume(int newVolume)
 {
     if (newVolume < 0 || newVolume > AUDIOMIXER_MAX_VOLUME) return;
+    pthread_mutex_lock(&volumeMutex);
     volume = newVolume;
-    long min, max;
-    snd_mixer_t *mixerHandle;
-    snd_mixer_selem_id_t *sid;
-    const char *card = "default";
-    const char *selem_name = "Speaker"; 
+    if (atomic_load(&useSoftwareVolume)) {
+        // Picked up (and ramped to) by the playback thread's next period.
+        atomic_store(&targetGain, volumeToGain(newVolume));
+    } else {
+        setHardwareVolume(newVolume);
+    }
+    pthread_mutex_unlock(&volumeMutex);
+}
 
-    snd_mixer_open(&mixerHandle, 0);
-    snd_mixer_attach(mixerHandle, card);
-    snd_mixer_selem_register(mixerHandle, NULL, NULL);
-    snd_mixer_load(mixerHandle);
-    snd_mixer_selem_id_alloca(&sid);
-    snd_mixer_selem_id_set_index(sid, 0);
-    snd_mixer_selem_id_set_name(sid, selem_name);
-    snd_mixer_elem_t* elem = snd_mixer_find_selem(mixerHandle, sid);
-    if (elem == NULL) {
-        snd_mixer_selem_id_set_name(sid, "PCM");
-        elem = snd_mixer_find_selem(mixerHandle, sid);
+void AudioMixer_setSoftwareVolume(bool enable)
+{
+    pthread_mutex_lock(&volumeMutex);
+    if (enable) {
+        // Hardware stays at full scale; all attenuation happens in-mixer.
+        setHardwareVolume(AUDIOMIXER_MAX_VOLUME);
+        atomic_store(&targetGain, volumeToGain(volume));
+    } else {
+        atomic_store(&targetGain, MIX_KERNEL_UNITY_GAIN);
+        setHardwareVolume(volume);
     }
-    if (elem) {
-        snd_mixer_selem_get_playback_volume_range(elem, &min, &max);
-        snd_mixer_selem_set_playback_volume_all(elem, volume * max / 100);
+    atomic_store(&useSoftwareVolume, enable);
+    pthread_mutex_unlock(&volumeMutex);
+}
+
+// The software master gain across the next `size` frames, ramping towards
+// the latest target at no more than one full-scale change per
+// GAIN_RAMP_FRAMES. Returns false if it is unity throughout. Gains never
+// exceed unity (see volumeToGain()), so they never add to a peak.
+static bool stepMasterGain(int size, int32_t *pStart, int32_t *pEnd)
+{
+    int32_t target = atomic_load_explicit(&targetGain, memory_order_relaxed);
+    *pStart = currentGain;
+    if (target != currentGain) {
+        int64_t maxStep = (int64_t)MIX_KERNEL_UNITY_GAIN * size / GAIN_RAMP_FRAMES;
+        int64_t delta = (int64_t)target - currentGain;
+        if (delta > maxStep) delta = maxStep;
+        else if (delta < -maxStep) delta = -maxStep;
+        currentGain = (int32_t)(currentGain + delta);
     }
-    snd_mixer_close(mixerHandle);
+    *pEnd = currentGain;
+    return *pStart != MIX_KERNEL_UNITY_GAIN || *pEnd != MIX_KERNEL_UNITY_GAIN;
 }
 
-static void fillPlaybackBuffer(short *buff, int size)
+// The mixer is done reading pSound's samples (voice ended or dropped).
+static void releaseSound(wavedata_t *pSound)
+{
+    atomic_fetch_sub_explicit(&pSound->voiceRefs, 1, memory_order_release);
+}
+
+static void removeActiveVoice(int index)
+{
+    releaseSound(activeSound[index]);
+    activeCount--;
+    activeSound[index] = activeSound[activeCount];
+    activeLocation[index] = activeLocation[activeCount];
+    activeOffset[index] = activeOffset[activeCount];
+    activeEnd[index] = activeEnd[activeCount];
+    activeFadeStart[index] = activeFadeStart[activeCount];
+    activeDecoder[index] = activeDecoder[activeCount];
+    activeRate[index] = activeRate[activeCount];
+    activePhase[index] = activePhase[activeCount];
+    activeStartFrame[index] = activeStartFrame[activeCount];
+}
+
+static int32_t fadeGain(int location, int end, int fadeLength)
+{
+    return (int32_t)((int64_t)MIX_KERNEL_UNITY_GAIN * (end - location) / fadeLength);
+}
+
+// Samples voice `index` moves through in `frames` output frames from
+// where it is now (whole samples, any fraction carried in activePhase).
+static int samplesIn(int index, int frames)
 {
-    memset(buff, 0, size * sizeof(short));
-    pthread_mutex_lock(&audioMutex);
-    for (int i = 0; i < MAX_SOUND_BITES; i++) {
-        if (soundBites[i].pSound == NULL) continue;
-        wavedata_t *pWav = soundBites[i].pSound;
-        int currentLoc = soundBites[i].location;
-        for (int j = 0; j < size; j++) {
-            if (currentLoc >= pWav->numSamples) {
-                soundBites[i].pSound = NULL;
-                break; 
+    return (int)((activePhase[index] + (uint64_t)frames * activeRate[index]) >> 16);
+}
+
+// Output frames voice `index` plays from `location` (its current sample)
+// before reaching `sample`; 0 if it already has.
+static int framesUntil(int index, int location, int sample)
+{
+    int64_t distance = (int64_t)(sample - location) * MIX_KERNEL_UNITY_RATE - activePhase[index];
+    if (distance <= 0) return 0;
+    uint32_t rate = activeRate[index];
+    return (int)((distance + rate - 1) / rate);
+}
+
+// Add `count` samples of voice `index`, from sample `location` of its
+// sound on, at busOffset in pOut or, if that is NULL, the bus. Blocks its
+// sound's peaks show to be silent are skipped; only at the sound's own
+// rate do output frames line up with those blocks.
+static void addAudible(int index, int location, short *pOut, int busOffset, const short *pSamples,
+    int count)
+{
+    const uint16_t *pPeaks = activeSound[index]->pPeaks;
+    bool skip = pPeaks && activeRate[index] == MIX_KERNEL_UNITY_RATE;
+    int from = 0;
+    while (from < count) {
+        int to = count;
+        if (skip) {
+            int blockEnd = ((location + from) / AUDIOMIXER_PEAK_BLOCK + 1) * AUDIOMIXER_PEAK_BLOCK - location;
+            if (pPeaks[(location + from) / AUDIOMIXER_PEAK_BLOCK] == 0) {
+                from = blockEnd;
+                continue;
             }
-            int sample = (int)buff[j] + (int)pWav->pData[currentLoc];
-            if (sample > SHRT_MAX) sample = SHRT_MAX;
-            else if (sample < SHRT_MIN) sample = SHRT_MIN;
-            buff[j] = (short)sample;
-            currentLoc++;
+            // Up to the next silent block.
+            to = blockEnd;
+            while (to < count && pPeaks[(location + to) / AUDIOMIXER_PEAK_BLOCK] != 0) {
+                to += AUDIOMIXER_PEAK_BLOCK;
+            }
+            if (to > count) to = count;
+        }
+        if (pOut) {
+            MixKernel_add(pOut + busOffset + from, pSamples + from, to - from);
+        } else {
+            MixKernel_accumulate(mixBus + busOffset + from, pSamples + from, to - from);
         }
-        if (soundBites[i].pSound != NULL) soundBites[i].location = currentLoc;
+        from = to;
     }
-    pthread_mutex_unlock(&audioMutex);
 }
 
-void* playbackThread(void* _arg)
+// Mix voice `index` into the first `size` frames of the bus, or of pOut
+// (16-bit, no clamping) if that is given. Returns true once the voice has
+// played to its end.
+static bool mixVoice(int index, int size, short *pOut)
 {
-    (void)_arg;
-    while (!stopping) {
-        fillPlaybackBuffer(playbackBuffer, playbackBufferSize);
-        snd_pcm_sframes_t frames = snd_pcm_writei(handle, playbackBuffer, playbackBufferSize);
-        
+    int location = activeLocation[index];
+    int busOffset = 0;
+    if (location < 0) {
+        // Starts -location frames into this buffer.
+        busOffset = -location;
+        location = activeOffset[index];
+    }
+
+    wavedata_t *pSound = activeSound[index];
+    int end = activeEnd[index];
+    bool resampled = activeRate[index] != MIX_KERNEL_UNITY_RATE;
+    int count = framesUntil(index, location, end);
+    if (count > size - busOffset) count = size - busOffset;
+    // Samples played through in this buffer, and those read: interpolating
+    // reads one past the last position. Past the end of the sound that
+    // sample is silence.
+    int advance = samplesIn(index, count);
+    int span = resampled && count > 0 ? samplesIn(index, count - 1) + 2 : advance;
+    int available = pSound->numSamples - location;
+    int fetch = span < available ? span : available;
+
+    // Samples [location, location + span) of the sound.
+    const short *pSamples;
+    if (pSound->pAdpcm) {
+        // The voice's decoder moves on by what is played; a sample read
+        // beyond that is decoded on a copy.
+        int played = advance < available ? advance : available;
+        Adpcm_decode(&activeDecoder[index], pSound->pAdpcm, decodeBuffer, played);
+        if (played < fetch) {
+            adpcmDecoder_t decoder = activeDecoder[index];
+            Adpcm_decode(&decoder, pSound->pAdpcm, decodeBuffer + played, fetch - played);
+        }
+        pSamples = decodeBuffer;
+    } else if (pSound->pStream) {
+        int got = AudioStream_copy(pSound->pStream, location, decodeBuffer, fetch);
+        if (got < fetch) {
+            // The disk fell behind: play silence rather than wait.
+            memset(decodeBuffer + got, 0, (size_t)(fetch - got) * sizeof(short));
+            atomic_fetch_add_explicit(&streamUnderruns, fetch - got, memory_order_relaxed);
+        }
+        AudioStream_advance(pSound->pStream, location + advance);
+        pSamples = decodeBuffer;
+    } else if (fetch < span) {
+        memcpy(decodeBuffer, pSound->pData + location, (size_t)fetch * sizeof(short));
+        pSamples = decodeBuffer;
+    } else {
+        pSamples = pSound->pData + location;
+    }
+    if (fetch < span) {
+        memset(decodeBuffer + fetch, 0, (size_t)(span - fetch) * sizeof(short));
+    }
+    if (resampled) {
+        MixKernel_resample(resampleBuffer, pSamples, count, activePhase[index], activeRate[index]);
+        pSamples = resampleBuffer;
+    }
+
+    int plain = framesUntil(index, location, activeFadeStart[index]);
+    if (plain > count) plain = count;
+    addAudible(index, location, pOut, busOffset, pSamples, plain);
+    if (plain < count) {
+        // Cut off: fade linearly to silence at activeEnd.
+        int fadeLength = end - activeFadeStart[index];
+        int from = location + samplesIn(index, plain);
+        int to = location + advance < end ? location + advance : end;
+        int32_t gainFrom = fadeGain(from, end, fadeLength);
+        int32_t gainTo = fadeGain(to, end, fadeLength);
+        if (pOut) {
+            MixKernel_addRamp(pOut + busOffset + plain, pSamples + plain, count - plain, gainFrom, gainTo);
+        } else {
+            MixKernel_accumulateRamp(mixBus + busOffset + plain, pSamples + plain, count - plain,
+                gainFrom, gainTo);
+        }
+    }
+
+    activePhase[index] = (uint32_t)((activePhase[index] + (uint64_t)count * activeRate[index]) & 0xffff);
+    location += advance;
+    activeLocation[index] = location;
+    return location >= end;
+}
+
+// The sample voice `index` is at by frame `frame` of this buffer, or -1 if
+// it only starts at that frame or later. A voice taking over part way
+// through a sound has been sounding all along.
+static int positionAt(int index, int frame)
+{
+    int location = activeLocation[index];
+    int offset = activeOffset[index];
+    if (location < 0) {
+        int elapsed = location + frame;
+        return elapsed > 0 || (elapsed == 0 && offset > 0) ? offset + samplesIn(index, elapsed) : -1;
+    }
+    if (location == 0 && frame == 0) {
+        // Starting right at the top of this buffer.
+        return -1;
+    }
+    return location + samplesIn(index, frame);
+}
+
+// Make voice `index` fade out from sample `location`. Returns false if it
+// already ends by then.
+static bool cutVoice(int index, int location)
+{
+    if (location >= activeFadeStart[index]) {
+        return false;
+    }
+    activeFadeStart[index] = location;
+    // The same fade time at any rate.
+    int fadeSamples = (int)(((uint64_t)CUT_FADE_FRAMES * activeRate[index]) >> 16);
+    if (fadeSamples < 1) fadeSamples = 1;
+    if (location + fadeSamples < activeEnd[index]) {
+        activeEnd[index] = location + fadeSamples;
+    }
+    return true;
+}
+
+// Upper bound on the magnitude of what voice `index` adds to the next
+// `size` frames, from its sound's block peaks: every sample it reads,
+// interpolation's extra one included, is in the blocks spanned. Fades and
+// interpolation only ever scale those samples down.
+static int voicePeak(int index, int size)
+{
+    wavedata_t *pSound = activeSound[index];
+    if (pSound->pPeaks == NULL) {
+        return SHRT_MAX + 1;
+    }
+    int location = activeLocation[index];
+    int frames = size;
+    if (location < 0) {
+        frames += location;
+        location = activeOffset[index];
+    }
+    int last = location + samplesIn(index, frames) + 1;
+    if (last >= pSound->numSamples) last = pSound->numSamples - 1;
+    int peak = 0;
+    for (int block = location / AUDIOMIXER_PEAK_BLOCK; block <= last / AUDIOMIXER_PEAK_BLOCK; block++) {
+        if (pSound->pPeaks[block] > peak) peak = pSound->pPeaks[block];
+    }
+    return peak;
+}
+
+// Whether the active voices' peaks add up to no more than full scale over
+// the next `size` frames, so that their sum needs no 32-bit headroom.
+static bool cannotClip(int size)
+{
+    int sum = 0;
+    for (int i = 0; i < activeCount; i++) {
+        sum += voicePeak(i, size);
+        if (sum > SHRT_MAX) return false;
+    }
+    return true;
+}
+
+static int upcomingPeak(int index)
+{
+    wavedata_t *pSound = activeSound[index];
+    int location = activeLocation[index] < 0 ? activeOffset[index] : activeLocation[index];
+    int count = activeEnd[index] - location;
+    if (count > QUIET_SCAN_FRAMES) count = QUIET_SCAN_FRAMES;
+    short decoded[QUIET_SCAN_FRAMES];
+    const short *pSamples = decoded;
+    if (pSound->pAdpcm) {
+        // Decode ahead on a copy: the voice's own decoder must not move.
+        adpcmDecoder_t decoder = activeDecoder[index];
+        Adpcm_decode(&decoder, pSound->pAdpcm, decoded, count);
+    } else if (pSound->pStream) {
+        count = AudioStream_copy(pSound->pStream, location, decoded, count);
+    } else {
+        pSamples = pSound->pData + location;
+    }
+    int peak = 0;
+    for (int i = 0; i < count; i++) {
+        int sample = abs(pSamples[i]);
+        if (sample > peak) peak = sample;
+    }
+    return peak;
+}
+
+// Pick the voice a new sound of `priority` may take over: the lowest
+// priority first, then by the steal policy. Returns -1 if none qualifies.
+static int findVoiceToSteal(int priority)
+{
+    if (config.stealPolicy == AUDIOMIXER_STEAL_NONE) {
+        return -1;
+    }
+    int victim = -1;
+    int victimPriority = 0;
+    long long victimScore = 0;
+    for (int i = 0; i < activeCount; i++) {
+        int voicePriority = activeSound[i]->priority;
+        if (voicePriority > priority) continue;
+        // Higher score = better to steal.
+        long long score = (config.stealPolicy == AUDIOMIXER_STEAL_OLDEST)
+            ? -activeStartFrame[i] : -upcomingPeak(i);
+        if (victim < 0 || voicePriority < victimPriority
+                || (voicePriority == victimPriority && score > victimScore)) {
+            victim = i;
+            victimPriority = voicePriority;
+            victimScore = score;
+        }
+    }
+    return victim;
+}
+
+static void clearBus(int size)
+{
+    if (!busCleared) {
+        memset(mixBus, 0, size * sizeof(*mixBus));
+        busCleared = true;
+    }
+}
+
+// Free voice `index` for a new sound. One that is already sounding gets
+// its fade-out mixed into the start of this buffer first.
+static void stealVoice(int index, int size)
+{
+    if (activeLocation[index] > 0) {
+        cutVoice(index, activeLocation[index]);
+        clearBus(size);
+        mixVoice(index, size, NULL);
+    }
+    removeActiveVoice(index);
+    atomic_fetch_add_explicit(&stolenVoices, 1, memory_order_relaxed);
+}
+
+// Move newly queued sounds onto the pending list. Playback thread only.
+static void drainVoiceQueue(void)
+{
+    voiceCommand_t command;
+    while (VoiceQueue_pop(&voiceQueue, &command)) {
+        if (pendingCount == MAX_PENDING) {
+            atomic_fetch_add_explicit(&droppedVoices, 1, memory_order_relaxed);
+            releaseSound(command.pSound);
+            continue;
+        }
+        pendingSound[pendingCount] = command.pSound;
+        pendingStart[pendingCount] = command.startFrame;
+        pendingOffset[pendingCount] = command.offset;
+        pendingRate[pendingCount] = command.rate ? command.rate : MIX_KERNEL_UNITY_RATE;
+        pendingStop[pendingCount] = command.stop;
+        pendingTriggerNs[pendingCount] = command.triggerNs;
+        pendingQueuedNs[pendingCount] = command.queuedNs;
+        pendingCount++;
+    }
+}
+
+static void removePending(int p)
+{
+    pendingCount--;
+    pendingSound[p] = pendingSound[pendingCount];
+    pendingStart[p] = pendingStart[pendingCount];
+    pendingOffset[p] = pendingOffset[pendingCount];
+    pendingRate[p] = pendingRate[pendingCount];
+    pendingStop[p] = pendingStop[pendingCount];
+    pendingTriggerNs[p] = pendingTriggerNs[pendingCount];
+    pendingQueuedNs[p] = pendingQueuedNs[pendingCount];
+}
+
+static bool isPlaying(const wavedata_t *pSound)
+{
+    for (int i = 0; i < activeCount; i++) {
+        if (activeSound[i] == pSound) return true;
+    }
+    return false;
+}
+
+// A live hit's voice starts `frame` frames into the buffer at bufferFrame,
+// which is being mixed now: work out when that frame leaves the DAC.
+static void recordHit(long long triggerNs, long long queuedNs, long long bufferFrame, int frame)
+{
+    if (!pSink->realtime) {
+        return;
+    }
+    long long now = getTimeInNs();
+    long long ahead;
+    if (config.renderAhead > 0) {
+        // The writer thread owns the device; go by the position it last
+        // measured, which counts the mixed periods still queued too.
+        ahead = bufferFrame - AudioMixer_getFramePosition();
+    } else {
+        // Everything before bufferFrame has gone to the device already.
+        ahead = pSink->getDelay();
+    }
+    long long dacNs = now + (ahead + frame) * 1000000000LL / latencyInfo.rate;
+    HitLatency_record(triggerNs, queuedNs, now, dacNs);
+}
+
+// Give a voice to each pending sound due in the buffer starting at
+// bufferFrame, stealing one if the mixer is full. A stolen voice fades
+// out into the bus, which then carries the rest of the period.
+static void startDueVoices(long long bufferFrame, int size)
+{
+    int p = 0;
+    while (p < pendingCount) {
+        long long wait = pendingStart[p] - bufferFrame;
+        if (wait >= size || pendingStop[p]) {
+            p++;
+            continue;
+        }
+        wavedata_t *pSound = pendingSound[p];
+        int offset = pendingOffset[p];
+        uint32_t rate = pendingRate[p];
+        long long triggerNs = pendingTriggerNs[p];
+        long long queuedNs = pendingQueuedNs[p];
+        removePending(p);
+
+        if (pSound->pStream && isPlaying(pSound)) {
+            // A stream has one read position, so one voice at a time.
+            atomic_fetch_add_explicit(&droppedVoices, 1, memory_order_relaxed);
+            releaseSound(pSound);
+            continue;
+        }
+        if (activeCount >= maxVoices) {
+            int victim = findVoiceToSteal(pSound->priority);
+            if (victim < 0) {
+                // Every voice outranks this sound: drop the hit.
+                atomic_fetch_add_explicit(&droppedVoices, 1, memory_order_relaxed);
+                releaseSound(pSound);
+                continue;
+            }
+            stealVoice(victim, size);
+        }
+
+        activeSound[activeCount] = pSound;
+        activeLocation[activeCount] = wait > 0 ? -(int)wait : offset;
+        activeOffset[activeCount] = offset;
+        activeEnd[activeCount] = pSound->numSamples;
+        activeFadeStart[activeCount] = pSound->numSamples;
+        activeRate[activeCount] = rate;
+        activePhase[activeCount] = 0;
+        activeStartFrame[activeCount] = bufferFrame + (wait > 0 ? wait : 0);
+        if (pSound->pAdpcm) {
+            Adpcm_seek(&activeDecoder[activeCount], pSound->pAdpcm, offset);
+        }
+        if (pSound->pStream) {
+            AudioStream_rewind(pSound->pStream);
+        }
+        activeCount++;
+        atomic_fetch_add_explicit(&startedVoices, 1, memory_order_relaxed);
+        if (triggerNs > 0) {
+            recordHit(triggerNs, queuedNs, bufferFrame, wait > 0 ? (int)wait : 0);
+        }
+    }
+}
+
+// End pSound's voices at `frame` of this buffer; those yet to start there
+// end before they do.
+static void stopVoices(const wavedata_t *pSound, int frame)
+{
+    for (int i = 0; i < activeCount; i++) {
+        if (activeSound[i] != pSound) continue;
+        int location = positionAt(i, frame);
+        if (location < 0) {
+            // Removed once mixVoice() finds nothing to play.
+            location = activeLocation[i] < 0 ? activeOffset[i] : activeLocation[i];
+        }
+        if (location < activeEnd[i]) activeEnd[i] = location;
+        if (location < activeFadeStart[i]) activeFadeStart[i] = location;
+    }
+}
+
+// Apply the stop commands due in this buffer, after the voices they may
+// cut have been started. Whatever is still pending for the sound is due
+// after the stop, so it goes too.
+static void applyDueStops(long long bufferFrame, int size)
+{
+    int p = 0;
+    while (p < pendingCount) {
+        long long wait = pendingStart[p] - bufferFrame;
+        if (wait >= size || !pendingStop[p]) {
+            p++;
+            continue;
+        }
+        wavedata_t *pSound = pendingSound[p];
+        removePending(p);
+        stopVoices(pSound, wait > 0 ? (int)wait : 0);
+        releaseSound(pSound);
+
+        for (int q = 0; q < pendingCount; ) {
+            if (pendingSound[q] == pSound && !pendingStop[q]) {
+                releaseSound(pSound);
+                removePending(q);
+                continue;
+            }
+            q++;
+        }
+        // The list may have been reordered.
+        p = 0;
+    }
+}
+
+// A voice starting in this buffer cuts off the others in its choke group
+// at the frame it starts, if they were already sounding by then. Voices
+// taking over part way through a sound are not new hits and cut nothing.
+static void applyChokeGroups(int size)
+{
+    for (int j = 0; j < activeCount; j++) {
+        int group = activeSound[j]->chokeGroup;
+        int start = -activeLocation[j];
+        if (group == 0 || activeOffset[j] > 0 || start < 0 || start >= size) continue;
+
+        for (int i = 0; i < activeCount; i++) {
+            if (i == j || activeSound[i]->chokeGroup != group) continue;
+            int location = positionAt(i, start);
+            if (location > 0 && cutVoice(i, location)) {
+                atomic_fetch_add_explicit(&chokedVoices, 1, memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// Whether any pending sound starts, or stops, in the buffer at
+// bufferFrame. A stop with no voice left to cut still has to be applied:
+// until then it holds its sound's voiceRefs and keeps the output awake.
+static bool voicesDue(long long bufferFrame, int size)
+{
+    for (int p = 0; p < pendingCount; p++) {
+        if (pendingStart[p] - bufferFrame < size) return true;
+    }
+    return false;
+}
+
+static void fillPlaybackBuffer(short *buff, int size)
+{
+    drainVoiceQueue();
+    long long bufferFrame = atomic_load_explicit(&framesRendered, memory_order_relaxed);
+    if (activeCount == 0 && !voicesDue(bufferFrame, size)) {
+        // Nothing playing: silence needs no mix, gain or saturation pass,
+        // and a volume change has nothing to ramp.
+        memset(buff, 0, size * sizeof(*buff));
+        currentGain = atomic_load_explicit(&targetGain, memory_order_relaxed);
+        atomic_store_explicit(&publishedActive, 0, memory_order_relaxed);
+        atomic_fetch_add_explicit(&idlePeriods, 1, memory_order_relaxed);
+        idleFrames += size;
+        return;
+    }
+    idleFrames = 0;
+
+    busCleared = false;
+    startDueVoices(bufferFrame, size);
+    applyDueStops(bufferFrame, size);
+    applyChokeGroups(size);
+
+    // A stolen voice has already faded out into the bus.
+    short *pOut = NULL;
+    if (!busCleared && cannotClip(size)) {
+        pOut = buff;
+        memset(buff, 0, size * sizeof(*buff));
+        atomic_fetch_add_explicit(&unclampedPeriods, 1, memory_order_relaxed);
+    } else {
+        clearBus(size);
+    }
+
+    int i = 0;
+    while (i < activeCount) {
+        if (mixVoice(i, size, pOut)) {
+            // Finished: the last voice moves into this index, so revisit it.
+            removeActiveVoice(i);
+            continue;
+        }
+        i++;
+    }
+
+    atomic_store_explicit(&publishedActive, activeCount, memory_order_relaxed);
+    if (activeCount > atomic_load_explicit(&peakActive, memory_order_relaxed)) {
+        atomic_store_explicit(&peakActive, activeCount, memory_order_relaxed);
+    }
+
+    int32_t gainStart, gainEnd;
+    bool gained = stepMasterGain(size, &gainStart, &gainEnd);
+    if (pOut) {
+        if (gained) {
+            MixKernel_applyGainRamp16(buff, size, gainStart, gainEnd);
+        }
+        return;
+    }
+    if (gained) {
+        MixKernel_applyGainRamp(mixBus, size, gainStart, gainEnd);
+    }
+    int clipped = MixKernel_saturate(buff, mixBus, size);
+    if (clipped > 0) {
+        atomic_fetch_add_explicit(&clippedSamples, clipped, memory_order_relaxed);
+    }
+}
+
+// Readers swap these back to empty, hence a CAS rather than a plain store.
+static void raiseMax(atomic_llong *pMax, long long value)
+{
+    long long max = atomic_load_explicit(pMax, memory_order_relaxed);
+    while (value > max
+            && !atomic_compare_exchange_weak_explicit(pMax, &max, value,
+                memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+static void lowerMin(atomic_int *pMin, int value)
+{
+    int min = atomic_load_explicit(pMin, memory_order_relaxed);
+    while (value < min
+            && !atomic_compare_exchange_weak_explicit(pMin, &min, value,
+                memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+// DSP load is the mix time over the time the period takes to play.
+static void recordRenderTime(long long renderNs, unsigned long frames)
+{
+    long long loadPpm = (long long)(renderNs / (frames * 1e3 / latencyInfo.rate));
+    atomic_fetch_add_explicit(&statPeriods, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&statRenderNs, renderNs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&statLoadPpm, loadPpm, memory_order_relaxed);
+    for (int i = 0; i < AUDIOMIXER_MAX_STATS_READERS; i++) {
+        raiseMax(&statMaxRenderNs[i], renderNs);
+        raiseMax(&statMaxLoadPpm[i], loadPpm);
+    }
+}
+
+static void recordQueueDepth(int depth)
+{
+    atomic_fetch_add_explicit(&statDepthSum, depth, memory_order_relaxed);
+    atomic_fetch_add_explicit(&statDepthSamples, 1, memory_order_relaxed);
+    for (int i = 0; i < AUDIOMIXER_MAX_STATS_READERS; i++) {
+        lowerMin(&statMinDepth[i], depth);
+    }
+}
+
+// Frames in the next period (fewer at the end of a bounded render, 0 once
+// it is done). Gives the render callback its chance to schedule sounds.
+static unsigned long startPeriod(void)
+{
+    long long firstFrame = atomic_load_explicit(&framesRendered, memory_order_relaxed);
+    unsigned long frames = latencyInfo.periodFrames;
+    if (config.renderFrames > 0 && (long long)frames > config.renderFrames - firstFrame) {
+        frames = (unsigned long)(config.renderFrames - firstFrame);
+    }
+    if (frames > 0 && config.renderCallback) {
+        config.renderCallback(firstFrame, frames, config.pRenderContext);
+    }
+    return frames;
+}
+
+// The sink has just accepted everything up to frame `written`.
+static void markPeriodWritten(long long written)
+{
+    // Position and period timing only mean something against a device clock.
+    if (pSink->realtime) {
+        publishPosition(written - pSink->getDelay());
         Period_markEvent(PERIOD_EVENT_AUDIO_BUFFER);
+    }
+}
+
+// Render one period into the sink, in as many pieces as it hands out.
+// renderNs is the time already spent on the period (the render callback).
+static void renderPeriod(unsigned long remaining, long long renderNs)
+{
+    unsigned long periodFrames = remaining;
+    while (remaining > 0 && !stopping) {
+        unsigned long frames = remaining;
+        short *pBuffer = pSink->acquire(&frames);
+        if (pBuffer == NULL) {
+            // The sink has already waited; stopping is checked above.
+            continue;
+        }
+        long long start = getTimeInNs();
+        fillPlaybackBuffer(pBuffer, frames);
+        renderNs += getTimeInNs() - start;
+        Recorder_capture(pBuffer, frames);
+        pSink->commit(pBuffer, frames);
+        remaining -= frames;
+        atomic_fetch_add_explicit(&framesRendered, frames, memory_order_relaxed);
+    }
+    if (remaining == 0) {
+        recordRenderTime(renderNs, periodFrames);
+    }
+    markPeriodWritten(atomic_load_explicit(&framesRendered, memory_order_relaxed));
+}
 
-        if (frames < 0) frames = snd_pcm_recover(handle, frames, 1);
-        if (frames < 0) {
-            fprintf(stderr, "ERROR: writei failed: %li\n", frames);
+// Pipelined mode: hand each mixed period to the sink. Blocking here (in
+// snd_pcm_writei() or waiting for ring space) no longer holds up mixing.
+static void* writerThread(void* _arg)
+{
+    (void)_arg;
+    ThreadPolicy_apply("audio-out");
+    long long written = 0;
+    unsigned long frames;
+    const short *pBuffer;
+    while ((pBuffer = RenderQueue_beginRead(&renderQueue, &frames)) != NULL) {
+        // How many mixed periods are still in hand: 0 means a mix spike
+        // right now would reach the device.
+        recordQueueDepth(RenderQueue_getDepth(&renderQueue));
+        pSink->write(pBuffer, frames);
+        RenderQueue_endRead(&renderQueue);
+        written += frames;
+        markPeriodWritten(written);
+    }
+    return NULL;
+}
+
+static void runPipelined(void)
+{
+    pthread_create(&writerThreadId, NULL, writerThread, NULL);
+    bool ended = false;
+    while (!stopping && !ended) {
+        short *pBuffer = RenderQueue_beginWrite(&renderQueue);
+        long long start = getTimeInNs();
+        unsigned long frames = startPeriod();
+        if (frames == 0) {
+            RenderQueue_endWrite(&renderQueue, 0);
+            ended = true;
+            continue;
+        }
+        fillPlaybackBuffer(pBuffer, frames);
+        recordRenderTime(getTimeInNs() - start, frames);
+        Recorder_capture(pBuffer, frames);
+        atomic_fetch_add_explicit(&framesRendered, frames, memory_order_relaxed);
+        RenderQueue_endWrite(&renderQueue, frames);
+    }
+    if (!ended) {
+        // End of stream, once the writer has made room for it.
+        RenderQueue_beginWrite(&renderQueue);
+        RenderQueue_endWrite(&renderQueue, 0);
+    }
+    // Everything mixed has been written once the writer exits.
+    pthread_join(writerThreadId, NULL);
+}
+
+// Whether to park before the next period: idle for config.idleParkMs (by
+// then the sink holds nothing but silence) and nothing due to wake it.
+static bool shouldPark(void)
+{
+    if (config.idleParkMs <= 0 || pSink->pause == NULL || pendingCount > 0
+            || idleFrames < (long long)config.idleParkMs * latencyInfo.rate / 1000) {
+        return false;
+    }
+    if (config.renderCallback && !(config.idleCallback && config.idleCallback(config.pRenderContext))) {
+        return false;
+    }
+    Recorder_stats_t recording;
+    Recorder_getStats(&recording);
+    // A recording keeps its silences.
+    return !recording.recording;
+}
+
+// Stop the sink and sleep until woken. Sounds queued, or work given to the
+// render callback, before `parked` is seen set are caught by the checks
+// after it.
+static void park(void)
+{
+    long long start = getTimeInNs();
+    atomic_fetch_add_explicit(&parks, 1, memory_order_relaxed);
+    pSink->pause(true);
+    while (sem_trywait(&wakeParked) == 0) {
+    }
+    atomic_store_explicit(&parked, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    drainVoiceQueue();
+    while (!stopping && pendingCount == 0
+            && (config.renderCallback == NULL || config.idleCallback(config.pRenderContext))) {
+        while (sem_wait(&wakeParked) < 0) {
+        }
+        drainVoiceQueue();
+    }
+    atomic_store_explicit(&parked, false, memory_order_relaxed);
+    pSink->pause(false);
+    idleFrames = 0;
+    atomic_fetch_add_explicit(&parkedNs, getTimeInNs() - start, memory_order_relaxed);
+}
+
+void* playbackThread(void* _arg)
+{
+    (void)_arg;
+    ThreadPolicy_apply("audio");
+    if (config.renderAhead > 0) {
+        runPipelined();
+    } else {
+        while (!stopping) {
+            if (shouldPark()) {
+                park();
+            }
+            long long start = getTimeInNs();
+            unsigned long frames = startPeriod();
+            if (frames == 0) {
+                break;
+            }
+            renderPeriod(frames, getTimeInNs() - start);
         }
     }
+    markRenderDone();
     return NULL;
 }
\ No newline at end of file
@@ -0,0 +1,649 @@
+#define _GNU_SOURCE
+#include "audioSink.h"
+#include "netAudio.h"
+#include "waveFile.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <alsa/asoundlib.h>
+
+#define SAMPLE_RATE WAVEFILE_SAMPLE_RATE
+#define NUM_CHANNELS WAVEFILE_NUM_CHANNELS
+
+// Large stdio buffer for the file sink: a render is written in big bursts.
+#define FILE_SINK_BUFFER_BYTES (256 * 1024)
+
+// Packets per sendmmsg() call: a period of up to this many full packets
+// goes out in one system call.
+#define NET_BATCH_PACKETS 8
+
+// One sink is open at a time (the mixer owns it), so each keeps its state here.
+static unsigned long periodFrames = 0;
+static short *periodBuffer = NULL;
+
+static snd_pcm_t *handle = NULL;
+static snd_pcm_uframes_t mmapOffset = 0;
+static atomic_llong xrunCount = 0;
+static atomic_llong recoveryCount = 0;
+static atomic_llong shortWriteCount = 0;
+
+static FILE *pOutputFile = NULL;
+static const char *outputFileName = NULL;
+static unsigned long long framesWritten = 0;
+static bool writeFailed = false;
+
+static int netSocket = -1;
+static uint32_t netSsrc = 0;
+static uint16_t netSequence = 0;
+// Also the RTP timestamp of the next packet.
+static long long netFramesSent = 0;
+// The wall clock "plays" the stream from frame 0 at netStartNs on; the
+// sink keeps at most netAheadFrames sent ahead of it.
+static long long netStartNs = 0;
+static unsigned long netAheadFrames = 0;
+static uint8_t netPackets[NET_BATCH_PACKETS][NETAUDIO_MAX_PACKET];
+static struct iovec netIovecs[NET_BATCH_PACKETS];
+static struct mmsghdr netMessages[NET_BATCH_PACKETS];
+static atomic_llong packetsSent = 0;
+static atomic_llong bytesSent = 0;
+static atomic_llong sendErrors = 0;
+
+static void allocatePeriodBuffer(void)
+{
+    periodBuffer = malloc(periodFrames * sizeof(*periodBuffer));
+    if (periodBuffer == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate playback buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void freePeriodBuffer(void)
+{
+    free(periodBuffer);
+    periodBuffer = NULL;
+}
+
+// Buffer-backed sinks hand out the same period buffer every time.
+static short *acquirePeriodBuffer(unsigned long *pFrames)
+{
+    if (*pFrames > periodFrames) {
+        *pFrames = periodFrames;
+    }
+    return periodBuffer;
+}
+
+
+/*
+ * ALSA
+ */
+static void checkPcm(int err, const char *what)
+{
+    if (err < 0) {
+        printf("Playback open error (%s): %s\n", what, snd_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Ask the device for our period size and count, rather than just a total
+// latency, so small periods can be requested explicitly. The device may
+// round both; the values it grants are read back.
+static void configurePcm(const AudioMixer_config_t *pConfig, snd_pcm_access_t access,
+        AudioMixer_latencyInfo_t *pInfo)
+{
+    snd_pcm_hw_params_t *hwParams;
+    snd_pcm_hw_params_alloca(&hwParams);
+    checkPcm(snd_pcm_hw_params_any(handle, hwParams), "no configurations");
+    checkPcm(snd_pcm_hw_params_set_rate_resample(handle, hwParams, 1), "resample");
+    checkPcm(snd_pcm_hw_params_set_access(handle, hwParams, access), "access");
+    checkPcm(snd_pcm_hw_params_set_format(handle, hwParams, SND_PCM_FORMAT_S16_LE), "format");
+    checkPcm(snd_pcm_hw_params_set_channels(handle, hwParams, NUM_CHANNELS), "channels");
+    unsigned int rate = SAMPLE_RATE;
+    checkPcm(snd_pcm_hw_params_set_rate_near(handle, hwParams, &rate, NULL), "rate");
+    if (rate != SAMPLE_RATE) {
+        printf("Playback open error: device runs at %u Hz, need %d Hz (try plughw:)\n", rate, SAMPLE_RATE);
+        exit(EXIT_FAILURE);
+    }
+    snd_pcm_uframes_t grantedPeriod = pConfig->periodFrames;
+    checkPcm(snd_pcm_hw_params_set_period_size_near(handle, hwParams, &grantedPeriod, NULL), "period size");
+    unsigned int numPeriods = pConfig->numPeriods;
+    checkPcm(snd_pcm_hw_params_set_periods_near(handle, hwParams, &numPeriods, NULL), "periods");
+    checkPcm(snd_pcm_hw_params(handle, hwParams), "hw params");
+
+    snd_pcm_hw_params_get_period_size(hwParams, &grantedPeriod, NULL);
+    snd_pcm_uframes_t bufferFrames = 0;
+    snd_pcm_hw_params_get_buffer_size(hwParams, &bufferFrames);
+    pInfo->periodFrames = grantedPeriod;
+    pInfo->bufferFrames = bufferFrames;
+    pInfo->rate = rate;
+
+    // Start once the ring is full; wake the writer a period at a time.
+    snd_pcm_sw_params_t *swParams;
+    snd_pcm_sw_params_alloca(&swParams);
+    checkPcm(snd_pcm_sw_params_current(handle, swParams), "sw params");
+    checkPcm(snd_pcm_sw_params_set_start_threshold(handle, swParams, bufferFrames), "start threshold");
+    checkPcm(snd_pcm_sw_params_set_avail_min(handle, swParams, grantedPeriod), "avail min");
+    checkPcm(snd_pcm_sw_params(handle, swParams), "sw params");
+}
+
+// snd_pcm_recover(), counting underruns (-EPIPE) on the way.
+static int recoverPcm(int err)
+{
+    if (err == -EPIPE) {
+        atomic_fetch_add_explicit(&xrunCount, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&recoveryCount, 1, memory_order_relaxed);
+    int result = snd_pcm_recover(handle, err, 1);
+    if (result < 0) {
+        // Not recoverable for now (e.g. a USB device unplugged). Wait out a
+        // period before the caller tries again, so the SCHED_FIFO playback
+        // thread cannot spin on the failure and starve everything else.
+        long long waitNs = (long long)periodFrames * 1000000000LL / SAMPLE_RATE;
+        struct timespec wait = { .tv_sec = waitNs / 1000000000LL, .tv_nsec = waitNs % 1000000000LL };
+        nanosleep(&wait, NULL);
+    }
+    return result;
+}
+
+void AudioSink_getCounters(audioSinkCounters_t *pCounters)
+{
+    pCounters->xruns = atomic_load_explicit(&xrunCount, memory_order_relaxed);
+    pCounters->recoveries = atomic_load_explicit(&recoveryCount, memory_order_relaxed);
+    pCounters->shortWrites = atomic_load_explicit(&shortWriteCount, memory_order_relaxed);
+    pCounters->packetsSent = atomic_load_explicit(&packetsSent, memory_order_relaxed);
+    pCounters->bytesSent = atomic_load_explicit(&bytesSent, memory_order_relaxed);
+    pCounters->sendErrors = atomic_load_explicit(&sendErrors, memory_order_relaxed);
+}
+
+// Mix into a private buffer; snd_pcm_writei() copies it into the driver's
+// ring buffer, blocking while the ring is full.
+// A short write (e.g. interrupted by a signal) is finished off; after an
+// error the rest of the buffer is dropped.
+static void alsaWriteWritei(const short *pBuffer, unsigned long frames)
+{
+    while (frames > 0) {
+        snd_pcm_sframes_t written = snd_pcm_writei(handle, pBuffer, frames);
+        if (written < 0) {
+            int err = recoverPcm(written);
+            if (err < 0) {
+                fprintf(stderr, "ERROR: writei failed: %s\n", snd_strerror(err));
+            }
+            return;
+        }
+        if ((unsigned long)written < frames) {
+            atomic_fetch_add_explicit(&shortWriteCount, 1, memory_order_relaxed);
+        }
+        pBuffer += written;
+        frames -= written;
+    }
+}
+
+static void alsaCommitWritei(short *pBuffer, unsigned long frames)
+{
+    alsaWriteWritei(pBuffer, frames);
+}
+
+// Mix directly into the mmap'd ring buffer (no intermediate copy). A
+// period may wrap around the end of the ring, in which case the caller
+// gets it in two pieces. *pFailed is set when the device is not coming
+// back for now: a recovery failed, or a second went by with no space.
+static short *acquireMmap(unsigned long *pFrames, bool *pFailed)
+{
+    *pFailed = false;
+    snd_pcm_sframes_t avail = snd_pcm_avail_update(handle);
+    if (avail < 0) {
+        int err = recoverPcm(avail);
+        if (err < 0) {
+            fprintf(stderr, "ERROR: avail_update failed: %s\n", snd_strerror(err));
+            *pFailed = true;
+        }
+        return NULL;
+    }
+    if ((snd_pcm_uframes_t)avail < *pFrames) {
+        // Ring is full: make sure it is playing, then sleep until space frees up.
+        if (snd_pcm_state(handle) == SND_PCM_STATE_PREPARED) {
+            snd_pcm_start(handle);
+        }
+        int err = snd_pcm_wait(handle, 1000);
+        if (err < 0) {
+            *pFailed = recoverPcm(err) < 0;
+        } else if (err == 0) {
+            *pFailed = true;
+        }
+        return NULL;
+    }
+
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t frames = *pFrames;
+    int err = snd_pcm_mmap_begin(handle, &areas, &mmapOffset, &frames);
+    if (err < 0) {
+        *pFailed = recoverPcm(err) < 0;
+        return NULL;
+    }
+    *pFrames = frames;
+    // Mono S16 interleaved: one contiguous run of shorts.
+    return (short *)((char *)areas[0].addr + areas[0].first / 8) + mmapOffset * (areas[0].step / 16);
+}
+
+// The playback loop retries until it gets space, or the mixer stops.
+static short *alsaAcquireMmap(unsigned long *pFrames)
+{
+    bool failed;
+    return acquireMmap(pFrames, &failed);
+}
+
+static void alsaCommitMmap(short *pBuffer, unsigned long frames)
+{
+    (void)pBuffer;
+    snd_pcm_sframes_t committed = snd_pcm_mmap_commit(handle, mmapOffset, frames);
+    if (committed >= 0 && (snd_pcm_uframes_t)committed != frames) {
+        atomic_fetch_add_explicit(&shortWriteCount, 1, memory_order_relaxed);
+    }
+    if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+        recoverPcm(committed < 0 ? committed : -EPIPE);
+    }
+}
+
+// Already rendered elsewhere: copy it into the ring a piece at a time.
+// Once the device has failed the rest is dropped, as alsaWriteWritei()
+// does, so the writer thread can still see the mixer stop.
+static void alsaWriteMmap(const short *pBuffer, unsigned long frames)
+{
+    while (frames > 0) {
+        unsigned long count = frames;
+        bool failed;
+        short *pDest = acquireMmap(&count, &failed);
+        if (failed) {
+            return;
+        }
+        if (pDest == NULL) {
+            continue;
+        }
+        memcpy(pDest, pBuffer, count * sizeof(*pBuffer));
+        alsaCommitMmap(pDest, count);
+        pBuffer += count;
+        frames -= count;
+    }
+}
+
+static long alsaGetDelay(void)
+{
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(handle, &delay) < 0 || delay < 0) {
+        return 0;
+    }
+    return delay;
+}
+
+// Dropping loses nothing: only silence is queued. Once prepared again the
+// device starts as soon as the mixer has refilled its buffer, which it does
+// without waiting, so a sound that ends the pause is heard at once.
+static void alsaPause(bool paused)
+{
+    int err = paused ? snd_pcm_drop(handle) : snd_pcm_prepare(handle);
+    if (err < 0) {
+        fprintf(stderr, "ERROR: Unable to %s the PCM: %s\n", paused ? "stop" : "restart", snd_strerror(err));
+    }
+}
+
+static void alsaClose(void)
+{
+    snd_pcm_drain(handle);
+    snd_pcm_close(handle);
+    handle = NULL;
+    freePeriodBuffer();
+}
+
+static const audioSink_t alsaWriteiSink = {
+    .name = "alsa",
+    .realtime = true,
+    .acquire = acquirePeriodBuffer,
+    .commit = alsaCommitWritei,
+    .write = alsaWriteWritei,
+    .getDelay = alsaGetDelay,
+    .pause = alsaPause,
+    .close = alsaClose,
+};
+
+static const audioSink_t alsaMmapSink = {
+    .name = "alsa-mmap",
+    .realtime = true,
+    .acquire = alsaAcquireMmap,
+    .commit = alsaCommitMmap,
+    .write = alsaWriteMmap,
+    .getDelay = alsaGetDelay,
+    .pause = alsaPause,
+    .close = alsaClose,
+};
+
+static const audioSink_t *openAlsa(const AudioMixer_config_t *pConfig, AudioMixer_latencyInfo_t *pInfo)
+{
+    atomic_store(&xrunCount, 0);
+    atomic_store(&recoveryCount, 0);
+    atomic_store(&shortWriteCount, 0);
+    int err = snd_pcm_open(&handle, pConfig->device, SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0) {
+        printf("Playback open error: %s\n", snd_strerror(err));
+        exit(EXIT_FAILURE);
+    }
+
+    bool useMmap = (pConfig->outputMode == AUDIOMIXER_OUTPUT_MMAP);
+    configurePcm(pConfig, useMmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED : SND_PCM_ACCESS_RW_INTERLEAVED, pInfo);
+    printf("Audio on \"%s\": period %lu frames, buffer %lu frames @ %u Hz, latency %.1f ms\n",
+        pConfig->device, pInfo->periodFrames, pInfo->bufferFrames, pInfo->rate,
+        pInfo->bufferFrames * 1000.0 / pInfo->rate);
+
+    // In mmap mode the mix is rendered straight into ALSA's ring buffer.
+    periodFrames = pInfo->periodFrames;
+    if (useMmap) {
+        return &alsaMmapSink;
+    }
+    allocatePeriodBuffer();
+    return &alsaWriteiSink;
+}
+
+
+/*
+ * Null: render and discard.
+ */
+static void nullCommit(short *pBuffer, unsigned long frames)
+{
+    (void)pBuffer;
+    (void)frames;
+}
+
+static void nullWrite(const short *pBuffer, unsigned long frames)
+{
+    (void)pBuffer;
+    (void)frames;
+}
+
+// Offline output is "played" the moment it is committed.
+static long noDelay(void)
+{
+    return 0;
+}
+
+static const audioSink_t nullSink = {
+    .name = "null",
+    .realtime = false,
+    .acquire = acquirePeriodBuffer,
+    .commit = nullCommit,
+    .write = nullWrite,
+    .getDelay = noDelay,
+    .close = freePeriodBuffer,
+};
+
+
+/*
+ * WAV file: offline render.
+ */
+static void fileWrite(const short *pBuffer, unsigned long frames)
+{
+    if (writeFailed) return;
+    if (fwrite(pBuffer, sizeof(*pBuffer), frames, pOutputFile) != frames) {
+        fprintf(stderr, "ERROR: Unable to write %s.\n", outputFileName);
+        writeFailed = true;
+        return;
+    }
+    framesWritten += frames;
+}
+
+static void fileCommit(short *pBuffer, unsigned long frames)
+{
+    fileWrite(pBuffer, frames);
+}
+
+// Now that the length is known, go back and fill in the header sizes.
+static void fileClose(void)
+{
+    if (fseek(pOutputFile, 0, SEEK_SET) != 0
+            || !WaveFile_writeHeader(pOutputFile, (uint32_t)framesWritten)) {
+        fprintf(stderr, "ERROR: Unable to finish %s.\n", outputFileName);
+    }
+    fclose(pOutputFile);
+    pOutputFile = NULL;
+    printf("Rendered %llu frames (%.2f s) to %s\n",
+        framesWritten, (double)framesWritten / SAMPLE_RATE, outputFileName);
+    freePeriodBuffer();
+}
+
+static const audioSink_t fileSink = {
+    .name = "file",
+    .realtime = false,
+    .acquire = acquirePeriodBuffer,
+    .commit = fileCommit,
+    .write = fileWrite,
+    .getDelay = noDelay,
+    .close = fileClose,
+};
+
+static const audioSink_t *openFile(const AudioMixer_config_t *pConfig)
+{
+    outputFileName = pConfig->outputFile;
+    pOutputFile = outputFileName ? fopen(outputFileName, "wb") : NULL;
+    if (pOutputFile == NULL) {
+        fprintf(stderr, "ERROR: Unable to create output file %s.\n",
+            outputFileName ? outputFileName : "(none)");
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(pOutputFile, NULL, _IOFBF, FILE_SINK_BUFFER_BYTES);
+    framesWritten = 0;
+    writeFailed = false;
+    // Placeholder sizes; rewritten by fileClose().
+    if (!WaveFile_writeHeader(pOutputFile, 0)) {
+        fprintf(stderr, "ERROR: Unable to write %s.\n", outputFileName);
+        exit(EXIT_FAILURE);
+    }
+    return &fileSink;
+}
+
+
+/*
+ * Network: RTP over UDP, paced by the wall clock like a sound card with
+ * a buffer of numPeriods periods. The receiver's jitter buffer does the
+ * rest.
+ */
+static long long getMonotonicNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+// Frames the wall clock has played by nowNs.
+static long long netFramesPlayed(long long nowNs)
+{
+    return (nowNs - netStartNs) * SAMPLE_RATE / 1000000000LL;
+}
+
+// Block until `frames` more fit within netAheadFrames of the wall clock.
+// Having fallen behind it (the far end ran dry) counts as an xrun and
+// restarts the clock from here.
+static void netWaitForSpace(unsigned long frames)
+{
+    long long nowNs = getMonotonicNs();
+    if (netFramesSent == 0 || netFramesPlayed(nowNs) > netFramesSent) {
+        if (netFramesSent > 0) {
+            atomic_fetch_add_explicit(&xrunCount, 1, memory_order_relaxed);
+        }
+        netStartNs = nowNs - netFramesSent * 1000000000LL / SAMPLE_RATE;
+        return;
+    }
+    long long dueFrame = netFramesSent + (long long)frames - (long long)netAheadFrames;
+    long long dueNs = netStartNs + dueFrame * 1000000000LL / SAMPLE_RATE;
+    if (dueNs > nowNs) {
+        struct timespec spec = { .tv_sec = dueNs / 1000000000LL, .tv_nsec = dueNs % 1000000000LL };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL) == EINTR) {
+        }
+    }
+}
+
+// Send the first `count` packets in netPackets. A failed send (e.g.
+// ECONNREFUSED while nothing listens at the far end) drops the rest.
+static void netSendBatch(int count)
+{
+    int done = 0;
+    long long bytes = 0;
+    while (done < count) {
+        int sent = sendmmsg(netSocket, &netMessages[done], count - done, 0);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            atomic_fetch_add_explicit(&sendErrors, count - done, memory_order_relaxed);
+            break;
+        }
+        for (int i = done; i < done + sent; i++) {
+            bytes += netMessages[i].msg_len;
+        }
+        done += sent;
+    }
+    atomic_fetch_add_explicit(&packetsSent, done, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytesSent, bytes, memory_order_relaxed);
+}
+
+// Packetize and send, up to NET_BATCH_PACKETS packets per system call.
+static void netSend(const short *pBuffer, unsigned long frames)
+{
+    while (frames > 0) {
+        long long sentNs = NetAudio_getRealTimeNs();
+        int count = 0;
+        while (frames > 0 && count < NET_BATCH_PACKETS) {
+            int packetFrames = frames < NETAUDIO_MAX_FRAMES ? (int)frames : NETAUDIO_MAX_FRAMES;
+            NetAudio_header_t header = {
+                .sequence = netSequence++,
+                .timestamp = (uint32_t)netFramesSent,
+                .ssrc = netSsrc,
+                .sentNs = sentNs,
+                .numFrames = packetFrames,
+            };
+            netIovecs[count].iov_len = NetAudio_pack(&header, pBuffer, netPackets[count]);
+            count++;
+            pBuffer += packetFrames;
+            frames -= packetFrames;
+            netFramesSent += packetFrames;
+        }
+        netSendBatch(count);
+    }
+}
+
+static short *netAcquire(unsigned long *pFrames)
+{
+    short *pBuffer = acquirePeriodBuffer(pFrames);
+    netWaitForSpace(*pFrames);
+    return pBuffer;
+}
+
+static void netCommit(short *pBuffer, unsigned long frames)
+{
+    netSend(pBuffer, frames);
+}
+
+static void netWrite(const short *pBuffer, unsigned long frames)
+{
+    while (frames > 0) {
+        unsigned long count = frames < periodFrames ? frames : periodFrames;
+        netWaitForSpace(count);
+        netSend(pBuffer, count);
+        pBuffer += count;
+        frames -= count;
+    }
+}
+
+static long netGetDelay(void)
+{
+    long long delay = netFramesSent - netFramesPlayed(getMonotonicNs());
+    return delay < 0 ? 0 : (long)delay;
+}
+
+// Silence suppression: nothing is sent while paused. The stream's clock
+// runs on regardless, so the first packet after the pause carries the
+// timestamp it would have had, and its send time, rather than counting
+// the gap as falling behind.
+static void netPause(bool paused)
+{
+    if (!paused) {
+        long long played = netFramesPlayed(getMonotonicNs());
+        if (played > netFramesSent) {
+            netFramesSent = played;
+        }
+    }
+}
+
+static void netClose(void)
+{
+    close(netSocket);
+    netSocket = -1;
+    freePeriodBuffer();
+}
+
+static const audioSink_t netSink = {
+    .name = "network",
+    .realtime = true,
+    .acquire = netAcquire,
+    .commit = netCommit,
+    .write = netWrite,
+    .getDelay = netGetDelay,
+    .pause = netPause,
+    .close = netClose,
+};
+
+static const audioSink_t *openNetwork(const AudioMixer_config_t *pConfig, AudioMixer_latencyInfo_t *pInfo)
+{
+    struct sockaddr_in address;
+    if (pConfig->netTarget == NULL || !NetAudio_parseAddress(pConfig->netTarget, &address)) {
+        fprintf(stderr, "ERROR: No address to stream to.\n");
+        exit(EXIT_FAILURE);
+    }
+    // Connected, so sendmmsg() needs no addresses and a receiver that is
+    // not there yet shows up as ECONNREFUSED.
+    netSocket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (netSocket < 0 || connect(netSocket, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "ERROR: Unable to stream to %s: %s.\n", pConfig->netTarget, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < NET_BATCH_PACKETS; i++) {
+        netIovecs[i].iov_base = netPackets[i];
+        netMessages[i] = (struct mmsghdr){ .msg_hdr = { .msg_iov = &netIovecs[i], .msg_iovlen = 1 } };
+    }
+    netSsrc = (uint32_t)(NetAudio_getRealTimeNs() ^ getpid());
+    netSequence = (uint16_t)netSsrc;
+    netFramesSent = 0;
+    atomic_store(&xrunCount, 0);
+    atomic_store(&packetsSent, 0);
+    atomic_store(&bytesSent, 0);
+    atomic_store(&sendErrors, 0);
+
+    netAheadFrames = (unsigned long)pInfo->periodFrames * (pConfig->numPeriods < 1 ? 1 : pConfig->numPeriods);
+    pInfo->bufferFrames = netAheadFrames;
+    printf("Streaming to %s:%d: period %lu frames, %lu frames ahead (%.1f ms)\n",
+        inet_ntoa(address.sin_addr), ntohs(address.sin_port), pInfo->periodFrames, netAheadFrames,
+        netAheadFrames * 1000.0 / SAMPLE_RATE);
+    return &netSink;
+}
+
+const audioSink_t *AudioSink_open(const AudioMixer_config_t *pConfig, AudioMixer_latencyInfo_t *pInfo)
+{
+    if (pConfig->sink == AUDIOMIXER_SINK_ALSA) {
+        return openAlsa(pConfig, pInfo);
+    }
+
+    // The other sinks take the requested period as is; offline ones queue
+    // nothing beyond the period being rendered.
+    periodFrames = pConfig->periodFrames;
+    pInfo->periodFrames = periodFrames;
+    pInfo->bufferFrames = periodFrames;
+    pInfo->rate = SAMPLE_RATE;
+    allocatePeriodBuffer();
+    if (pConfig->sink == AUDIOMIXER_SINK_WAVE_FILE) {
+        return openFile(pConfig);
+    }
+    if (pConfig->sink == AUDIOMIXER_SINK_NETWORK) {
+        return openNetwork(pConfig, pInfo);
+    }
+    return &nullSink;
+}
@@ -0,0 +1,290 @@
+#include "audioStream.h"
+#include "waveFile.h"
+#include "hal/threadPolicy.h"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_STREAMS 8
+
+// Positions are frames from the start of the file. The head holds frames
+// [0, headFrames); the ring holds frames from headFrames on, frame f in
+// slot (f - headFrames) % AUDIOSTREAM_RING_FRAMES, and is refilled a
+// chunk at a time (chunks never wrap, as the ring is a whole number of
+// chunks).
+//
+// The playback thread owns `generation` and publishes readPos; the reader
+// owns the ring contents and publishes `written` (generation in the top
+// half, frames written in the bottom half). A rewind bumps the generation:
+// until the reader has restarted under it, whatever is in the ring counts
+// as not there.
+struct audioStream {
+    int fd;
+    off_t dataOffset;
+    int numSamples;
+    int headFrames;
+    short *head;
+    short *ring;
+
+    uint32_t generation;            // Playback thread only
+    bool played;                    // Playback thread only
+    atomic_uint requestedGeneration;
+    atomic_int readPos;
+    atomic_llong written;
+
+    uint32_t readerGeneration;      // Reader thread only
+    int writePos;
+    bool readFailed;
+};
+
+// open() and close() hold openMutex throughout, so starting and stopping
+// the reader never overlap; the reader itself only takes streamsMutex.
+static pthread_mutex_t openMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t streamsMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct audioStream *streams[MAX_STREAMS];
+static int numStreams = 0;
+static pthread_t readerThreadId;
+static bool stopping = false;
+// Posted whenever a stream needs attention: space freed up or a rewind.
+static sem_t wakeReader;
+
+static long long packWritten(uint32_t generation, int position)
+{
+    return (long long)((uint64_t)generation << 32 | (uint32_t)position);
+}
+
+static int readFrames(struct audioStream *pStream, short *pOut, int position, int count)
+{
+    size_t bytes = (size_t)count * sizeof(short);
+    off_t offset = pStream->dataOffset + (off_t)position * (off_t)sizeof(short);
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = pread(pStream->fd, (char *)pOut + done, bytes - done, offset + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    return (int)(done / sizeof(short));
+}
+
+// Top up one stream's ring. Reader thread, with streamsMutex held.
+static void fillStream(struct audioStream *pStream)
+{
+    uint32_t generation = atomic_load_explicit(&pStream->requestedGeneration, memory_order_acquire);
+    if (generation != pStream->readerGeneration) {
+        pStream->readerGeneration = generation;
+        pStream->writePos = pStream->headFrames;
+        atomic_store_explicit(&pStream->written, packWritten(generation, pStream->writePos),
+            memory_order_release);
+    }
+
+    while (pStream->writePos < pStream->numSamples && !pStream->readFailed) {
+        int readPos = atomic_load_explicit(&pStream->readPos, memory_order_acquire);
+        if (readPos < pStream->headFrames) readPos = pStream->headFrames;
+        if (readPos > pStream->writePos) {
+            // Playback ran past what was read (an underrun): skip to the
+            // chunk it is in rather than fall further behind.
+            int skip = (readPos - pStream->writePos) / AUDIOSTREAM_CHUNK_FRAMES * AUDIOSTREAM_CHUNK_FRAMES;
+            pStream->writePos += skip;
+        }
+        if (pStream->writePos - readPos + AUDIOSTREAM_CHUNK_FRAMES > AUDIOSTREAM_RING_FRAMES) {
+            return;
+        }
+
+        int count = pStream->numSamples - pStream->writePos;
+        if (count > AUDIOSTREAM_CHUNK_FRAMES) count = AUDIOSTREAM_CHUNK_FRAMES;
+        int slot = (pStream->writePos - pStream->headFrames) % AUDIOSTREAM_RING_FRAMES;
+        int got = readFrames(pStream, pStream->ring + slot, pStream->writePos, count);
+        if (got < count) {
+            fprintf(stderr, "ERROR: Stream read failed at frame %d.\n", pStream->writePos + got);
+            // Play out what there is; the rest comes through as underruns.
+            pStream->readFailed = true;
+        }
+
+        if (atomic_load_explicit(&pStream->requestedGeneration, memory_order_acquire) != generation) {
+            // Rewound during the read: this data is for the old position.
+            return;
+        }
+        pStream->writePos += got;
+        atomic_store_explicit(&pStream->written, packWritten(generation, pStream->writePos),
+            memory_order_release);
+    }
+}
+
+static void* readerThread(void* _arg)
+{
+    (void)_arg;
+    ThreadPolicy_apply("stream");
+    while (true) {
+        sem_wait(&wakeReader);
+        pthread_mutex_lock(&streamsMutex);
+        if (stopping) {
+            pthread_mutex_unlock(&streamsMutex);
+            break;
+        }
+        for (int i = 0; i < numStreams; i++) {
+            fillStream(streams[i]);
+        }
+        pthread_mutex_unlock(&streamsMutex);
+    }
+    return NULL;
+}
+
+static void freeStream(struct audioStream *pStream)
+{
+    close(pStream->fd);
+    free(pStream->head);
+    free(pStream->ring);
+    free(pStream);
+}
+
+bool AudioStream_open(const char *fileName, wavedata_t *pSound)
+{
+    memset(pSound, 0, sizeof(*pSound));
+    struct audioStream *pStream = calloc(1, sizeof(*pStream));
+    if (pStream == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate stream.\n");
+        return false;
+    }
+    if (!WaveFile_openData(fileName, &pStream->fd, &pStream->dataOffset, &pStream->numSamples)) {
+        free(pStream);
+        return false;
+    }
+
+    pStream->headFrames = pStream->numSamples < AUDIOSTREAM_HEAD_FRAMES
+        ? pStream->numSamples : AUDIOSTREAM_HEAD_FRAMES;
+    pStream->head = malloc((size_t)pStream->headFrames * sizeof(short));
+    // Short files fit in the head and never use a ring.
+    pStream->ring = pStream->numSamples > pStream->headFrames
+        ? malloc(AUDIOSTREAM_RING_FRAMES * sizeof(short)) : NULL;
+    if ((pStream->headFrames > 0 && pStream->head == NULL)
+            || (pStream->numSamples > pStream->headFrames && pStream->ring == NULL)) {
+        fprintf(stderr, "ERROR: Unable to allocate stream buffers for %s.\n", fileName);
+        freeStream(pStream);
+        return false;
+    }
+    if (readFrames(pStream, pStream->head, 0, pStream->headFrames) < pStream->headFrames) {
+        fprintf(stderr, "ERROR: Unable to read %s.\n", fileName);
+        freeStream(pStream);
+        return false;
+    }
+    // Reader generation 0 at headFrames: it fills the ring straight away.
+    pStream->writePos = pStream->headFrames;
+    atomic_store(&pStream->written, packWritten(0, pStream->headFrames));
+
+    pthread_mutex_lock(&openMutex);
+    if (numStreams == MAX_STREAMS) {
+        pthread_mutex_unlock(&openMutex);
+        fprintf(stderr, "ERROR: Too many streams open (max %d).\n", MAX_STREAMS);
+        freeStream(pStream);
+        return false;
+    }
+    if (numStreams == 0) {
+        stopping = false;
+        sem_init(&wakeReader, 0, 0);
+        pthread_create(&readerThreadId, NULL, readerThread, NULL);
+    }
+    pthread_mutex_lock(&streamsMutex);
+    streams[numStreams++] = pStream;
+    pthread_mutex_unlock(&streamsMutex);
+    sem_post(&wakeReader);
+    pthread_mutex_unlock(&openMutex);
+
+    pSound->numSamples = pStream->numSamples;
+    pSound->pStream = pStream;
+    return true;
+}
+
+void AudioStream_close(wavedata_t *pSound)
+{
+    struct audioStream *pStream = pSound->pStream;
+    if (pStream == NULL) return;
+
+    bool stopReader = false;
+    pthread_mutex_lock(&openMutex);
+    pthread_mutex_lock(&streamsMutex);
+    for (int i = 0; i < numStreams; i++) {
+        if (streams[i] == pStream) {
+            streams[i] = streams[--numStreams];
+            stopReader = (numStreams == 0);
+            break;
+        }
+    }
+    if (stopReader) {
+        stopping = true;
+    }
+    pthread_mutex_unlock(&streamsMutex);
+    if (stopReader) {
+        sem_post(&wakeReader);
+        pthread_join(readerThreadId, NULL);
+        sem_destroy(&wakeReader);
+    }
+    pthread_mutex_unlock(&openMutex);
+
+    freeStream(pStream);
+    pSound->pStream = NULL;
+    pSound->numSamples = 0;
+}
+
+void AudioStream_rewind(struct audioStream *pStream)
+{
+    // Nothing to undo before the first play: the ring is already filled
+    // from the head on.
+    if (!pStream->played || pStream->numSamples <= pStream->headFrames) {
+        pStream->played = true;
+        return;
+    }
+    atomic_store_explicit(&pStream->readPos, 0, memory_order_relaxed);
+    pStream->generation++;
+    atomic_store_explicit(&pStream->requestedGeneration, pStream->generation, memory_order_release);
+    sem_post(&wakeReader);
+}
+
+int AudioStream_copy(struct audioStream *pStream, int position, short *pOut, int count)
+{
+    int copied = 0;
+    if (position < pStream->headFrames) {
+        copied = pStream->headFrames - position;
+        if (copied > count) copied = count;
+        memcpy(pOut, pStream->head + position, (size_t)copied * sizeof(short));
+    }
+    if (copied == count) {
+        return copied;
+    }
+
+    long long written = atomic_load_explicit(&pStream->written, memory_order_acquire);
+    if ((uint32_t)((uint64_t)written >> 32) != pStream->generation) {
+        return copied;
+    }
+    int from = position + copied;
+    int available = (int)(uint32_t)written - from;
+    int wanted = count - copied;
+    if (available < wanted) wanted = available;
+    // Up to two pieces, either side of the end of the ring.
+    while (wanted > 0) {
+        int slot = (from - pStream->headFrames) % AUDIOSTREAM_RING_FRAMES;
+        int n = AUDIOSTREAM_RING_FRAMES - slot;
+        if (n > wanted) n = wanted;
+        memcpy(pOut + copied, pStream->ring + slot, (size_t)n * sizeof(short));
+        copied += n;
+        from += n;
+        wanted -= n;
+    }
+    return copied;
+}
+
+void AudioStream_advance(struct audioStream *pStream, int position)
+{
+    int previous = atomic_load_explicit(&pStream->readPos, memory_order_relaxed);
+    atomic_store_explicit(&pStream->readPos, position, memory_order_release);
+    // Wake the reader once a whole chunk of the ring has been played.
+    if (position > pStream->headFrames && previous / AUDIOSTREAM_CHUNK_FRAMES != position / AUDIOSTREAM_CHUNK_FRAMES) {
+        sem_post(&wakeReader);
+    }
+}
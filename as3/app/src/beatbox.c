@@ -5,18 +5,40 @@
 #include <time.h>
 #include "audioMixer.h"
 #include "audioLogic.h"
+#include "hitLatency.h"
+#include "netAudio.h"
+#include "recorder.h"
+#include "sequencer.h"
 #include "udpServer.h"
 #include "hal/joystick.h"
 #include "hal/accelerometer.h"
 #include "hal/encoder.h"
 #include "hal/adc.h"
+#include "hal/threadPolicy.h"
 #include "periodTimer.h"
 
-// Helper to get time in milliseconds
-static long long getTimeMs(void) {
+// Scheduling for the time-critical threads. Without CAP_SYS_NICE these
+// fall back to SCHED_OTHER (see the startup log or the UDP "threads" reply).
+static const ThreadPolicy_config_t threadPolicies[] = {
+    // name        prio  cpu  lockMemory
+    { "audio-out", 85,   3,   true  },   // only with -a (render-ahead)
+    { "audio",     80,   3,   true  },
+    { "encoder",   50,   -1,  false },
+    { "stream",    40,   -1,  false },   // disk read-ahead, while streams are open
+    { "bars",      0,    -1,  false },   // bar cache renderer
+    { "record",    0,    -1,  false },   // recording writer, while recording
+    { "udp",       0,    -1,  false },
+};
+
+// Helpers to get time in nanoseconds / milliseconds
+static long long getTimeNs(void) {
     struct timespec spec;
     clock_gettime(CLOCK_MONOTONIC, &spec);
-    return spec.tv_sec * 1000 + spec.tv_nsec / 1000000;
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+static long long getTimeMs(void) {
+    return getTimeNs() / 1000000;
 }
 
 // Encoder Callbacks
@@ -28,8 +50,57 @@ void on_mode_button_press(void) {
     Beatbox_cycleMode();
 }
 
-int main(void) {
+static void printUsage(const char *progName) {
+    printf("Usage: %s [-d alsa_device] [-l latency] [-m] [-a periods] [-p pattern_file] [-n host[:port]]\n"
+        "       [-r recording.wav] [-s]\n",
+        progName);
+    printf("  -d  ALSA playback device (default \"default\"; hw:/plughw: bypass dmix)\n");
+    printf("  -l  latency profile: default, low or ultra\n");
+    printf("  -m  render straight into the ALSA mmap buffer\n");
+    printf("  -a  mix up to this many periods ahead of the ALSA writer (max %d)\n",
+        AUDIOMIXER_MAX_RENDER_AHEAD);
+    printf("  -p  add the beat patterns in this file (one per line, see pattern.h)\n");
+    printf("  -n  stream to this host as RTP over UDP instead of playing (port %d by default;\n"
+        "      play it there with net_receiver)\n", NETAUDIO_DEFAULT_PORT);
+    printf("  -r  record everything played to this WAV file (also UDP \"record start\")\n");
+    printf("  -s  set the volume as a click-free gain in the mix, not on the ALSA control\n");
+}
+
+int main(int argc, char *argv[]) {
+    AudioMixer_config_t mixerConfig;
+    AudioMixer_getDefaultConfig(&mixerConfig);
+    const char *patternFile = NULL;
+    const char *recordFile = NULL;
+    bool softwareVolume = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:l:ma:p:n:r:sh")) != -1) {
+        switch (opt) {
+            case 'd': mixerConfig.device = optarg; break;
+            case 'l':
+                if (!AudioMixer_setLatencyProfile(&mixerConfig, optarg)) {
+                    printf("Unknown latency profile '%s'\n", optarg);
+                    printUsage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'm': mixerConfig.outputMode = AUDIOMIXER_OUTPUT_MMAP; break;
+            case 'a': mixerConfig.renderAhead = atoi(optarg); break;
+            case 'p': patternFile = optarg; break;
+            case 'n':
+                mixerConfig.sink = AUDIOMIXER_SINK_NETWORK;
+                mixerConfig.netTarget = optarg;
+                break;
+            case 'r': recordFile = optarg; break;
+            case 's': softwareVolume = true; break;
+            default:
+                printUsage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
     printf("Starting Beatbox...\n");
+    ThreadPolicy_init(threadPolicies, sizeof(threadPolicies) / sizeof(threadPolicies[0]));
 
     // 1. Initialize Hardware & Modules
     // FIX: Initialize PeriodTimer FIRST so other threads can use it immediately
@@ -44,8 +115,22 @@ int main(void) {
     Encoder_set_BPM_callback(on_bpm_change);
     Encoder_set_button_callback(on_mode_button_press);
 
-    AudioMixer_init();
+    // The kit is loaded first: the sequencer plays it from the mixer's
+    // first period.
     Beatbox_init();
+    if (patternFile && !Beatbox_loadPatterns(patternFile)) {
+        printf("Some patterns in %s were not loaded\n", patternFile);
+    }
+    // Before the mixer starts, to have the first period too.
+    if (recordFile) {
+        Recorder_start(recordFile);
+    }
+    mixerConfig.renderCallback = Sequencer_renderPeriod;
+    mixerConfig.idleCallback = Sequencer_isIdle;
+    AudioMixer_initWithConfig(&mixerConfig);
+    if (softwareVolume) {
+        AudioMixer_setSoftwareVolume(true);
+    }
     UDP_init();
 
     long long lastStatTime = getTimeMs();
@@ -73,7 +158,9 @@ int main(void) {
         }
 
         // --- Accelerometer (Air Drumming) ---
+        // A hit's latency is counted from the start of the read that sees it.
         int x, y, z;
+        long long readNs = getTimeNs();
         Accel_readXYZ(&x, &y, &z);
         Period_markEvent(PERIOD_EVENT_ACCEL_READ);
 
@@ -86,17 +173,17 @@ int main(void) {
             bool triggered = false;
             // X-Axis Shake
             if (abs(x - 2048) > thresh) {
-                Beatbox_playSound(1); // Snare
+                Beatbox_playHit(1, readNs); // Snare
                 triggered = true;
             }
             // Y-Axis Shake
             if (abs(y - 2048) > thresh) {
-                Beatbox_playSound(2); // Hi-Hat
+                Beatbox_playHit(2, readNs); // Hi-Hat
                 triggered = true;
             }
           
             if (abs(z - 2048) > thresh) {
-                Beatbox_playSound(0); // Base
+                Beatbox_playHit(0, readNs); // Base
                 triggered = true;
             }
 
@@ -112,13 +199,17 @@ int main(void) {
             
             Period_getStatisticsAndClear(PERIOD_EVENT_AUDIO_BUFFER, &audioStats);
             Period_getStatisticsAndClear(PERIOD_EVENT_ACCEL_READ, &accelStats);
+            HitLatency_stats_t hitStats;
+            HitLatency_getStats(&hitStats);
 
-            printf("M%d %dbpm vol:%d  Audio[%.3f, %.3f] avg %.3f/%d  Accel[%.3f, %.3f] avg %.3f/%d\n",
+            printf("M%d %dbpm vol:%d  Audio[%.3f, %.3f] avg %.3f/%d  Accel[%.3f, %.3f] avg %.3f/%d"
+                "  Hit[%.1f, %.1f] max %.1f/%lld\n",
                 Beatbox_getMode(),
                 Beatbox_getBPM(),
                 Beatbox_getVolume(),
                 audioStats.minPeriodInMs, audioStats.maxPeriodInMs, audioStats.avgPeriodInMs, audioStats.numSamples,
-                accelStats.minPeriodInMs, accelStats.maxPeriodInMs, accelStats.avgPeriodInMs, accelStats.numSamples
+                accelStats.minPeriodInMs, accelStats.maxPeriodInMs, accelStats.avgPeriodInMs, accelStats.numSamples,
+                hitStats.p50Ms, hitStats.p99Ms, hitStats.maxMs, hitStats.hits
             );
             
             lastStatTime = now;
@@ -129,12 +220,19 @@ int main(void) {
 
     // 3. Cleanup
     printf("Cleaning up...\n");
+    char threadReport[1024];
+    ThreadPolicy_report(threadReport, sizeof(threadReport));
+    printf("%s", threadReport);
     UDP_cleanup();
-    Beatbox_cleanup();
+    // Stop the mixer before the kit is unloaded: voices may still be playing.
     AudioMixer_cleanup();
+    // Finishes the file, now that nothing more is played.
+    Recorder_cleanup();
+    Beatbox_cleanup();
     Encoder_cleanup();
     Accel_cleanup();
     ADC_cleanup();
+    ThreadPolicy_cleanup();
     Period_cleanup();
     
     printf("Program Terminated.\n");
@@ -0,0 +1,98 @@
+#include "hitLatency.h"
+#include <stdatomic.h>
+
+// Written by the playback thread (SCHED_FIFO) with relaxed atomics only,
+// so it never waits on a reader. Readers load each counter on its own: a
+// snapshot taken while a hit is being recorded may be off by that hit.
+static atomic_llong buckets[HITLATENCY_NUM_BUCKETS];
+static atomic_llong hits;
+static atomic_llong totalQueueNs;
+static atomic_llong totalWaitNs;
+static atomic_llong totalOutputNs;
+static atomic_llong maxTotalNs;
+static atomic_llong maxWaitNs;
+static atomic_llong maxOutputNs;
+
+// A CAS rather than a plain store, so a concurrent reset is not undone.
+static void raiseMax(atomic_llong *pMax, long long value)
+{
+    long long max = atomic_load_explicit(pMax, memory_order_relaxed);
+    while (value > max
+            && !atomic_compare_exchange_weak_explicit(pMax, &max, value,
+                memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void HitLatency_record(long long triggerNs, long long queuedNs, long long mixedNs, long long dacNs)
+{
+    long long totalNs = dacNs - triggerNs;
+    long long bucket = totalNs / (HITLATENCY_BUCKET_US * 1000LL);
+    if (bucket < 0) bucket = 0;
+    if (bucket >= HITLATENCY_NUM_BUCKETS) bucket = HITLATENCY_NUM_BUCKETS - 1;
+
+    atomic_fetch_add_explicit(&buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hits, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&totalQueueNs, queuedNs - triggerNs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&totalWaitNs, mixedNs - queuedNs, memory_order_relaxed);
+    atomic_fetch_add_explicit(&totalOutputNs, dacNs - mixedNs, memory_order_relaxed);
+    raiseMax(&maxTotalNs, totalNs);
+    raiseMax(&maxWaitNs, mixedNs - queuedNs);
+    raiseMax(&maxOutputNs, dacNs - mixedNs);
+}
+
+// Upper edge of the bucket holding the hit at `rank` (0-based).
+static double percentileMs(const long long *pCounts, long long rank)
+{
+    long long seen = 0;
+    for (int i = 0; i < HITLATENCY_NUM_BUCKETS; i++) {
+        seen += pCounts[i];
+        if (seen > rank) {
+            return (i + 1) * HITLATENCY_BUCKET_US / 1000.0;
+        }
+    }
+    return HITLATENCY_NUM_BUCKETS * HITLATENCY_BUCKET_US / 1000.0;
+}
+
+void HitLatency_getStats(HitLatency_stats_t *pStats)
+{
+    long long counts[HITLATENCY_NUM_BUCKETS];
+    HitLatency_getHistogram(counts);
+    long long n = atomic_load_explicit(&hits, memory_order_relaxed);
+    pStats->hits = n;
+    pStats->maxMs = atomic_load_explicit(&maxTotalNs, memory_order_relaxed) / 1e6;
+    pStats->avgQueueMs = n ? atomic_load_explicit(&totalQueueNs, memory_order_relaxed) / 1e6 / n : 0;
+    pStats->avgWaitMs = n ? atomic_load_explicit(&totalWaitNs, memory_order_relaxed) / 1e6 / n : 0;
+    pStats->avgOutputMs = n ? atomic_load_explicit(&totalOutputNs, memory_order_relaxed) / 1e6 / n : 0;
+    pStats->maxWaitMs = atomic_load_explicit(&maxWaitNs, memory_order_relaxed) / 1e6;
+    pStats->maxOutputMs = atomic_load_explicit(&maxOutputNs, memory_order_relaxed) / 1e6;
+
+    // Ranks out of the histogram copied, so they stay within it.
+    long long counted = 0;
+    for (int i = 0; i < HITLATENCY_NUM_BUCKETS; i++) {
+        counted += counts[i];
+    }
+    // Nearest rank: the hit at or below which 50% / 99% of them fall.
+    pStats->p50Ms = counted ? percentileMs(counts, (counted + 1) / 2 - 1) : 0;
+    pStats->p99Ms = counted ? percentileMs(counts, (counted * 99 + 99) / 100 - 1) : 0;
+}
+
+void HitLatency_getHistogram(long long pCounts[HITLATENCY_NUM_BUCKETS])
+{
+    for (int i = 0; i < HITLATENCY_NUM_BUCKETS; i++) {
+        pCounts[i] = atomic_load_explicit(&buckets[i], memory_order_relaxed);
+    }
+}
+
+void HitLatency_reset(void)
+{
+    for (int i = 0; i < HITLATENCY_NUM_BUCKETS; i++) {
+        atomic_store_explicit(&buckets[i], 0, memory_order_relaxed);
+    }
+    atomic_store(&hits, 0);
+    atomic_store(&totalQueueNs, 0);
+    atomic_store(&totalWaitNs, 0);
+    atomic_store(&totalOutputNs, 0);
+    atomic_store(&maxTotalNs, 0);
+    atomic_store(&maxWaitNs, 0);
+    atomic_store(&maxOutputNs, 0);
+}
@@ -0,0 +1,283 @@
+#include "mixKernel.h"
+#include <limits.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define KERNEL_NAME "neon"
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define KERNEL_NAME "avx2"
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define KERNEL_NAME "sse2"
+#else
+#define KERNEL_NAME "scalar"
+#endif
+
+const char *MixKernel_name(void)
+{
+    return KERNEL_NAME;
+}
+
+void MixKernel_accumulate(int32_t *pBus, const short *pSrc, int count)
+{
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        int16x8_t src = vld1q_s16(pSrc + i);
+        vst1q_s32(pBus + i, vaddw_s16(vld1q_s32(pBus + i), vget_low_s16(src)));
+        vst1q_s32(pBus + i + 4, vaddw_s16(vld1q_s32(pBus + i + 4), vget_high_s16(src)));
+    }
+#elif defined(__AVX2__)
+    for (; i + 16 <= count; i += 16) {
+        __m128i srcLo = _mm_loadu_si128((const __m128i *)(pSrc + i));
+        __m128i srcHi = _mm_loadu_si128((const __m128i *)(pSrc + i + 8));
+        __m256i *pLo = (__m256i *)(pBus + i);
+        __m256i *pHi = (__m256i *)(pBus + i + 8);
+        _mm256_storeu_si256(pLo, _mm256_add_epi32(_mm256_loadu_si256(pLo), _mm256_cvtepi16_epi32(srcLo)));
+        _mm256_storeu_si256(pHi, _mm256_add_epi32(_mm256_loadu_si256(pHi), _mm256_cvtepi16_epi32(srcHi)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i src = _mm_loadu_si128((const __m128i *)(pSrc + i));
+        // Sign-extend 16 -> 32 by interleaving with itself and shifting down.
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(src, src), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(src, src), 16);
+        __m128i *pLo = (__m128i *)(pBus + i);
+        __m128i *pHi = (__m128i *)(pBus + i + 4);
+        _mm_storeu_si128(pLo, _mm_add_epi32(_mm_loadu_si128(pLo), lo));
+        _mm_storeu_si128(pHi, _mm_add_epi32(_mm_loadu_si128(pHi), hi));
+    }
+#endif
+    for (; i < count; i++) {
+        pBus[i] += pSrc[i];
+    }
+}
+
+// Clipped samples are counted in-register: each out-of-range compare
+// yields -1 per lane, which is subtracted from a vector of counters.
+int MixKernel_saturate(short *pOut, const int32_t *pBus, int count)
+{
+    int i = 0;
+    int clipped = 0;
+#if defined(__ARM_NEON)
+    int32x4_t max = vdupq_n_s32(SHRT_MAX);
+    int32x4_t min = vdupq_n_s32(SHRT_MIN);
+    uint32x4_t clips = vdupq_n_u32(0);
+    for (; i + 8 <= count; i += 8) {
+        int32x4_t busLo = vld1q_s32(pBus + i);
+        int32x4_t busHi = vld1q_s32(pBus + i + 4);
+        clips = vsubq_u32(clips, vorrq_u32(vcgtq_s32(busLo, max), vcltq_s32(busLo, min)));
+        clips = vsubq_u32(clips, vorrq_u32(vcgtq_s32(busHi, max), vcltq_s32(busHi, min)));
+        vst1q_s16(pOut + i, vcombine_s16(vqmovn_s32(busLo), vqmovn_s32(busHi)));
+    }
+    uint32_t lanes[4];
+    vst1q_u32(lanes, clips);
+    clipped = (int)(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+#elif defined(__AVX2__)
+    __m256i max = _mm256_set1_epi32(SHRT_MAX);
+    __m256i min = _mm256_set1_epi32(SHRT_MIN);
+    __m256i clips = _mm256_setzero_si256();
+    for (; i + 16 <= count; i += 16) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(pBus + i));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(pBus + i + 8));
+        clips = _mm256_sub_epi32(clips, _mm256_or_si256(_mm256_cmpgt_epi32(lo, max), _mm256_cmpgt_epi32(min, lo)));
+        clips = _mm256_sub_epi32(clips, _mm256_or_si256(_mm256_cmpgt_epi32(hi, max), _mm256_cmpgt_epi32(min, hi)));
+        // packs works per 128-bit lane; restore sample order afterwards.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+        _mm256_storeu_si256((__m256i *)(pOut + i), packed);
+    }
+    int32_t lanes[8];
+    _mm256_storeu_si256((__m256i *)lanes, clips);
+    for (int lane = 0; lane < 8; lane++) clipped += lanes[lane];
+#elif defined(__SSE2__)
+    __m128i max = _mm_set1_epi32(SHRT_MAX);
+    __m128i min = _mm_set1_epi32(SHRT_MIN);
+    __m128i clips = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        __m128i lo = _mm_loadu_si128((const __m128i *)(pBus + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *)(pBus + i + 4));
+        clips = _mm_sub_epi32(clips, _mm_or_si128(_mm_cmpgt_epi32(lo, max), _mm_cmplt_epi32(lo, min)));
+        clips = _mm_sub_epi32(clips, _mm_or_si128(_mm_cmpgt_epi32(hi, max), _mm_cmplt_epi32(hi, min)));
+        _mm_storeu_si128((__m128i *)(pOut + i), _mm_packs_epi32(lo, hi));
+    }
+    int32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, clips);
+    clipped = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < count; i++) {
+        int32_t sample = pBus[i];
+        if (sample > SHRT_MAX) {
+            sample = SHRT_MAX;
+            clipped++;
+        } else if (sample < SHRT_MIN) {
+            sample = SHRT_MIN;
+            clipped++;
+        }
+        pOut[i] = (short)sample;
+    }
+    return clipped;
+}
+
+void MixKernel_accumulateRamp(int32_t *pBus, const short *pSrc, int count, int32_t gainStart, int32_t gainEnd)
+{
+    if (count <= 0) return;
+    int64_t gain = (int64_t)gainStart * 65536;
+    int64_t step = ((int64_t)gainEnd - gainStart) * 65536 / count;
+    for (int i = 0; i < count; i++) {
+        gain += step;
+        pBus[i] += (int32_t)(((int64_t)pSrc[i] * (gain >> 16)) / MIX_KERNEL_UNITY_GAIN);
+    }
+}
+
+void MixKernel_applyGainRamp(int32_t *pBus, int count, int32_t gainStart, int32_t gainEnd)
+{
+    if (count <= 0) return;
+    // Gain is tracked in Q16 with 16 extra fractional bits so small
+    // per-sample steps over long blocks don't round away to zero.
+    int64_t gain = (int64_t)gainStart * 65536;
+    int64_t step = ((int64_t)gainEnd - gainStart) * 65536 / count;
+    for (int i = 0; i < count; i++) {
+        gain += step;
+        pBus[i] = (int32_t)(((int64_t)pBus[i] * (gain >> 16)) >> 16);
+    }
+}
+
+void MixKernel_add(short *pOut, const short *pSrc, int count)
+{
+    int i = 0;
+#if defined(__ARM_NEON)
+    for (; i + 8 <= count; i += 8) {
+        vst1q_s16(pOut + i, vaddq_s16(vld1q_s16(pOut + i), vld1q_s16(pSrc + i)));
+    }
+#elif defined(__AVX2__)
+    for (; i + 16 <= count; i += 16) {
+        __m256i *pDst = (__m256i *)(pOut + i);
+        __m256i src = _mm256_loadu_si256((const __m256i *)(pSrc + i));
+        _mm256_storeu_si256(pDst, _mm256_add_epi16(_mm256_loadu_si256(pDst), src));
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= count; i += 8) {
+        __m128i *pDst = (__m128i *)(pOut + i);
+        __m128i src = _mm_loadu_si128((const __m128i *)(pSrc + i));
+        _mm_storeu_si128(pDst, _mm_add_epi16(_mm_loadu_si128(pDst), src));
+    }
+#endif
+    for (; i < count; i++) {
+        pOut[i] = (short)(pOut[i] + pSrc[i]);
+    }
+}
+
+void MixKernel_addRamp(short *pOut, const short *pSrc, int count, int32_t gainStart, int32_t gainEnd)
+{
+    if (count <= 0) return;
+    int64_t gain = (int64_t)gainStart * 65536;
+    int64_t step = ((int64_t)gainEnd - gainStart) * 65536 / count;
+    for (int i = 0; i < count; i++) {
+        gain += step;
+        pOut[i] = (short)(pOut[i] + ((int64_t)pSrc[i] * (gain >> 16)) / MIX_KERNEL_UNITY_GAIN);
+    }
+}
+
+void MixKernel_applyGainRamp16(short *pOut, int count, int32_t gainStart, int32_t gainEnd)
+{
+    if (count <= 0) return;
+    int64_t gain = (int64_t)gainStart * 65536;
+    int64_t step = ((int64_t)gainEnd - gainStart) * 65536 / count;
+    for (int i = 0; i < count; i++) {
+        gain += step;
+        pOut[i] = (short)(((int64_t)pOut[i] * (gain >> 16)) >> 16);
+    }
+}
+
+// Interpolation weights are Q14 so that both products of a sample pair fit
+// a 32-bit lane together: s0 * (16384 - f) + s1 * f, which is one
+// multiply-add per lane on x86.
+#define WEIGHT_BITS 14
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+// Positions are 32-bit: rebased onto pSrc every so many frames so that
+// they cannot overflow below the maximum rate.
+#define RESAMPLE_CHUNK_FRAMES 4096
+
+static void resampleChunk(short *pOut, const short *pSrc, int count, uint32_t phase, uint32_t rate)
+{
+    int i = 0;
+    uint32_t position = phase;
+#if defined(__ARM_NEON)
+    static const uint32_t steps[4] = { 0, 1, 2, 3 };
+    uint32x4_t positions = vmlaq_n_u32(vdupq_n_u32(phase), vld1q_u32(steps), rate);
+    int16x4_t one = vdup_n_s16(WEIGHT_ONE);
+    for (; i + 4 <= count; i += 4) {
+        // No gather: fetch the four sample pairs, then split them.
+        int32_t pairs[4];
+        for (int lane = 0; lane < 4; lane++) {
+            memcpy(&pairs[lane], pSrc + ((position + lane * rate) >> 16), sizeof(pairs[lane]));
+        }
+        int16x4x2_t samples = vld2_s16((const int16_t *)pairs);
+        int16x4_t weight = vreinterpret_s16_u16(vmovn_u32(
+            vshrq_n_u32(vandq_u32(positions, vdupq_n_u32(0xffff)), 16 - WEIGHT_BITS)));
+        int32x4_t mixed = vmull_s16(samples.val[0], vsub_s16(one, weight));
+        mixed = vmlal_s16(mixed, samples.val[1], weight);
+        vst1_s16(pOut + i, vshrn_n_s32(mixed, WEIGHT_BITS));
+        positions = vaddq_u32(positions, vdupq_n_u32(4 * rate));
+        position += 4 * rate;
+    }
+#elif defined(__AVX2__)
+    __m256i positions = _mm256_add_epi32(_mm256_set1_epi32((int)phase),
+        _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((int)rate)));
+    __m256i step = _mm256_set1_epi32((int)(8 * rate));
+    __m256i fractionMask = _mm256_set1_epi32(0xffff);
+    __m256i one = _mm256_set1_epi32(WEIGHT_ONE);
+    for (; i + 8 <= count; i += 8) {
+        // A 32-bit gather at each position fetches the sample and the one
+        // after it: exactly the pair to interpolate.
+        __m256i pairs = _mm256_i32gather_epi32((const int *)pSrc, _mm256_srli_epi32(positions, 16), 2);
+        __m256i weight = _mm256_srli_epi32(_mm256_and_si256(positions, fractionMask), 16 - WEIGHT_BITS);
+        __m256i weights = _mm256_or_si256(_mm256_sub_epi32(one, weight), _mm256_slli_epi32(weight, 16));
+        __m256i mixed = _mm256_srai_epi32(_mm256_madd_epi16(pairs, weights), WEIGHT_BITS);
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(mixed, mixed), 0xD8);
+        _mm_storeu_si128((__m128i *)(pOut + i), _mm256_castsi256_si128(packed));
+        positions = _mm256_add_epi32(positions, step);
+        position += 8 * rate;
+    }
+#elif defined(__SSE2__)
+    __m128i positions = _mm_add_epi32(_mm_set1_epi32((int)phase),
+        _mm_setr_epi32(0, (int)rate, (int)(2 * rate), (int)(3 * rate)));
+    __m128i step = _mm_set1_epi32((int)(4 * rate));
+    __m128i fractionMask = _mm_set1_epi32(0xffff);
+    __m128i one = _mm_set1_epi32(WEIGHT_ONE);
+    for (; i + 4 <= count; i += 4) {
+        // No gather: load each sample pair as one 32-bit word.
+        int32_t pairs[4];
+        for (int lane = 0; lane < 4; lane++) {
+            memcpy(&pairs[lane], pSrc + ((position + lane * rate) >> 16), sizeof(pairs[lane]));
+        }
+        __m128i weight = _mm_srli_epi32(_mm_and_si128(positions, fractionMask), 16 - WEIGHT_BITS);
+        __m128i weights = _mm_or_si128(_mm_sub_epi32(one, weight), _mm_slli_epi32(weight, 16));
+        __m128i mixed = _mm_srai_epi32(_mm_madd_epi16(_mm_loadu_si128((const __m128i *)pairs), weights), WEIGHT_BITS);
+        _mm_storel_epi64((__m128i *)(pOut + i), _mm_packs_epi32(mixed, mixed));
+        positions = _mm_add_epi32(positions, step);
+        position += 4 * rate;
+    }
+#endif
+    for (; i < count; i++) {
+        const short *pPair = pSrc + (position >> 16);
+        int32_t weight = (int32_t)((position & 0xffff) >> (16 - WEIGHT_BITS));
+        pOut[i] = (short)((pPair[0] * (WEIGHT_ONE - weight) + pPair[1] * weight) >> WEIGHT_BITS);
+        position += rate;
+    }
+}
+
+void MixKernel_resample(short *pOut, const short *pSrc, int count, uint32_t phase, uint32_t rate)
+{
+    while (count > 0) {
+        int chunk = count < RESAMPLE_CHUNK_FRAMES ? count : RESAMPLE_CHUNK_FRAMES;
+        resampleChunk(pOut, pSrc, chunk, phase, rate);
+        uint32_t end = phase + (uint32_t)chunk * rate;
+        pSrc += end >> 16;
+        phase = end & 0xffff;
+        pOut += chunk;
+        count -= chunk;
+    }
+}
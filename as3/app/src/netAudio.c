@@ -0,0 +1,126 @@
+#include "netAudio.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RTP_VERSION 2
+#define RTP_FIXED_BYTES 12
+// Version 2, no padding, an extension, no CSRCs.
+#define RTP_FIRST_BYTE (RTP_VERSION << 6 | 0x10)
+// The extension's length in 32-bit words: the 8-byte send time.
+#define EXTENSION_WORDS 2
+
+static void put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xff;
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+    put16(p, value >> 16);
+    put16(p + 2, value & 0xffff);
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return (uint32_t)get16(p) << 16 | get16(p + 2);
+}
+
+size_t NetAudio_pack(const NetAudio_header_t *pHeader, const short *samples, uint8_t *packet)
+{
+    packet[0] = RTP_FIRST_BYTE;
+    packet[1] = NETAUDIO_PAYLOAD_TYPE;
+    put16(packet + 2, pHeader->sequence);
+    put32(packet + 4, pHeader->timestamp);
+    put32(packet + 8, pHeader->ssrc);
+    put16(packet + 12, NETAUDIO_EXTENSION);
+    put16(packet + 14, EXTENSION_WORDS);
+    uint64_t sentNs = (uint64_t)pHeader->sentNs;
+    put32(packet + 16, (uint32_t)(sentNs >> 32));
+    put32(packet + 20, (uint32_t)sentNs);
+
+    uint8_t *p = packet + NETAUDIO_HEADER_BYTES;
+    for (int i = 0; i < pHeader->numFrames; i++) {
+        put16(p, (uint16_t)samples[i]);
+        p += 2;
+    }
+    return NETAUDIO_HEADER_BYTES + (size_t)pHeader->numFrames * 2;
+}
+
+bool NetAudio_parse(const uint8_t *packet, size_t size, NetAudio_header_t *pHeader, short *samples)
+{
+    if (size < NETAUDIO_HEADER_BYTES || size > NETAUDIO_MAX_PACKET || (size - NETAUDIO_HEADER_BYTES) % 2
+            || packet[0] != RTP_FIRST_BYTE || (packet[1] & 0x7f) != NETAUDIO_PAYLOAD_TYPE
+            || get16(packet + 12) != NETAUDIO_EXTENSION || get16(packet + 14) != EXTENSION_WORDS) {
+        return false;
+    }
+    pHeader->sequence = get16(packet + 2);
+    pHeader->timestamp = get32(packet + 4);
+    pHeader->ssrc = get32(packet + 8);
+    pHeader->sentNs = (long long)((uint64_t)get32(packet + 16) << 32 | get32(packet + 20));
+    pHeader->numFrames = (int)(size - NETAUDIO_HEADER_BYTES) / 2;
+
+    const uint8_t *p = packet + NETAUDIO_HEADER_BYTES;
+    for (int i = 0; i < pHeader->numFrames; i++) {
+        samples[i] = (short)get16(p);
+        p += 2;
+    }
+    return true;
+}
+
+bool NetAudio_parseAddress(const char *text, struct sockaddr_in *pAddress)
+{
+    char host[256];
+    const char *colon = strrchr(text, ':');
+    size_t hostLength = colon ? (size_t)(colon - text) : strlen(text);
+    if (hostLength >= sizeof(host)) {
+        fprintf(stderr, "ERROR: Host name too long in %s.\n", text);
+        return false;
+    }
+    memcpy(host, text, hostLength);
+    host[hostLength] = '\0';
+
+    long port = NETAUDIO_DEFAULT_PORT;
+    if (colon) {
+        char *end;
+        port = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0' || port < 1 || port > 65535) {
+            fprintf(stderr, "ERROR: Bad port in %s.\n", text);
+            return false;
+        }
+    }
+
+    memset(pAddress, 0, sizeof(*pAddress));
+    pAddress->sin_family = AF_INET;
+    pAddress->sin_port = htons((uint16_t)port);
+    if (hostLength == 0) {
+        pAddress->sin_addr.s_addr = htonl(INADDR_ANY);
+        return true;
+    }
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_DGRAM };
+    struct addrinfo *pResult;
+    int err = getaddrinfo(host, NULL, &hints, &pResult);
+    if (err != 0) {
+        fprintf(stderr, "ERROR: Unable to resolve %s: %s.\n", host, gai_strerror(err));
+        return false;
+    }
+    pAddress->sin_addr = ((struct sockaddr_in *)pResult->ai_addr)->sin_addr;
+    freeaddrinfo(pResult);
+    return true;
+}
+
+long long NetAudio_getRealTimeNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_REALTIME, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
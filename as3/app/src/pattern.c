@@ -0,0 +1,125 @@
+#include "pattern.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIT 'x'
+#define REST '.'
+
+static const char *skipSpace(const char *p)
+{
+    while (*p && isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+static size_t wordLength(const char *p)
+{
+    size_t n = 0;
+    while (p[n] && !isspace((unsigned char)p[n])) n++;
+    return n;
+}
+
+// One "sound:steps" word of length n.
+static bool parseTrack(const char *p, size_t n, Pattern_def_t *pPattern, char *error, size_t errorSize)
+{
+    if (pPattern->numTracks == SEQUENCER_MAX_TRACKS) {
+        snprintf(error, errorSize, "more than %d tracks", SEQUENCER_MAX_TRACKS);
+        return false;
+    }
+    const char *colon = memchr(p, ':', n);
+    if (colon == NULL || colon == p) {
+        snprintf(error, errorSize, "track '%.*s' is not sound:steps", (int)n, p);
+        return false;
+    }
+    int soundId = 0;
+    for (const char *d = p; d < colon; d++) {
+        if (!isdigit((unsigned char)*d) || soundId > 9999) {
+            snprintf(error, errorSize, "bad sound id in '%.*s'", (int)n, p);
+            return false;
+        }
+        soundId = soundId * 10 + (*d - '0');
+    }
+
+    const char *steps = colon + 1;
+    int numSteps = (int)(p + n - steps);
+    if (numSteps == 0 || numSteps > SEQUENCER_MAX_STEPS) {
+        snprintf(error, errorSize, "track '%.*s' needs 1 to %d steps", (int)n, p, SEQUENCER_MAX_STEPS);
+        return false;
+    }
+    if (pPattern->numTracks > 0 && numSteps != pPattern->numSteps) {
+        snprintf(error, errorSize, "track '%.*s' has %d steps, not %d",
+            (int)n, p, numSteps, pPattern->numSteps);
+        return false;
+    }
+    uint64_t bits = 0;
+    for (int s = 0; s < numSteps; s++) {
+        if (steps[s] == HIT) {
+            bits |= (uint64_t)1 << s;
+        } else if (steps[s] != REST) {
+            snprintf(error, errorSize, "step '%c' in '%.*s' is not '%c' or '%c'",
+                steps[s], (int)n, p, HIT, REST);
+            return false;
+        }
+    }
+
+    pPattern->numSteps = numSteps;
+    pPattern->tracks[pPattern->numTracks].soundId = soundId;
+    pPattern->tracks[pPattern->numTracks].steps = bits;
+    pPattern->numTracks++;
+    return true;
+}
+
+bool Pattern_parse(const char *text, Pattern_def_t *pPattern, char *error, size_t errorSize)
+{
+    memset(pPattern, 0, sizeof(*pPattern));
+
+    const char *p = skipSpace(text);
+    size_t n = wordLength(p);
+    if (n == 0 || n >= PATTERN_MAX_NAME) {
+        snprintf(error, errorSize, "name must be 1 to %d characters", PATTERN_MAX_NAME - 1);
+        return false;
+    }
+    memcpy(pPattern->name, p, n);
+
+    p = skipSpace(p + n);
+    char *end;
+    long stepsPerBeat = strtol(p, &end, 10);
+    if (end == p || (*end && !isspace((unsigned char)*end))
+            || stepsPerBeat < 1 || stepsPerBeat > PATTERN_MAX_STEPS_PER_BEAT) {
+        snprintf(error, errorSize, "steps per beat must be 1 to %d", PATTERN_MAX_STEPS_PER_BEAT);
+        return false;
+    }
+    pPattern->stepsPerBeat = (int)stepsPerBeat;
+
+    for (p = skipSpace(end); *p; p = skipSpace(p + n)) {
+        n = wordLength(p);
+        if (!parseTrack(p, n, pPattern, error, errorSize)) {
+            return false;
+        }
+    }
+    if (pPattern->numTracks == 0) {
+        snprintf(error, errorSize, "no tracks");
+        return false;
+    }
+    return true;
+}
+
+bool Pattern_format(const Pattern_def_t *pPattern, char *buffer, size_t bufferSize)
+{
+    size_t used = (size_t)snprintf(buffer, bufferSize, "%s %d", pPattern->name, pPattern->stepsPerBeat);
+    for (int t = 0; t < pPattern->numTracks; t++) {
+        if (used >= bufferSize) {
+            return false;
+        }
+        used += (size_t)snprintf(buffer + used, bufferSize - used, " %d:", pPattern->tracks[t].soundId);
+        if (used + (size_t)pPattern->numSteps >= bufferSize) {
+            return false;
+        }
+        for (int s = 0; s < pPattern->numSteps; s++) {
+            buffer[used++] = (pPattern->tracks[t].steps >> s & 1) ? HIT : REST;
+        }
+        buffer[used] = '\0';
+    }
+    return used < bufferSize;
+}
@@ -0,0 +1,235 @@
+#include "recorder.h"
+#include "waveFile.h"
+#include "hal/threadPolicy.h"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_MASK (RECORDER_RING_FRAMES - 1)
+// Wake the writer once this much is waiting (about 0.75 s, 64 KB per
+// write), and anyway every FLUSH_MS so a short take still reaches the disk.
+#define BATCH_FRAMES (1 << 15)
+#define FLUSH_MS 500
+// A WAV file's sizes are 32-bit.
+#define MAX_FRAMES ((UINT32_MAX - 44) / sizeof(short))
+
+// Frame counters that only ever go up: the playback thread owns head, the
+// writer owns tail. The ring holds frames [tail, head), frame f being at
+// ring[f & RING_MASK].
+static short *ring;
+static atomic_ullong head;
+static atomic_ullong tail;
+
+// The playback thread only touches the ring while `capturing` is set, and
+// flags `inCapture` while it is in Recorder_capture(), so stopping can
+// tell when it has let go.
+static atomic_bool capturing;
+static atomic_bool inCapture;
+
+static atomic_bool recording;
+static atomic_llong framesWritten;
+static atomic_llong droppedPeriods;
+static atomic_llong droppedFrames;
+static atomic_bool writeFailed;
+
+// Held by start and stop throughout.
+static pthread_mutex_t controlMutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *pFile;
+static char fileName[256];
+static pthread_t writerThreadId;
+static sem_t wakeWriter;
+static atomic_bool writerStopping;
+
+// Write out everything in the ring, in at most two pieces (it wraps).
+// After a failure, the frames are thrown away instead.
+static void writeAvailable(void)
+{
+    unsigned long long t = atomic_load_explicit(&tail, memory_order_relaxed);
+    unsigned long long h = atomic_load_explicit(&head, memory_order_acquire);
+    while (t < h) {
+        unsigned long long index = t & RING_MASK;
+        unsigned long long frames = h - t;
+        if (frames > RECORDER_RING_FRAMES - index) {
+            frames = RECORDER_RING_FRAMES - index;
+        }
+        if (!atomic_load(&writeFailed)) {
+            long long written = atomic_load_explicit(&framesWritten, memory_order_relaxed);
+            if ((unsigned long long)written + frames > MAX_FRAMES) {
+                fprintf(stderr, "ERROR: Recording %s has reached the 4 GB limit of a WAV file.\n", fileName);
+                atomic_store(&writeFailed, true);
+            } else if (fwrite(ring + index, sizeof(short), frames, pFile) != frames) {
+                fprintf(stderr, "ERROR: Unable to write recording %s: %s.\n", fileName, strerror(errno));
+                atomic_store(&writeFailed, true);
+            } else {
+                atomic_store_explicit(&framesWritten, written + (long long)frames, memory_order_relaxed);
+            }
+            if (atomic_load(&writeFailed)) {
+                // Nothing more is kept; the playback thread can stop copying.
+                atomic_store(&capturing, false);
+            }
+        }
+        t += frames;
+    }
+    atomic_store_explicit(&tail, t, memory_order_release);
+}
+
+static void *writerThread(void *arg)
+{
+    (void)arg;
+    ThreadPolicy_apply("record");
+    while (true) {
+        // Read the flag first: once it is set, nothing more is captured, so
+        // this last pass leaves the ring empty.
+        bool last = atomic_load(&writerStopping);
+        writeAvailable();
+        if (last) {
+            break;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += FLUSH_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (sem_timedwait(&wakeWriter, &deadline) < 0 && errno == EINTR) {
+        }
+    }
+    return NULL;
+}
+
+bool Recorder_start(const char *name)
+{
+    pthread_mutex_lock(&controlMutex);
+    if (atomic_load(&recording)) {
+        pthread_mutex_unlock(&controlMutex);
+        fprintf(stderr, "ERROR: Already recording to %s.\n", fileName);
+        return false;
+    }
+    if (ring == NULL) {
+        ring = malloc(RECORDER_RING_FRAMES * sizeof(*ring));
+        if (ring == NULL) {
+            pthread_mutex_unlock(&controlMutex);
+            fprintf(stderr, "ERROR: Unable to allocate the recording buffer.\n");
+            return false;
+        }
+    }
+    pFile = fopen(name, "wb");
+    // The real length goes in when the recording stops.
+    if (pFile == NULL || !WaveFile_writeHeader(pFile, 0)) {
+        fprintf(stderr, "ERROR: Unable to create recording %s: %s.\n", name, strerror(errno));
+        if (pFile != NULL) {
+            fclose(pFile);
+        }
+        pthread_mutex_unlock(&controlMutex);
+        return false;
+    }
+    snprintf(fileName, sizeof(fileName), "%s", name);
+
+    atomic_store(&head, 0);
+    atomic_store(&tail, 0);
+    atomic_store(&framesWritten, 0);
+    atomic_store(&droppedPeriods, 0);
+    atomic_store(&droppedFrames, 0);
+    atomic_store(&writeFailed, false);
+    atomic_store(&writerStopping, false);
+    sem_init(&wakeWriter, 0, 0);
+    pthread_create(&writerThreadId, NULL, writerThread, NULL);
+    atomic_store(&recording, true);
+    atomic_store(&capturing, true);
+    pthread_mutex_unlock(&controlMutex);
+    printf("Recording to %s\n", fileName);
+    return true;
+}
+
+void Recorder_stop(void)
+{
+    pthread_mutex_lock(&controlMutex);
+    if (!atomic_load(&recording)) {
+        pthread_mutex_unlock(&controlMutex);
+        return;
+    }
+    // Pairs with Recorder_capture(): once capturing is clear and the
+    // playback thread is seen outside it, head no longer moves.
+    atomic_store(&capturing, false);
+    while (atomic_load(&inCapture)) {
+        usleep(100);
+    }
+    atomic_store(&writerStopping, true);
+    sem_post(&wakeWriter);
+    pthread_join(writerThreadId, NULL);
+    sem_destroy(&wakeWriter);
+
+    long long frames = atomic_load(&framesWritten);
+    if (fflush(pFile) != 0 || fseek(pFile, 0, SEEK_SET) != 0
+            || !WaveFile_writeHeader(pFile, (uint32_t)frames)) {
+        fprintf(stderr, "ERROR: Unable to finish recording %s: %s.\n", fileName, strerror(errno));
+        atomic_store(&writeFailed, true);
+    }
+    if (fclose(pFile) != 0) {
+        atomic_store(&writeFailed, true);
+    }
+    pFile = NULL;
+    atomic_store(&recording, false);
+    pthread_mutex_unlock(&controlMutex);
+
+    printf("Recorded %.1f s to %s", (double)frames / WAVEFILE_SAMPLE_RATE, fileName);
+    long long dropped = atomic_load(&droppedPeriods);
+    if (dropped > 0) {
+        printf(", %lld periods (%lld frames) dropped", dropped, atomic_load(&droppedFrames));
+    }
+    printf("\n");
+}
+
+void Recorder_cleanup(void)
+{
+    Recorder_stop();
+    pthread_mutex_lock(&controlMutex);
+    free(ring);
+    ring = NULL;
+    pthread_mutex_unlock(&controlMutex);
+}
+
+void Recorder_getStats(Recorder_stats_t *pStats)
+{
+    pStats->recording = atomic_load(&recording);
+    pStats->framesWritten = atomic_load(&framesWritten);
+    pStats->droppedPeriods = atomic_load(&droppedPeriods);
+    pStats->droppedFrames = atomic_load(&droppedFrames);
+    pStats->writeFailed = atomic_load(&writeFailed);
+}
+
+void Recorder_capture(const short *pFrames, unsigned long frames)
+{
+    // Not recording: one relaxed load per period.
+    if (!atomic_load_explicit(&capturing, memory_order_relaxed)) {
+        return;
+    }
+    atomic_store(&inCapture, true);
+    if (atomic_load(&capturing)) {
+        unsigned long long h = atomic_load_explicit(&head, memory_order_relaxed);
+        unsigned long long used = h - atomic_load_explicit(&tail, memory_order_acquire);
+        if (used + frames > RECORDER_RING_FRAMES) {
+            // The disk is behind: leave this period out rather than wait.
+            atomic_fetch_add_explicit(&droppedPeriods, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&droppedFrames, (long long)frames, memory_order_relaxed);
+        } else {
+            unsigned long index = h & RING_MASK;
+            unsigned long first = frames < RECORDER_RING_FRAMES - index ? frames : RECORDER_RING_FRAMES - index;
+            memcpy(ring + index, pFrames, first * sizeof(short));
+            memcpy(ring, pFrames + first, (frames - first) * sizeof(short));
+            atomic_store_explicit(&head, h + frames, memory_order_release);
+            if (used < BATCH_FRAMES && used + frames >= BATCH_FRAMES) {
+                sem_post(&wakeWriter);
+            }
+        }
+    }
+    atomic_store(&inCapture, false);
+}
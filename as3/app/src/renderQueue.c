@@ -0,0 +1,80 @@
+#include "renderQueue.h"
+#include <errno.h>
+#include <stdlib.h>
+
+bool RenderQueue_init(renderQueue_t *pQueue, int numBuffers, unsigned long maxFrames)
+{
+    if (numBuffers < 1 || numBuffers > RENDER_QUEUE_MAX_BUFFERS) {
+        return false;
+    }
+    pQueue->numBuffers = numBuffers;
+    for (int i = 0; i < numBuffers; i++) {
+        pQueue->pBuffers[i] = calloc(maxFrames, sizeof(short));
+        if (pQueue->pBuffers[i] == NULL) {
+            pQueue->numBuffers = i;
+            RenderQueue_cleanup(pQueue);
+            return false;
+        }
+        pQueue->frames[i] = 0;
+    }
+    sem_init(&pQueue->freeBuffers, 0, numBuffers);
+    sem_init(&pQueue->filledBuffers, 0, 0);
+    pQueue->writeIndex = 0;
+    pQueue->readIndex = 0;
+    atomic_init(&pQueue->depth, 0);
+    return true;
+}
+
+void RenderQueue_cleanup(renderQueue_t *pQueue)
+{
+    for (int i = 0; i < pQueue->numBuffers; i++) {
+        free(pQueue->pBuffers[i]);
+        pQueue->pBuffers[i] = NULL;
+    }
+    pQueue->numBuffers = 0;
+    sem_destroy(&pQueue->freeBuffers);
+    sem_destroy(&pQueue->filledBuffers);
+}
+
+// sem_wait(), retried if a signal interrupts it.
+static void waitFor(sem_t *pSem)
+{
+    while (sem_wait(pSem) != 0 && errno == EINTR) {
+    }
+}
+
+short *RenderQueue_beginWrite(renderQueue_t *pQueue)
+{
+    waitFor(&pQueue->freeBuffers);
+    return pQueue->pBuffers[pQueue->writeIndex];
+}
+
+void RenderQueue_endWrite(renderQueue_t *pQueue, unsigned long frames)
+{
+    pQueue->frames[pQueue->writeIndex] = frames;
+    pQueue->writeIndex = (pQueue->writeIndex + 1) % pQueue->numBuffers;
+    atomic_fetch_add(&pQueue->depth, 1);
+    sem_post(&pQueue->filledBuffers);
+}
+
+const short *RenderQueue_beginRead(renderQueue_t *pQueue, unsigned long *pFrames)
+{
+    waitFor(&pQueue->filledBuffers);
+    atomic_fetch_sub(&pQueue->depth, 1);
+    *pFrames = pQueue->frames[pQueue->readIndex];
+    if (*pFrames == 0) {
+        return NULL;
+    }
+    return pQueue->pBuffers[pQueue->readIndex];
+}
+
+void RenderQueue_endRead(renderQueue_t *pQueue)
+{
+    pQueue->readIndex = (pQueue->readIndex + 1) % pQueue->numBuffers;
+    sem_post(&pQueue->freeBuffers);
+}
+
+int RenderQueue_getDepth(renderQueue_t *pQueue)
+{
+    return atomic_load(&pQueue->depth);
+}
@@ -0,0 +1,159 @@
+#include "sampleCache.h"
+#include "waveFile.h"
+#include "adpcm.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    const SampleCache_sound_t *pInfo;
+    wavedata_t sound;
+    bool loaded;
+    int pins;
+    unsigned long long lastUse;
+} cacheEntry_t;
+
+// Only the producer threads (beat, main loop, UDP) take this lock; the
+// playback thread only ever touches wavedata_t.voiceRefs.
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static cacheEntry_t *entries = NULL;
+static int numEntries = 0;
+static size_t budget = 0;
+static size_t residentBytes = 0;
+static unsigned long long useClock = 0;
+
+static size_t entryBytes(const cacheEntry_t *pEntry)
+{
+    size_t bytes = pEntry->sound.pAdpcm
+        ? Adpcm_getEncodedBytes(pEntry->sound.numSamples)
+        : (size_t)pEntry->sound.numSamples * sizeof(short);
+    if (pEntry->sound.pPeaks) {
+        bytes += (size_t)WAVEFILE_PEAK_BLOCKS(pEntry->sound.numSamples) * sizeof(uint16_t);
+    }
+    return bytes;
+}
+
+static bool isEvictable(cacheEntry_t *pEntry)
+{
+    return pEntry->loaded
+        && pEntry->pins == 0
+        && atomic_load_explicit(&pEntry->sound.voiceRefs, memory_order_acquire) == 0;
+}
+
+static void unloadEntry(cacheEntry_t *pEntry)
+{
+    residentBytes -= entryBytes(pEntry);
+    WaveFile_unmap(&pEntry->sound);
+    pEntry->loaded = false;
+}
+
+// Caller holds cacheMutex. Best effort: if every resident sample is in use
+// the cache stays over budget until some of them finish.
+static void evictToBudget(void)
+{
+    while (residentBytes > budget) {
+        cacheEntry_t *pOldest = NULL;
+        for (int i = 0; i < numEntries; i++) {
+            if (isEvictable(&entries[i])
+                    && (pOldest == NULL || entries[i].lastUse < pOldest->lastUse)) {
+                pOldest = &entries[i];
+            }
+        }
+        if (pOldest == NULL) {
+            return;
+        }
+        unloadEntry(pOldest);
+    }
+}
+
+void SampleCache_init(const SampleCache_sound_t *sounds, int numSounds, size_t budgetBytes)
+{
+    pthread_mutex_lock(&cacheMutex);
+    entries = calloc(numSounds, sizeof(*entries));
+    if (entries == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate sample cache.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < numSounds; i++) {
+        entries[i].pInfo = &sounds[i];
+    }
+    numEntries = numSounds;
+    budget = budgetBytes;
+    residentBytes = 0;
+    useClock = 0;
+    pthread_mutex_unlock(&cacheMutex);
+}
+
+// The mixer must be stopped first: any sample still referenced by a voice
+// is unloaded regardless.
+void SampleCache_cleanup(void)
+{
+    pthread_mutex_lock(&cacheMutex);
+    for (int i = 0; i < numEntries; i++) {
+        if (entries[i].loaded) {
+            unloadEntry(&entries[i]);
+        }
+    }
+    free(entries);
+    entries = NULL;
+    numEntries = 0;
+    pthread_mutex_unlock(&cacheMutex);
+}
+
+int SampleCache_getNumSounds(void)
+{
+    return numEntries;
+}
+
+wavedata_t *SampleCache_acquire(int soundId)
+{
+    wavedata_t *pSound = NULL;
+    pthread_mutex_lock(&cacheMutex);
+    if (soundId >= 0 && soundId < numEntries) {
+        cacheEntry_t *pEntry = &entries[soundId];
+        if (!pEntry->loaded && WaveFile_map(pEntry->pInfo->fileName, &pEntry->sound)) {
+            pEntry->sound.priority = pEntry->pInfo->priority;
+            pEntry->sound.chokeGroup = pEntry->pInfo->chokeGroup;
+            WaveFile_trimLeadingSilence(&pEntry->sound, pEntry->pInfo->trimThreshold);
+            // Without peaks the sample still plays, the mixer just clamps.
+            WaveFile_scanPeaks(&pEntry->sound);
+            if (pEntry->pInfo->compress) {
+                // Keeps the PCM (uncompressed) if this fails.
+                WaveFile_compress(&pEntry->sound);
+            }
+            pEntry->loaded = true;
+            residentBytes += entryBytes(pEntry);
+        }
+        if (pEntry->loaded) {
+            pEntry->pins++;
+            pEntry->lastUse = ++useClock;
+            pSound = &pEntry->sound;
+            evictToBudget();
+        }
+    }
+    pthread_mutex_unlock(&cacheMutex);
+    return pSound;
+}
+
+void SampleCache_release(wavedata_t *pSound)
+{
+    if (pSound == NULL) return;
+    pthread_mutex_lock(&cacheMutex);
+    for (int i = 0; i < numEntries; i++) {
+        if (&entries[i].sound == pSound) {
+            entries[i].pins--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cacheMutex);
+}
+
+size_t SampleCache_getResidentBytes(void)
+{
+    pthread_mutex_lock(&cacheMutex);
+    size_t bytes = residentBytes;
+    pthread_mutex_unlock(&cacheMutex);
+    return bytes;
+}
@@ -0,0 +1,738 @@
+#include "sequencer.h"
+#include "adpcm.h"
+#include "mixKernel.h"
+#include "waveFile.h"
+#include "hal/threadPolicy.h"
+#include <limits.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define MAX_RETIRED 16
+#define RECLAIM_POLL_US 1000
+
+// Bars longer than this (10 s at 44.1 kHz) are always played step by step.
+#define MAX_BAR_FRAMES 441000
+#define MAX_HITS (SEQUENCER_MAX_STEPS * SEQUENCER_MAX_TRACKS)
+// As the mixer's fade for a choked voice.
+#define CUT_FADE_FRAMES 64
+#define DECODE_CHUNK_FRAMES 1024
+// Silences at least this long split a cached bar into pieces, so that the
+// mixer idles between them as it would between the hits. At most
+// MAX_PIECES per sound; the last piece takes in any gaps after it.
+#define MIN_GAP_FRAMES 1024
+#define MAX_PIECES 16
+
+// A published copy. Serial numbers tell patterns apart even when a new
+// copy reuses a freed one's address.
+typedef struct {
+    Sequencer_pattern_t pattern;
+    unsigned long serial;
+} published_t;
+
+// One hit of a cached bar, in frames from the top of the bar. A hit fades
+// out from fadeStart to end when the next hit of its choke group cuts it.
+typedef struct {
+    wavedata_t *pSound;
+    int offset;
+    int fadeStart;
+    int end;
+} barHit_t;
+
+// A stretch of a cached bar's samples between silences, queued as a sound
+// of its own `offset` frames into the bar.
+typedef struct {
+    wavedata_t sound;
+    int offset;
+} barPiece_t;
+
+// One bar of a pattern at one tempo, mixed into `bar`: each hit with its
+// whole tail, choked as it would be with the bar repeating. Tails make the
+// sound longer than the bar, but never by a whole bar, so a cached bar
+// overlaps only the one before it. Where the hits add up to more than 16
+// bits, the rest is in `excess`, which starts excessOffset frames in: the
+// mixer's bus then sums to exactly what the hits would have, before the
+// master gain and clipping. Both are played as pieces[], which point into
+// them. chokers[] are silent sounds in the choke groups of the tracks
+// (chokerOf[track], or -1), queued at each of their hits to cut off other
+// voices as the real hits would.
+typedef struct {
+    unsigned long serial;
+    int bpm;
+    unsigned int rate;
+    wavedata_t bar;
+    wavedata_t excess;
+    int excessOffset;
+    int numPieces;
+    barPiece_t pieces[2 * MAX_PIECES];
+    int numHits;
+    barHit_t hits[MAX_HITS];
+    int chokerOf[SEQUENCER_MAX_TRACKS];
+    wavedata_t chokers[SEQUENCER_MAX_TRACKS];
+} barCache_t;
+
+// The published pattern. The playback thread loads it once per period
+// with inCallback set, then counts the period done; a pattern replaced
+// while callbacksDone still read `stamp` can only be in use by a callback
+// that began before the swap, and is freed once that one has finished.
+static _Atomic(published_t *) currentPattern = NULL;
+static atomic_bool inCallback = false;
+static atomic_ullong callbacksDone = 0;
+static atomic_int requestedBPM = 120;
+
+// Replaced patterns awaiting reclamation. Publishers only.
+typedef struct {
+    void *pObject;
+    unsigned long long stamp;
+} retired_t;
+static pthread_mutex_t publishMutex = PTHREAD_MUTEX_INITIALIZER;
+static retired_t retired[MAX_RETIRED];
+static int numRetired = 0;
+static unsigned long lastSerial = 0;
+
+// The latest cached bar, published the same way by the renderer thread.
+// The playback thread also holds on to the caches its bars came from for
+// as long as they may sound, and shows which in cachesInUse.
+static _Atomic(barCache_t *) currentCache = NULL;
+static _Atomic(barCache_t *) cachesInUse[2];
+static atomic_bool cacheEnabled = true;
+
+// Renderer thread only (and cleanup(), once it has stopped).
+static pthread_t rendererThreadId;
+static atomic_bool rendererStopping = false;
+static sem_t wakeRenderer;
+static retired_t retiredCaches[MAX_RETIRED];
+static int numRetiredCaches = 0;
+static unsigned long renderedSerial = 0;
+static int renderedBPM = 0;
+static unsigned int renderedRate = 0;
+
+static atomic_llong statBars = 0;
+static atomic_llong statCachedBars = 0;
+static atomic_llong statBarsRendered = 0;
+static atomic_llong statHandovers = 0;
+
+// Playback thread only. nextFrame is the next step on the sample clock
+// (-1 while nothing plays); frameRemainder carries the fraction of a frame
+// the steps have lost to rounding, in 1/(bpm * stepsPerBeat) frames, so
+// the grid never drifts from the true tempo. bars[0] is the cached bar
+// started last (while cachedBar, the current one) and bars[1] the one
+// before, whose tail may still be sounding.
+static unsigned long playingSerial = 0;
+static long long nextFrame = -1;
+static long long frameRemainder = 0;
+static int step = 0;
+static struct {
+    barCache_t *pCache;
+    long long start;
+} bars[2];
+static bool cachedBar = false;
+static int barBPM = 0;
+
+static short silence[1];
+static uint16_t silencePeaks[1];
+
+static bool isReclaimable(const retired_t *pRetired)
+{
+    return atomic_load(&callbacksDone) != pRetired->stamp || !atomic_load(&inCallback);
+}
+
+// Free what the playback thread has finished with. Caller holds
+// publishMutex.
+static void reclaimRetired(void)
+{
+    int i = 0;
+    while (i < numRetired) {
+        if (isReclaimable(&retired[i])) {
+            free(retired[i].pObject);
+            retired[i] = retired[--numRetired];
+            continue;
+        }
+        i++;
+    }
+}
+
+static void freeCache(barCache_t *pCache)
+{
+    if (pCache) {
+        free(pCache->bar.pData);
+        free(pCache->excess.pData);
+        for (int p = 0; p < pCache->numPieces; p++) {
+            free(pCache->pieces[p].sound.pPeaks);
+        }
+        free(pCache);
+    }
+}
+
+static bool isCacheReclaimable(const retired_t *pRetired)
+{
+    barCache_t *pCache = pRetired->pObject;
+    if (!isReclaimable(pRetired)
+            || atomic_load(&cachesInUse[0]) == pCache || atomic_load(&cachesInUse[1]) == pCache) {
+        return false;
+    }
+    for (int p = 0; p < pCache->numPieces; p++) {
+        if (atomic_load(&pCache->pieces[p].sound.voiceRefs) != 0) return false;
+    }
+    for (int t = 0; t < SEQUENCER_MAX_TRACKS; t++) {
+        if (atomic_load(&pCache->chokers[t].voiceRefs) != 0) return false;
+    }
+    return true;
+}
+
+// Renderer thread only.
+static void reclaimCaches(void)
+{
+    int i = 0;
+    while (i < numRetiredCaches) {
+        if (isCacheReclaimable(&retiredCaches[i])) {
+            freeCache(retiredCaches[i].pObject);
+            retiredCaches[i] = retiredCaches[--numRetiredCaches];
+            continue;
+        }
+        i++;
+    }
+}
+
+static int32_t fadeGain(int position, int end, int fadeLength)
+{
+    return (int32_t)((int64_t)MIX_KERNEL_UNITY_GAIN * (end - position) / fadeLength);
+}
+
+// Add one hit, with its fade if it is choked, into the bus at its offset.
+static void mixHit(int32_t *pBus, const barHit_t *pHit)
+{
+    const wavedata_t *pSound = pHit->pSound;
+    int plain = pHit->fadeStart - pHit->offset;
+    int length = pHit->end - pHit->offset;
+    int fadeLength = length - plain;
+    short decoded[DECODE_CHUNK_FRAMES];
+    adpcmDecoder_t decoder;
+    if (pSound->pAdpcm) {
+        Adpcm_seek(&decoder, pSound->pAdpcm, 0);
+    }
+
+    int count;
+    for (int done = 0; done < length; done += count) {
+        count = length - done;
+        if (count > DECODE_CHUNK_FRAMES) count = DECODE_CHUNK_FRAMES;
+        const short *pSamples = decoded;
+        if (pSound->pAdpcm) {
+            Adpcm_decode(&decoder, pSound->pAdpcm, decoded, count);
+        } else {
+            pSamples = pSound->pData + done;
+        }
+        int unfaded = plain - done;
+        if (unfaded < 0) unfaded = 0;
+        if (unfaded > count) unfaded = count;
+        MixKernel_accumulate(pBus + pHit->offset + done, pSamples, unfaded);
+        if (unfaded < count) {
+            int from = done + unfaded;
+            MixKernel_accumulateRamp(pBus + pHit->offset + from, pSamples + unfaded, count - unfaded,
+                fadeGain(from, length, fadeLength), fadeGain(done + count, length, fadeLength));
+        }
+    }
+}
+
+// Split the bus into the bar and its excess. Returns false if even the
+// excess would not fit in 16 bits.
+static bool storeBar(barCache_t *pCache, const int32_t *pBus, int length)
+{
+    MixKernel_saturate(pCache->bar.pData, pBus, length);
+    int first = 0;
+    while (first < length && pBus[first] == pCache->bar.pData[first]) first++;
+    int last = length;
+    while (last > first && pBus[last - 1] == pCache->bar.pData[last - 1]) last--;
+    if (first == last) {
+        return true;
+    }
+
+    pCache->excess.pData = malloc((size_t)(last - first) * sizeof(short));
+    if (pCache->excess.pData == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate a cached bar.\n");
+        return false;
+    }
+    for (int i = first; i < last; i++) {
+        int32_t rest = pBus[i] - pCache->bar.pData[i];
+        if (rest < SHRT_MIN || rest > SHRT_MAX) {
+            return false;
+        }
+        pCache->excess.pData[i - first] = (short)rest;
+    }
+    pCache->excess.numSamples = last - first;
+    pCache->excessOffset = first;
+    return true;
+}
+
+// Frames of the first `length` of *pSound the mixer plays: it skips the
+// blocks whose peak is silence.
+static long long audibleFrames(const wavedata_t *pSound, int length)
+{
+    if (pSound->pPeaks == NULL) {
+        return length;
+    }
+    long long frames = 0;
+    for (int first = 0; first < length; first += AUDIOMIXER_PEAK_BLOCK) {
+        if (pSound->pPeaks[first / AUDIOMIXER_PEAK_BLOCK] != 0) {
+            frames += length - first < AUDIOMIXER_PEAK_BLOCK ? length - first : AUDIOMIXER_PEAK_BLOCK;
+        }
+    }
+    return frames;
+}
+
+// Add the pieces of *pSource, which starts `offset` frames into the bar,
+// each with its peaks. Returns false if out of memory.
+static bool cutPieces(barCache_t *pCache, const wavedata_t *pSource, int offset, int priority)
+{
+    short *pData = pSource->pData;
+    int length = pSource->numSamples;
+    int added = 0;
+    int first = 0;
+    while (true) {
+        while (first < length && pData[first] == 0) first++;
+        if (first == length) {
+            return true;
+        }
+        // Up to the next gap, or to the last sound if this piece is the last.
+        int last = first;
+        int end = first + 1;
+        while (end < length && (end - last <= MIN_GAP_FRAMES || added == MAX_PIECES - 1)) {
+            if (pData[end] != 0) last = end;
+            end++;
+        }
+        barPiece_t *pPiece = &pCache->pieces[pCache->numPieces++];
+        pPiece->sound = (wavedata_t){ .numSamples = last + 1 - first, .pData = pData + first,
+            .priority = priority };
+        pPiece->offset = offset + first;
+        if (!WaveFile_scanPeaks(&pPiece->sound)) {
+            return false;
+        }
+        added++;
+        first = last + 1;
+    }
+}
+
+// Mix one bar of *pPublished at bpm. Returns NULL if the pattern cannot be
+// cached: its bar is too long, its tails reach past the next bar, its hits
+// pile up beyond what a bar and its excess can hold, or it plays a stream.
+// Also NULL if the cache would not save work: its pieces have no fewer
+// audible frames for the mixer than the hits, which only happens where
+// the hits seldom overlap.
+static barCache_t *renderBar(const published_t *pPublished, int bpm, unsigned int rate)
+{
+    const Sequencer_pattern_t *pPattern = &pPublished->pattern;
+    for (int t = 0; t < pPattern->numTracks; t++) {
+        const wavedata_t *pSound = pPattern->tracks[t].pSound;
+        if (pSound == NULL || (pSound->pData == NULL && pSound->pAdpcm == NULL)) {
+            return NULL;
+        }
+    }
+
+    // The steps fall where Sequencer_renderPeriod() puts them, starting
+    // from no remainder. Playing, a bar may start with some, which moves
+    // its steps by up to a frame.
+    int offsets[SEQUENCER_MAX_STEPS];
+    long long stepsPerMinute = (long long)bpm * pPattern->stepsPerBeat;
+    long long frame = 0;
+    long long remainder = 0;
+    for (int s = 0; s < pPattern->numSteps; s++) {
+        offsets[s] = (int)frame;
+        long long span = (long long)rate * 60 + remainder;
+        frame += span / stepsPerMinute;
+        remainder = span % stepsPerMinute;
+    }
+    if (frame > MAX_BAR_FRAMES) {
+        return NULL;
+    }
+    int barFrames = (int)frame;
+
+    barCache_t *pCache = calloc(1, sizeof(*pCache));
+    if (pCache == NULL) {
+        return NULL;
+    }
+    for (int s = 0; s < pPattern->numSteps; s++) {
+        for (int t = 0; t < pPattern->numTracks; t++) {
+            if (pPattern->tracks[t].steps & ((uint64_t)1 << s)) {
+                wavedata_t *pSound = pPattern->tracks[t].pSound;
+                int end = offsets[s] + pSound->numSamples;
+                pCache->hits[pCache->numHits++] = (barHit_t){ pSound, offsets[s], end, end };
+            }
+        }
+    }
+
+    // Each hit is cut by the next one in its choke group to start after it,
+    // in this bar or the next.
+    int length = barFrames;
+    for (int h = 0; h < pCache->numHits; h++) {
+        barHit_t *pHit = &pCache->hits[h];
+        int group = pHit->pSound->chokeGroup;
+        for (int k = 0; k < pCache->numHits && group != 0; k++) {
+            if (pCache->hits[k].pSound->chokeGroup != group) continue;
+            int cut = pCache->hits[k].offset;
+            if (cut <= pHit->offset) cut += barFrames;
+            if (cut < pHit->fadeStart) {
+                pHit->fadeStart = cut;
+                if (cut + CUT_FADE_FRAMES < pHit->end) pHit->end = cut + CUT_FADE_FRAMES;
+            }
+        }
+        if (pHit->end > length) length = pHit->end;
+    }
+    // Bars vary by a frame or so from barFrames: keep clear of a third.
+    if (length + pPattern->numSteps > 2 * barFrames) {
+        free(pCache);
+        return NULL;
+    }
+
+    int32_t *pBus = calloc((size_t)length, sizeof(*pBus));
+    pCache->bar.pData = malloc((size_t)length * sizeof(short));
+    if (pBus == NULL || pCache->bar.pData == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate a cached bar.\n");
+        free(pBus);
+        freeCache(pCache);
+        return NULL;
+    }
+    for (int h = 0; h < pCache->numHits; h++) {
+        mixHit(pBus, &pCache->hits[h]);
+    }
+    pCache->bar.numSamples = length;
+    bool stored = storeBar(pCache, pBus, length);
+    free(pBus);
+    int priority = INT_MIN;
+    for (int t = 0; t < pPattern->numTracks; t++) {
+        const wavedata_t *pSound = pPattern->tracks[t].pSound;
+        if (pSound->priority > priority) priority = pSound->priority;
+    }
+    if (!stored || !cutPieces(pCache, &pCache->bar, 0, priority)
+            || !cutPieces(pCache, &pCache->excess, pCache->excessOffset, priority)) {
+        freeCache(pCache);
+        return NULL;
+    }
+
+    long long hitFrames = 0;
+    for (int h = 0; h < pCache->numHits; h++) {
+        const barHit_t *pHit = &pCache->hits[h];
+        hitFrames += audibleFrames(pHit->pSound, pHit->end - pHit->offset);
+    }
+    long long pieceFrames = 0;
+    for (int p = 0; p < pCache->numPieces; p++) {
+        pieceFrames += audibleFrames(&pCache->pieces[p].sound, pCache->pieces[p].sound.numSamples);
+    }
+    if (pieceFrames >= hitFrames) {
+        freeCache(pCache);
+        return NULL;
+    }
+
+    pCache->serial = pPublished->serial;
+    pCache->bpm = bpm;
+    pCache->rate = rate;
+    for (int t = 0; t < pPattern->numTracks; t++) {
+        wavedata_t *pSound = pPattern->tracks[t].pSound;
+        pCache->chokerOf[t] = -1;
+        if (pSound->chokeGroup != 0) {
+            // Never steals a voice: it has nothing to play.
+            pCache->chokers[t] = (wavedata_t){ .numSamples = 1, .pData = silence,
+                .pPeaks = silencePeaks, .priority = INT_MIN, .chokeGroup = pSound->chokeGroup };
+            pCache->chokerOf[t] = t;
+        }
+    }
+    return pCache;
+}
+
+// Cache a bar of the current pattern and tempo, unless that is done.
+static void refreshCache(void)
+{
+    AudioMixer_latencyInfo_t info;
+    AudioMixer_getLatencyInfo(&info);
+    int bpm = atomic_load(&requestedBPM);
+
+    // Patterns are only freed under publishMutex.
+    published_t copy;
+    pthread_mutex_lock(&publishMutex);
+    published_t *pCurrent = atomic_load(&currentPattern);
+    if (pCurrent) {
+        copy = *pCurrent;
+    }
+    pthread_mutex_unlock(&publishMutex);
+    if (pCurrent == NULL || info.rate == 0
+            || (copy.serial == renderedSerial && bpm == renderedBPM && info.rate == renderedRate)) {
+        return;
+    }
+
+    reclaimCaches();
+    if (numRetiredCaches == MAX_RETIRED) {
+        // The playback thread asks again at its next bar.
+        return;
+    }
+    renderedSerial = copy.serial;
+    renderedBPM = bpm;
+    renderedRate = info.rate;
+    barCache_t *pCache = renderBar(&copy, bpm, info.rate);
+    if (pCache == NULL) {
+        return;
+    }
+    barCache_t *pOld = atomic_exchange(&currentCache, pCache);
+    if (pOld) {
+        retiredCaches[numRetiredCaches++] = (retired_t){ pOld, atomic_load(&callbacksDone) };
+    }
+    atomic_fetch_add_explicit(&statBarsRendered, 1, memory_order_relaxed);
+}
+
+static void* rendererThread(void* _arg)
+{
+    (void)_arg;
+    ThreadPolicy_apply("bars");
+    while (true) {
+        sem_wait(&wakeRenderer);
+        if (atomic_load(&rendererStopping)) {
+            break;
+        }
+        refreshCache();
+    }
+    return NULL;
+}
+
+void Sequencer_init(int bpm)
+{
+    nextFrame = -1;
+    frameRemainder = 0;
+    step = 0;
+    playingSerial = 0;
+    bars[0].pCache = bars[1].pCache = NULL;
+    cachedBar = false;
+    atomic_store(&cachesInUse[0], NULL);
+    atomic_store(&cachesInUse[1], NULL);
+    atomic_store(&requestedBPM, bpm);
+    atomic_store(&statBars, 0);
+    atomic_store(&statCachedBars, 0);
+    atomic_store(&statBarsRendered, 0);
+    atomic_store(&statHandovers, 0);
+
+    renderedSerial = 0;
+    atomic_store(&rendererStopping, false);
+    sem_init(&wakeRenderer, 0, 0);
+    pthread_create(&rendererThreadId, NULL, rendererThread, NULL);
+}
+
+void Sequencer_cleanup(void)
+{
+    atomic_store(&rendererStopping, true);
+    sem_post(&wakeRenderer);
+    pthread_join(rendererThreadId, NULL);
+    sem_destroy(&wakeRenderer);
+    freeCache(atomic_exchange(&currentCache, NULL));
+    for (int i = 0; i < numRetiredCaches; i++) {
+        freeCache(retiredCaches[i].pObject);
+    }
+    numRetiredCaches = 0;
+
+    pthread_mutex_lock(&publishMutex);
+    free(atomic_exchange(&currentPattern, NULL));
+    for (int i = 0; i < numRetired; i++) {
+        free(retired[i].pObject);
+    }
+    numRetired = 0;
+    playingSerial = 0;
+    pthread_mutex_unlock(&publishMutex);
+}
+
+void Sequencer_setPattern(const Sequencer_pattern_t *pPattern)
+{
+    published_t *pCopy = NULL;
+    if (pPattern) {
+        pCopy = malloc(sizeof(*pCopy));
+        if (pCopy == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate pattern.\n");
+            return;
+        }
+        pCopy->pattern = *pPattern;
+    }
+
+    pthread_mutex_lock(&publishMutex);
+    if (pCopy) {
+        pCopy->serial = ++lastSerial;
+    }
+    reclaimRetired();
+    while (numRetired == MAX_RETIRED) {
+        // Patterns are changing faster than the mixer renders periods.
+        usleep(RECLAIM_POLL_US);
+        reclaimRetired();
+    }
+    published_t *pOld = atomic_exchange(&currentPattern, pCopy);
+    if (pOld) {
+        retired[numRetired++] = (retired_t){ pOld, atomic_load(&callbacksDone) };
+    }
+    pthread_mutex_unlock(&publishMutex);
+    // A parked mixer would not call back to start it.
+    AudioMixer_wake();
+}
+
+void Sequencer_setBPM(int bpm)
+{
+    atomic_store_explicit(&requestedBPM, bpm, memory_order_relaxed);
+}
+
+void Sequencer_setBarCache(bool enable)
+{
+    atomic_store(&cacheEnabled, enable);
+}
+
+void Sequencer_getStats(Sequencer_stats_t *pStats)
+{
+    pStats->bars = atomic_load(&statBars);
+    pStats->cachedBars = atomic_load(&statCachedBars);
+    pStats->barsRendered = atomic_load(&statBarsRendered);
+    pStats->handovers = atomic_load(&statHandovers);
+}
+
+static void queueStep(const Sequencer_pattern_t *pPattern, int i, long long frame)
+{
+    uint64_t bit = (uint64_t)1 << i;
+    for (int t = 0; t < pPattern->numTracks; t++) {
+        if (pPattern->tracks[t].steps & bit) {
+            AudioMixer_queueSoundAt(pPattern->tracks[t].pSound, frame);
+        }
+    }
+}
+
+// A step of a cached bar: its sound is already playing, but its hits
+// still cut off whatever else is sounding in their choke groups.
+static void queueChokers(const Sequencer_pattern_t *pPattern, barCache_t *pCache, int i, long long frame)
+{
+    uint64_t bit = (uint64_t)1 << i;
+    for (int t = 0; t < pPattern->numTracks; t++) {
+        if ((pPattern->tracks[t].steps & bit) && pCache->chokerOf[t] >= 0) {
+            AudioMixer_queueSoundAt(&pCache->chokers[pCache->chokerOf[t]], frame);
+        }
+    }
+}
+
+// The pattern or tempo changes at `frame`: end the cached bars there and
+// carry on the hits still ringing in them as voices of their own, as if
+// the bars had been played step by step.
+static void handOverBars(long long frame)
+{
+    for (int b = 0; b < 2; b++) {
+        barCache_t *pCache = bars[b].pCache;
+        bars[b].pCache = NULL;
+        if (pCache == NULL || bars[b].start + pCache->bar.numSamples <= frame) {
+            continue;
+        }
+        for (int p = 0; p < pCache->numPieces; p++) {
+            barPiece_t *pPiece = &pCache->pieces[p];
+            if (bars[b].start + pPiece->offset + pPiece->sound.numSamples > frame) {
+                AudioMixer_stopSoundAt(&pPiece->sound, frame);
+            }
+        }
+        for (int h = 0; h < pCache->numHits; h++) {
+            // Choked from `frame` on only if the choking hit is still to
+            // come; one that was choked before is let go.
+            const barHit_t *pHit = &pCache->hits[h];
+            long long hitFrame = bars[b].start + pHit->offset;
+            if (hitFrame < frame && hitFrame + pHit->pSound->numSamples > frame
+                    && bars[b].start + pHit->fadeStart >= frame) {
+                AudioMixer_queueSoundFrom(pHit->pSound, frame, (int)(frame - hitFrame));
+            }
+        }
+        atomic_fetch_add_explicit(&statHandovers, 1, memory_order_relaxed);
+    }
+    cachedBar = false;
+}
+
+// The top of a bar at `frame`: play it from the cache if there is one for
+// this pattern and tempo, else ask for one.
+static void startBar(const published_t *pPublished, int bpm, unsigned int rate, long long frame)
+{
+    bars[1] = bars[0];
+    bars[0].pCache = NULL;
+    atomic_fetch_add_explicit(&statBars, 1, memory_order_relaxed);
+    if (!atomic_load_explicit(&cacheEnabled, memory_order_relaxed)) {
+        cachedBar = false;
+        return;
+    }
+
+    barCache_t *pCache = atomic_load(&currentCache);
+    cachedBar = pCache && pCache->serial == pPublished->serial && pCache->bpm == bpm && pCache->rate == rate;
+    if (!cachedBar) {
+        sem_post(&wakeRenderer);
+        return;
+    }
+    for (int p = 0; p < pCache->numPieces; p++) {
+        AudioMixer_queueSoundAt(&pCache->pieces[p].sound, frame + pCache->pieces[p].offset);
+    }
+    bars[0].pCache = pCache;
+    bars[0].start = frame;
+    barBPM = bpm;
+    atomic_fetch_add_explicit(&statCachedBars, 1, memory_order_relaxed);
+}
+
+bool Sequencer_isIdle(void *pContext)
+{
+    (void)pContext;
+    // nextFrame only goes back to -1 once the last pattern's bars have been
+    // handed over to voices of their own.
+    return atomic_load(&currentPattern) == NULL && nextFrame < 0;
+}
+
+void Sequencer_renderPeriod(long long firstFrame, unsigned long numFrames, void *pContext)
+{
+    (void)pContext;
+    atomic_store(&inCallback, true);
+    const published_t *pPublished = atomic_load(&currentPattern);
+    int bpm = atomic_load_explicit(&requestedBPM, memory_order_relaxed);
+
+    if (pPublished == NULL) {
+        if (nextFrame >= 0) {
+            handOverBars(nextFrame);
+        }
+        nextFrame = -1;
+        playingSerial = 0;
+    } else {
+        if (nextFrame < firstFrame) {
+            // Starting (or resuming): the first step is the period's first
+            // frame.
+            nextFrame = firstFrame;
+            frameRemainder = 0;
+        }
+
+        AudioMixer_latencyInfo_t info;
+        AudioMixer_getLatencyInfo(&info);
+        long long endFrame = firstFrame + (long long)numFrames;
+        const Sequencer_pattern_t *pPattern = &pPublished->pattern;
+        while (nextFrame < endFrame) {
+            bool newPattern = pPublished->serial != playingSerial;
+            if ((bars[0].pCache || bars[1].pCache) && (newPattern || bpm != barBPM)) {
+                handOverBars(nextFrame);
+            }
+            if (newPattern) {
+                // A new pattern starts from the top of its bar.
+                step = 0;
+                frameRemainder = 0;
+                playingSerial = pPublished->serial;
+            }
+            if (step == 0) {
+                startBar(pPublished, bpm, info.rate, nextFrame);
+            }
+            if (cachedBar) {
+                queueChokers(pPattern, bars[0].pCache, step, nextFrame);
+            } else {
+                queueStep(pPattern, step, nextFrame);
+            }
+            step = (step + 1) % pPattern->numSteps;
+
+            // A step is rate * 60 / (bpm * stepsPerBeat) frames.
+            long long stepsPerMinute = (long long)bpm * pPattern->stepsPerBeat;
+            long long span = (long long)info.rate * 60 + frameRemainder;
+            nextFrame += span / stepsPerMinute;
+            frameRemainder = span % stepsPerMinute;
+        }
+    }
+
+    atomic_store(&cachesInUse[0], bars[0].pCache);
+    atomic_store(&cachesInUse[1], bars[1].pCache);
+    atomic_store(&inCallback, false);
+    atomic_fetch_add(&callbacksDone, 1);
+}
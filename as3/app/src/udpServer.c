@@ -1,5 +1,11 @@
 #include "udpServer.h"
 #include "audioLogic.h"
+#include "audioMixer.h"
+#include "hitLatency.h"
+#include "recorder.h"
+#include "sequencer.h"
+#include "waveFile.h"
+#include "hal/threadPolicy.h"
 #include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -12,6 +18,8 @@
 
 #define PORT 12345
 #define MAX_LEN 1024
+// "record start" without a file name, in the working directory.
+#define RECORD_FILE "beatbox-recording.wav"
 
 static pthread_t udpThreadId;
 static int sockfd;
@@ -20,11 +28,14 @@ static int running = 0;
 
 static void* udpThread(void* arg) {
     (void)arg;
+    ThreadPolicy_apply("udp");
     char buffer[MAX_LEN];
     socklen_t len = sizeof(cliaddr);
 
     while (running) {
-        int n = recvfrom(sockfd, buffer, MAX_LEN, 0, (struct sockaddr *)&cliaddr, &len);
+        // One byte short of the buffer, to leave room for the terminator
+        // when a packet (e.g. a whole pattern definition) fills it.
+        int n = recvfrom(sockfd, buffer, MAX_LEN - 1, 0, (struct sockaddr *)&cliaddr, &len);
         if (n > 0) {
             buffer[n] = '\0';
             char reply[MAX_LEN] = "Unknown command";
@@ -42,6 +53,31 @@ static void* udpThread(void* arg) {
                 sprintf(reply, "%d", Beatbox_getMode());
             } 
             
+            // PATTERNS (the bank, one "mode definition" per line)
+            else if (strncmp(buffer, "patterns", 8) == 0) {
+                size_t used = 0;
+                reply[0] = '\0';
+                int count = Beatbox_getNumPatterns();
+                for (int m = 1; m <= count && used < MAX_LEN; m++) {
+                    char definition[MAX_LEN];
+                    if (Beatbox_describePattern(m, definition, sizeof(definition))) {
+                        used += snprintf(reply + used, MAX_LEN - used, "%s%d %s",
+                            m > 1 ? "\n" : "", m, definition);
+                    }
+                }
+            }
+
+            // PATTERN <definition> (add, or replace by name; replies with its mode)
+            else if (strncmp(buffer, "pattern ", 8) == 0) {
+                char error[MAX_LEN];
+                int patternMode = Beatbox_definePattern(buffer + 8, error, sizeof(error));
+                if (patternMode < 0) {
+                    snprintf(reply, MAX_LEN, "error: %s", error);
+                } else {
+                    sprintf(reply, "%d", patternMode);
+                }
+            }
+
             // VOLUME
             else if (strncmp(buffer, "volume", 6) == 0) {
                 // Check for space + digit (handles "volume undefined")
@@ -64,15 +100,167 @@ static void* udpThread(void* arg) {
                 sprintf(reply, "%d", Beatbox_getBPM());
             }
             
-            // PLAY
+            // PLAY <sound> [rate] (e.g. "play 0 0.75" for a lower base drum)
             else if (strncmp(buffer, "play", 4) == 0) {
                 if (strlen(buffer) > 5 && isdigit(buffer[5])) {
-                    int sound = atoi(buffer + 5);
-                    Beatbox_playSound(sound);
+                    char *end;
+                    int sound = (int)strtol(buffer + 5, &end, 10);
+                    double rate = strtod(end, &end);
+                    if (rate > 0) {
+                        Beatbox_playSoundAtRate(sound, rate);
+                    } else {
+                        Beatbox_playSound(sound);
+                    }
                 }
                 strcpy(reply, "played");
             }
             
+            // LATENCY (negotiated ALSA period/buffer)
+            else if (strncmp(buffer, "latency", 7) == 0) {
+                AudioMixer_latencyInfo_t info;
+                AudioMixer_getLatencyInfo(&info);
+                snprintf(reply, MAX_LEN, "period %lu buffer %lu rate %u latency %.1fms",
+                    info.periodFrames, info.bufferFrames, info.rate, info.latencyMs);
+            }
+
+            // HITS [reset] (accelerometer hit to DAC: percentiles, the stages
+            // on average, then the hits per millisecond as "ms:count")
+            else if (strncmp(buffer, "hits", 4) == 0) {
+                if (strncmp(buffer + 4, " reset", 6) == 0) {
+                    HitLatency_reset();
+                }
+                HitLatency_stats_t stats;
+                HitLatency_getStats(&stats);
+                int used = snprintf(reply, MAX_LEN,
+                    "hits %lld p50 %.1fms p99 %.1fms max %.1fms\n"
+                    "queue avg %.3fms wait avg %.2fms max %.2fms output avg %.2fms max %.2fms\n"
+                    "histogram",
+                    stats.hits, stats.p50Ms, stats.p99Ms, stats.maxMs,
+                    stats.avgQueueMs, stats.avgWaitMs, stats.maxWaitMs, stats.avgOutputMs, stats.maxOutputMs);
+                static long long counts[HITLATENCY_NUM_BUCKETS];
+                HitLatency_getHistogram(counts);
+                const int bucketsPerMs = 1000 / HITLATENCY_BUCKET_US;
+                for (int ms = 0; ms * bucketsPerMs < HITLATENCY_NUM_BUCKETS && used < MAX_LEN; ms++) {
+                    long long count = 0;
+                    for (int i = 0; i < bucketsPerMs; i++) {
+                        count += counts[ms * bucketsPerMs + i];
+                    }
+                    if (count > 0) {
+                        used += snprintf(reply + used, MAX_LEN - used, " %d:%lld", ms, count);
+                    }
+                }
+            }
+
+            // VOICES (allocation counters, for sizing polyphony)
+            else if (strncmp(buffer, "voices", 6) == 0) {
+                AudioMixer_voiceStats_t stats;
+                AudioMixer_getVoiceStats(&stats);
+                snprintf(reply, MAX_LEN,
+                    "active %d peak %d started %lld stolen %lld choked %lld dropped %lld queuefull %lld",
+                    stats.active, stats.peakActive, stats.started, stats.stolen,
+                    stats.choked, stats.dropped, stats.queueFull);
+            }
+
+            // PIPELINE (mix time, render-ahead depth and xruns since last asked)
+            else if (strncmp(buffer, "pipeline", 8) == 0) {
+                static AudioMixer_statsBaseline_t since;
+                AudioMixer_stats_t stats;
+                AudioMixer_getStatsSince(&since, &stats);
+                snprintf(reply, MAX_LEN,
+                    "ahead %d periods %d mix avg %.3fms max %.3fms queue min %d avg %.2f xruns %lld (%.2f/s)",
+                    stats.renderAhead, stats.numPeriods, stats.avgRenderMs, stats.maxRenderMs,
+                    stats.minQueueDepth, stats.avgQueueDepth, stats.xruns,
+                    stats.seconds > 0 ? stats.xruns / stats.seconds : 0);
+            }
+
+            // STATS (DSP load since last asked; output faults, clipping,
+            // peak polyphony, bar cache use and idling since start)
+            else if (strncmp(buffer, "stats", 5) == 0) {
+                static AudioMixer_statsBaseline_t since;
+                AudioMixer_stats_t stats;
+                AudioMixer_getStatsSince(&since, &stats);
+                Sequencer_stats_t bars;
+                Sequencer_getStats(&bars);
+                snprintf(reply, MAX_LEN,
+                    "load avg %.1f%% max %.1f%% over %d periods\n"
+                    "xruns %lld recoveries %lld shortwrites %lld\n"
+                    "clipped %lld unclamped %lld periods peakvoices %d streamunderruns %lld\n"
+                    "bars %lld cached %lld rendered %lld handovers %lld\n"
+                    "idle %lld periods parked %lld times %.1fs",
+                    stats.avgDspLoad * 100, stats.maxDspLoad * 100, stats.numPeriods,
+                    stats.totalXruns, stats.recoveries, stats.shortWrites,
+                    stats.clippedSamples, stats.unclampedPeriods, stats.peakVoices, stats.streamUnderruns,
+                    bars.bars, bars.cachedBars, bars.barsRendered, bars.handovers,
+                    stats.idlePeriods, stats.parks, stats.parkedSeconds);
+                if (stats.packetsSent > 0 || stats.sendErrors > 0) {
+                    size_t used = strlen(reply);
+                    snprintf(reply + used, MAX_LEN - used, "\nnet packets %lld errors %lld kbps %.0f",
+                        stats.packetsSent, stats.sendErrors, stats.sendKbps);
+                }
+                Recorder_stats_t recording;
+                Recorder_getStats(&recording);
+                if (recording.recording) {
+                    size_t used = strlen(reply);
+                    snprintf(reply + used, MAX_LEN - used, "\nrecord frames %lld dropped %lld periods %lld frames",
+                        recording.framesWritten, recording.droppedPeriods, recording.droppedFrames);
+                }
+            }
+
+            // RECORD [start [name.wav] | stop] (replies with the recording's
+            // state). The name is a bare file name, written in the working
+            // directory: a client cannot pick where the file goes.
+            else if (strncmp(buffer, "record", 6) == 0) {
+                // Not cancelled by UDP_cleanup() halfway through finishing a file.
+                int oldState;
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldState);
+                bool rejected = false;
+                if (strncmp(buffer + 6, " start", 6) == 0) {
+                    char *fileName = buffer + 12;
+                    while (*fileName == ' ') fileName++;
+                    fileName[strcspn(fileName, "\r\n")] = '\0';
+                    if (*fileName == '\0') {
+                        Recorder_start(RECORD_FILE);
+                    } else if (WaveFile_isPlainName(fileName)) {
+                        Recorder_start(fileName);
+                    } else {
+                        rejected = true;
+                    }
+                } else if (strncmp(buffer + 6, " stop", 5) == 0) {
+                    Recorder_stop();
+                }
+                pthread_setcancelstate(oldState, NULL);
+                Recorder_stats_t recording;
+                Recorder_getStats(&recording);
+                snprintf(reply, MAX_LEN, "%s%s %.1fs dropped %lld periods%s",
+                    rejected ? "not a plain .wav name; " : "",
+                    recording.recording ? "recording" : "stopped",
+                    (double)recording.framesWritten / WAVEFILE_SAMPLE_RATE,
+                    recording.droppedPeriods, recording.writeFailed ? " (write failed)" : "");
+            }
+
+            // STREAM <name.wav> | STREAM STOP (a backing track played from
+            // disk, out of the kit directory only)
+            else if (strncmp(buffer, "stream", 6) == 0) {
+                char *fileName = buffer + 6;
+                while (*fileName == ' ') fileName++;
+                fileName[strcspn(fileName, "\r\n")] = '\0';
+                if (strcmp(fileName, "stop") == 0) {
+                    Beatbox_stopStream();
+                    strcpy(reply, "stream stopped");
+                } else if (*fileName == '\0') {
+                    strcpy(reply, "usage: stream <name.wav> | stream stop");
+                } else if (Beatbox_playStream(fileName)) {
+                    snprintf(reply, MAX_LEN, "streaming %s", fileName);
+                } else {
+                    snprintf(reply, MAX_LEN, "cannot stream %s", fileName);
+                }
+            }
+
+            // THREADS (applied scheduling policy and fault/switch counts)
+            else if (strncmp(buffer, "threads", 7) == 0) {
+                ThreadPolicy_report(reply, MAX_LEN);
+            }
+
             // STOP
             else if (strncmp(buffer, "stop", 4) == 0) {
                 strcpy(reply, "stopping");
@@ -0,0 +1,65 @@
+// Bounded MPSC ring based on Dmitry Vyukov's sequenced-slot queue.
+// Each slot carries a sequence number telling whose turn it is:
+//   sequence == pos      -> free, a producer may claim position pos
+//   sequence == pos + 1  -> holds the command published for position pos
+#include "voiceQueue.h"
+#include <stdint.h>
+
+#define QUEUE_MASK (VOICE_QUEUE_CAPACITY - 1)
+_Static_assert((VOICE_QUEUE_CAPACITY & QUEUE_MASK) == 0,
+        "VOICE_QUEUE_CAPACITY must be a power of two");
+
+void VoiceQueue_init(voiceQueue_t *pQueue)
+{
+    for (size_t i = 0; i < VOICE_QUEUE_CAPACITY; i++) {
+        atomic_init(&pQueue->slots[i].sequence, i);
+        pQueue->slots[i].command.pSound = NULL;
+    }
+    atomic_init(&pQueue->enqueuePos, 0);
+    pQueue->dequeuePos = 0;
+}
+
+bool VoiceQueue_push(voiceQueue_t *pQueue, const voiceCommand_t *pCommand)
+{
+    voiceQueueSlot_t *pSlot;
+    size_t pos = atomic_load_explicit(&pQueue->enqueuePos, memory_order_relaxed);
+    for (;;) {
+        pSlot = &pQueue->slots[pos & QUEUE_MASK];
+        size_t seq = atomic_load_explicit(&pSlot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            // Slot is free for this lap: try to claim it.
+            if (atomic_compare_exchange_weak_explicit(&pQueue->enqueuePos, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+            // CAS failure reloaded pos; retry with the new value.
+        } else if (diff < 0) {
+            // Consumer has not freed this slot yet: queue is full.
+            return false;
+        } else {
+            // Another producer claimed it first.
+            pos = atomic_load_explicit(&pQueue->enqueuePos, memory_order_relaxed);
+        }
+    }
+
+    pSlot->command = *pCommand;
+    atomic_store_explicit(&pSlot->sequence, pos + 1, memory_order_release);
+    return true;
+}
+
+bool VoiceQueue_pop(voiceQueue_t *pQueue, voiceCommand_t *pCommand)
+{
+    size_t pos = pQueue->dequeuePos;
+    voiceQueueSlot_t *pSlot = &pQueue->slots[pos & QUEUE_MASK];
+    size_t seq = atomic_load_explicit(&pSlot->sequence, memory_order_acquire);
+    if (seq != pos + 1) {
+        // Empty, or the producer that claimed this slot is still writing it.
+        return false;
+    }
+
+    *pCommand = pSlot->command;
+    atomic_store_explicit(&pSlot->sequence, pos + VOICE_QUEUE_CAPACITY, memory_order_release);
+    pQueue->dequeuePos = pos + 1;
+    return true;
+}
@@ -0,0 +1,331 @@
+#include "waveFile.h"
+#include "adpcm.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RIFF_HEADER_SIZE 12
+#define CHUNK_HEADER_SIZE 8
+#define FMT_CHUNK_MIN_SIZE 16
+#define WAVE_FORMAT_PCM 1
+
+// WAV fields are little-endian; read them bytewise so alignment never matters.
+static uint16_t readLe16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t readLe32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void writeLe16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void writeLe32(uint8_t *p, uint32_t value)
+{
+    writeLe16(p, (uint16_t)value);
+    writeLe16(p + 2, (uint16_t)(value >> 16));
+}
+
+static bool checkFormat(const char *fileName, const uint8_t *pFmt, uint32_t size)
+{
+    if (size < FMT_CHUNK_MIN_SIZE) {
+        fprintf(stderr, "ERROR: %s: 'fmt ' chunk too short.\n", fileName);
+        return false;
+    }
+    uint16_t format = readLe16(pFmt);
+    uint16_t channels = readLe16(pFmt + 2);
+    uint32_t rate = readLe32(pFmt + 4);
+    uint16_t bits = readLe16(pFmt + 14);
+    if (format != WAVE_FORMAT_PCM
+            || channels != WAVEFILE_NUM_CHANNELS
+            || rate != WAVEFILE_SAMPLE_RATE
+            || bits != WAVEFILE_BITS_PER_SAMPLE) {
+        fprintf(stderr, "ERROR: %s: format %u, %u ch, %u Hz, %u bit; need PCM S16_LE mono %d Hz.\n",
+            fileName, format, channels, rate, bits, WAVEFILE_SAMPLE_RATE);
+        return false;
+    }
+    return true;
+}
+
+// Map fileName and find its samples. On success *ppMapping/*pMappingSize
+// describe the mapping and *ppData/*pDataSize the "data" chunk within it.
+static bool mapAndParse(const char *fileName, void **ppMapping, size_t *pMappingSize,
+    const uint8_t **ppData, uint32_t *pDataSize)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Unable to open file %s.\n", fileName);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) < 0 || info.st_size < RIFF_HEADER_SIZE) {
+        fprintf(stderr, "ERROR: %s is not a WAV file.\n", fileName);
+        close(fd);
+        return false;
+    }
+    size_t fileSize = (size_t)info.st_size;
+    void *pMapping = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping holds its own reference to the file.
+    close(fd);
+    if (pMapping == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Unable to map file %s.\n", fileName);
+        return false;
+    }
+
+    const uint8_t *pFile = pMapping;
+    if (memcmp(pFile, "RIFF", 4) != 0 || memcmp(pFile + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "ERROR: %s is not a RIFF/WAVE file.\n", fileName);
+        munmap(pMapping, fileSize);
+        return false;
+    }
+
+    // Walk the chunk list; anything other than "fmt " and "data" is skipped.
+    bool haveFormat = false;
+    const uint8_t *pData = NULL;
+    uint32_t dataSize = 0;
+    size_t pos = RIFF_HEADER_SIZE;
+    while (pos + CHUNK_HEADER_SIZE <= fileSize && pData == NULL) {
+        const uint8_t *pChunk = pFile + pos;
+        uint32_t chunkSize = readLe32(pChunk + 4);
+        size_t bodyPos = pos + CHUNK_HEADER_SIZE;
+        size_t available = fileSize - bodyPos;
+
+        if (memcmp(pChunk, "fmt ", 4) == 0) {
+            if (!checkFormat(fileName, pFile + bodyPos, chunkSize > available ? available : chunkSize)) {
+                munmap(pMapping, fileSize);
+                return false;
+            }
+            haveFormat = true;
+        } else if (memcmp(pChunk, "data", 4) == 0) {
+            pData = pFile + bodyPos;
+            // Tolerate truncated files (and streaming writers that leave 0).
+            dataSize = (chunkSize == 0 || chunkSize > available) ? (uint32_t)available : chunkSize;
+        }
+        if (chunkSize > available) {
+            break;
+        }
+        // Chunks are padded to an even length.
+        pos = bodyPos + chunkSize + (chunkSize & 1);
+    }
+
+    if (!haveFormat || pData == NULL) {
+        fprintf(stderr, "ERROR: %s: missing '%s' chunk.\n", fileName, haveFormat ? "data" : "fmt ");
+        munmap(pMapping, fileSize);
+        return false;
+    }
+
+    *ppMapping = pMapping;
+    *pMappingSize = fileSize;
+    *ppData = pData;
+    *pDataSize = dataSize;
+    return true;
+}
+
+bool WaveFile_map(const char *fileName, wavedata_t *pSound)
+{
+    memset(pSound, 0, sizeof(*pSound));
+
+    void *pMapping;
+    size_t fileSize;
+    const uint8_t *pData;
+    uint32_t dataSize;
+    if (!mapAndParse(fileName, &pMapping, &fileSize, &pData, &dataSize)) {
+        return false;
+    }
+    // Drum hits are played from the start: ask for read-ahead now so the
+    // first trigger doesn't take the page faults.
+    madvise(pMapping, fileSize, MADV_WILLNEED);
+
+    pSound->numSamples = dataSize / sizeof(short);
+    if (((uintptr_t)pData % sizeof(short)) == 0) {
+        // Zero-copy: samples stay in the (shared, page-cache backed) mapping.
+        pSound->pData = (short *)pData;
+        pSound->pMapping = pMapping;
+        pSound->mappingSize = fileSize;
+    } else {
+        // Odd chunk layout: copy once so the mixer gets aligned samples.
+        pSound->pData = malloc(pSound->numSamples * sizeof(short));
+        if (pSound->pData == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate %d samples.\n", pSound->numSamples);
+            munmap(pMapping, fileSize);
+            return false;
+        }
+        memcpy(pSound->pData, pData, pSound->numSamples * sizeof(short));
+        munmap(pMapping, fileSize);
+    }
+    return true;
+}
+
+bool WaveFile_openData(const char *fileName, int *pFd, off_t *pDataOffset, int *pNumSamples)
+{
+    void *pMapping;
+    size_t fileSize;
+    const uint8_t *pData;
+    uint32_t dataSize;
+    // Only the header pages of the mapping are ever touched.
+    if (!mapAndParse(fileName, &pMapping, &fileSize, &pData, &dataSize)) {
+        return false;
+    }
+    *pDataOffset = pData - (const uint8_t *)pMapping;
+    *pNumSamples = dataSize / sizeof(short);
+    munmap(pMapping, fileSize);
+
+    *pFd = open(fileName, O_RDONLY);
+    if (*pFd < 0) {
+        fprintf(stderr, "ERROR: Unable to open file %s.\n", fileName);
+        return false;
+    }
+    posix_fadvise(*pFd, *pDataOffset, 0, POSIX_FADV_SEQUENTIAL);
+    return true;
+}
+
+bool WaveFile_compress(wavedata_t *pSound)
+{
+    if (pSound->pAdpcm || pSound->pData == NULL) {
+        return true;
+    }
+    uint8_t *pBlocks = malloc(Adpcm_getEncodedBytes(pSound->numSamples));
+    if (pBlocks == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate ADPCM data for %d samples.\n", pSound->numSamples);
+        return false;
+    }
+    Adpcm_encode(pSound->pData, pSound->numSamples, pBlocks);
+
+    int numSamples = pSound->numSamples;
+    bool hadPeaks = pSound->pPeaks != NULL;
+    WaveFile_unmap(pSound);
+    pSound->numSamples = numSamples;
+    pSound->pAdpcm = pBlocks;
+    if (hadPeaks) {
+        // The decoded samples are not quite the originals: scan what the
+        // mixer will actually play. Without peaks it just always clamps.
+        WaveFile_scanPeaks(pSound);
+    }
+    return true;
+}
+
+int WaveFile_trimLeadingSilence(wavedata_t *pSound, int threshold)
+{
+    if (threshold <= 0 || pSound->pData == NULL || pSound->pAdpcm) {
+        return 0;
+    }
+    int trimmed = 0;
+    while (trimmed < pSound->numSamples && abs(pSound->pData[trimmed]) <= threshold) {
+        trimmed++;
+    }
+    if (trimmed == 0) {
+        return 0;
+    }
+    pSound->numSamples -= trimmed;
+    if (pSound->pMapping) {
+        // The mapping itself is released as a whole by WaveFile_unmap().
+        pSound->pData += trimmed;
+    } else {
+        memmove(pSound->pData, pSound->pData + trimmed, (size_t)pSound->numSamples * sizeof(short));
+    }
+    if (pSound->pPeaks) {
+        WaveFile_scanPeaks(pSound);
+    }
+    return trimmed;
+}
+
+bool WaveFile_scanPeaks(wavedata_t *pSound)
+{
+    free(pSound->pPeaks);
+    pSound->pPeaks = NULL;
+    if (pSound->pStream || pSound->numSamples <= 0) {
+        return true;
+    }
+    int numBlocks = WAVEFILE_PEAK_BLOCKS(pSound->numSamples);
+    uint16_t *pPeaks = malloc((size_t)numBlocks * sizeof(*pPeaks));
+    if (pPeaks == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate peaks for %d samples.\n", pSound->numSamples);
+        return false;
+    }
+    adpcmDecoder_t decoder;
+    if (pSound->pAdpcm) {
+        Adpcm_seek(&decoder, pSound->pAdpcm, 0);
+    }
+    for (int block = 0; block < numBlocks; block++) {
+        int first = block * AUDIOMIXER_PEAK_BLOCK;
+        int count = pSound->numSamples - first;
+        if (count > AUDIOMIXER_PEAK_BLOCK) count = AUDIOMIXER_PEAK_BLOCK;
+        short decoded[AUDIOMIXER_PEAK_BLOCK];
+        const short *pSamples = pSound->pData + first;
+        if (pSound->pAdpcm) {
+            Adpcm_decode(&decoder, pSound->pAdpcm, decoded, count);
+            pSamples = decoded;
+        }
+        int peak = 0;
+        for (int i = 0; i < count; i++) {
+            int sample = abs(pSamples[i]);
+            if (sample > peak) peak = sample;
+        }
+        pPeaks[block] = (uint16_t)peak;
+    }
+    pSound->pPeaks = pPeaks;
+    return true;
+}
+
+void WaveFile_unmap(wavedata_t *pSound)
+{
+    free(pSound->pAdpcm);
+    free(pSound->pPeaks);
+    if (pSound->pMapping) {
+        munmap(pSound->pMapping, pSound->mappingSize);
+    } else {
+        free(pSound->pData);
+    }
+    pSound->numSamples = 0;
+    pSound->pData = NULL;
+    pSound->pMapping = NULL;
+    pSound->mappingSize = 0;
+    pSound->pAdpcm = NULL;
+    pSound->pPeaks = NULL;
+}
+
+bool WaveFile_isPlainName(const char *name)
+{
+    size_t length = strlen(name);
+    return length > 4 && name[0] != '.' && strpbrk(name, "/\\") == NULL
+        && strcmp(name + length - 4, ".wav") == 0;
+}
+
+bool WaveFile_writeHeader(FILE *pFile, uint32_t numSamples)
+{
+    const uint16_t blockAlign = WAVEFILE_NUM_CHANNELS * WAVEFILE_BITS_PER_SAMPLE / 8;
+    uint32_t dataSize = numSamples * (uint32_t)sizeof(short);
+    uint8_t header[RIFF_HEADER_SIZE + CHUNK_HEADER_SIZE + FMT_CHUNK_MIN_SIZE + CHUNK_HEADER_SIZE];
+    uint8_t *p = header;
+
+    memcpy(p, "RIFF", 4);
+    writeLe32(p + 4, sizeof(header) - CHUNK_HEADER_SIZE + dataSize);
+    memcpy(p + 8, "WAVE", 4);
+    p += RIFF_HEADER_SIZE;
+
+    memcpy(p, "fmt ", 4);
+    writeLe32(p + 4, FMT_CHUNK_MIN_SIZE);
+    writeLe16(p + 8, WAVE_FORMAT_PCM);
+    writeLe16(p + 10, WAVEFILE_NUM_CHANNELS);
+    writeLe32(p + 12, WAVEFILE_SAMPLE_RATE);
+    writeLe32(p + 16, WAVEFILE_SAMPLE_RATE * blockAlign);
+    writeLe16(p + 20, blockAlign);
+    writeLe16(p + 22, WAVEFILE_BITS_PER_SAMPLE);
+    p += CHUNK_HEADER_SIZE + FMT_CHUNK_MIN_SIZE;
+
+    memcpy(p, "data", 4);
+    writeLe32(p + 4, dataSize);
+
+    return fwrite(header, sizeof(header), 1, pFile) == 1;
+}
@@ -0,0 +1,160 @@
+// Cost of holding samples IMA-ADPCM compressed. For each kit sample:
+// memory before and after, and the signal-to-noise ratio of the round
+// trip. Then, per period: mixing voices straight from PCM versus decoding
+// each voice's period and mixing that, as the mixer does for compressed
+// sounds. The decode must fit the per-voice budget below.
+//
+// Usage: adpcm_bench   (run from the as3 directory)
+#include "adpcm.h"
+#include "mixKernel.h"
+#include "waveFile.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define KIT_DIR "beatbox-wav-files/"
+#define PERIOD_FRAMES 512
+#define NUM_PERIODS 4000
+// Extra time a compressed voice may take, as a fraction of the period it
+// renders: with 30 voices all compressed that is 15% of the CPU.
+#define DECODE_BUDGET_FRACTION 0.005
+
+static const char *kitFiles[] = {
+    KIT_DIR "100051__menegass__gui-drum-bd-hard.wav",
+    KIT_DIR "100055__menegass__gui-drum-co.wav",
+    KIT_DIR "100056__menegass__gui-drum-cyn-hard.wav",
+    KIT_DIR "100060__menegass__gui-drum-splash-hard.wav",
+};
+#define NUM_FILES ((int)(sizeof(kitFiles) / sizeof(kitFiles[0])))
+
+static int32_t bus[PERIOD_FRAMES];
+static short decoded[PERIOD_FRAMES];
+static short out[PERIOD_FRAMES];
+
+static long long getTimeInNanoS(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+static double snrInDb(const short *pOriginal, const uint8_t *pBlocks, int numSamples)
+{
+    short *pDecoded = malloc(numSamples * sizeof(short));
+    adpcmDecoder_t decoder;
+    Adpcm_seek(&decoder, pBlocks, 0);
+    Adpcm_decode(&decoder, pBlocks, pDecoded, numSamples);
+    double signal = 0, noise = 0;
+    for (int i = 0; i < numSamples; i++) {
+        double error = pDecoded[i] - pOriginal[i];
+        signal += (double)pOriginal[i] * pOriginal[i];
+        noise += error * error;
+    }
+    free(pDecoded);
+    return noise > 0 ? 10 * log10(signal / noise) : INFINITY;
+}
+
+// Voice v plays from its own offset, a period further on every period,
+// wrapping round the sample like a retriggered hit.
+static int voiceLocation(int voice, int period, int numSamples)
+{
+    int span = numSamples / PERIOD_FRAMES * PERIOD_FRAMES;
+    return (voice * 997 + period * PERIOD_FRAMES) % span / PERIOD_FRAMES * PERIOD_FRAMES;
+}
+
+static double timePcm(const wavedata_t *pSound, int numVoices)
+{
+    long long start = getTimeInNanoS();
+    for (int p = 0; p < NUM_PERIODS; p++) {
+        memset(bus, 0, sizeof(bus));
+        for (int v = 0; v < numVoices; v++) {
+            int location = voiceLocation(v, p, pSound->numSamples);
+            MixKernel_accumulate(bus, pSound->pData + location, PERIOD_FRAMES);
+        }
+        MixKernel_saturate(out, bus, PERIOD_FRAMES);
+    }
+    return (double)(getTimeInNanoS() - start) / NUM_PERIODS;
+}
+
+static double timeAdpcm(const uint8_t *pBlocks, int numSamples, int numVoices)
+{
+    adpcmDecoder_t decoders[64];
+    for (int v = 0; v < numVoices; v++) {
+        Adpcm_seek(&decoders[v], pBlocks, voiceLocation(v, 0, numSamples));
+    }
+    long long start = getTimeInNanoS();
+    for (int p = 0; p < NUM_PERIODS; p++) {
+        memset(bus, 0, sizeof(bus));
+        for (int v = 0; v < numVoices; v++) {
+            // Wrapping is a seek to a block boundary: just a header read.
+            int location = voiceLocation(v, p, numSamples);
+            if (decoders[v].position != location) {
+                Adpcm_seek(&decoders[v], pBlocks, location);
+            }
+            Adpcm_decode(&decoders[v], pBlocks, decoded, PERIOD_FRAMES);
+            MixKernel_accumulate(bus, decoded, PERIOD_FRAMES);
+        }
+        MixKernel_saturate(out, bus, PERIOD_FRAMES);
+    }
+    return (double)(getTimeInNanoS() - start) / NUM_PERIODS;
+}
+
+int main(void)
+{
+    wavedata_t sounds[NUM_FILES];
+    uint8_t *encoded[NUM_FILES];
+    size_t pcmTotal = 0, adpcmTotal = 0;
+
+    printf("IMA-ADPCM, %d-frame blocks\n", ADPCM_BLOCK_FRAMES);
+    for (int i = 0; i < NUM_FILES; i++) {
+        if (!WaveFile_map(kitFiles[i], &sounds[i])) {
+            return EXIT_FAILURE;
+        }
+        size_t pcmBytes = (size_t)sounds[i].numSamples * sizeof(short);
+        size_t adpcmBytes = Adpcm_getEncodedBytes(sounds[i].numSamples);
+        encoded[i] = malloc(adpcmBytes);
+        if (encoded[i] == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate ADPCM data.\n");
+            return EXIT_FAILURE;
+        }
+        Adpcm_encode(sounds[i].pData, sounds[i].numSamples, encoded[i]);
+        pcmTotal += pcmBytes;
+        adpcmTotal += adpcmBytes;
+        printf("  %-45s %7zu -> %6zu bytes  SNR %5.1f dB\n",
+            strrchr(kitFiles[i], '/') + 1, pcmBytes, adpcmBytes,
+            snrInDb(sounds[i].pData, encoded[i], sounds[i].numSamples));
+    }
+    printf("  total %zu -> %zu bytes (%.2fx smaller)\n\n",
+        pcmTotal, adpcmTotal, (double)pcmTotal / adpcmTotal);
+
+    // Time against the longest sample so voices spread across it.
+    int longest = 0;
+    for (int i = 1; i < NUM_FILES; i++) {
+        if (sounds[i].numSamples > sounds[longest].numSamples) longest = i;
+    }
+    double periodNs = PERIOD_FRAMES * 1e9 / WAVEFILE_SAMPLE_RATE;
+    int overBudget = 0;
+    printf("Mix kernel: %s, %d frames/period, %d periods\n",
+        MixKernel_name(), PERIOD_FRAMES, NUM_PERIODS);
+    const int voiceCounts[] = { 1, 8, 30, 64 };
+    for (size_t i = 0; i < sizeof(voiceCounts) / sizeof(voiceCounts[0]); i++) {
+        int n = voiceCounts[i];
+        double pcmNs = timePcm(&sounds[longest], n);
+        double adpcmNs = timeAdpcm(encoded[longest], sounds[longest].numSamples, n);
+        double extraPerVoice = (adpcmNs - pcmNs) / n / periodNs;
+        bool withinBudget = extraPerVoice <= DECODE_BUDGET_FRACTION;
+        overBudget += !withinBudget;
+        printf("%3d voices: pcm %8.1f ns/period  adpcm %8.1f ns/period  "
+            "decode %5.2f ns/sample/voice  %.3f%% of period per voice %s\n",
+            n, pcmNs, adpcmNs, (adpcmNs - pcmNs) / n / PERIOD_FRAMES,
+            extraPerVoice * 100, withinBudget ? "ok" : "OVER BUDGET");
+    }
+
+    for (int i = 0; i < NUM_FILES; i++) {
+        free(encoded[i]);
+        WaveFile_unmap(&sounds[i]);
+    }
+    return overBudget ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,112 @@
+// CPU used by the mixer with nothing to play, as in mode 0 with no hits.
+// Runs the mixer on the network sink, which is paced by the wall clock
+// like a sound card, streaming to a socket of this process that is never
+// read. Each run idles for a while and reports CPU time (user + system,
+// all threads) as a percentage of one core:
+//   writing  - parking off: a period of zeros to the sink every period
+//   parked   - idleParkMs: the output stops after that long idle
+// Then queues a hit on the parked mixer and reports how long it took to
+// start the voice.
+//
+// Usage: idle_bench [seconds per run] [port]
+#include "audioMixer.h"
+#include "periodTimer.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define PARK_MS 200
+
+static long long getTimeInNs(int clock)
+{
+    struct timespec spec;
+    clock_gettime(clock, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+static long long getCpuNs(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+static void run(const char *profile, const char *target, int parkMs, int seconds, wavedata_t *pHit)
+{
+    AudioMixer_config_t config;
+    AudioMixer_getDefaultConfig(&config);
+    AudioMixer_setLatencyProfile(&config, profile);
+    config.sink = AUDIOMIXER_SINK_NETWORK;
+    config.netTarget = target;
+    config.idleParkMs = parkMs;
+    AudioMixer_initWithConfig(&config);
+    // Past the park delay, so only the steady state is measured.
+    usleep(PARK_MS * 2 * 1000);
+
+    long long startNs = getTimeInNs(CLOCK_MONOTONIC);
+    long long startCpu = getCpuNs();
+    sleep(seconds);
+    double cpu = (getCpuNs() - startCpu) * 100.0 / (getTimeInNs(CLOCK_MONOTONIC) - startNs);
+
+    // A hit on the idle mixer: time until its voice has been started.
+    AudioMixer_voiceStats_t voices;
+    AudioMixer_getVoiceStats(&voices);
+    long long started = voices.started;
+    long long queuedNs = getTimeInNs(CLOCK_MONOTONIC);
+    AudioMixer_queueSound(pHit);
+    do {
+        usleep(50);
+        AudioMixer_getVoiceStats(&voices);
+    } while (voices.started == started);
+    double resumeMs = (getTimeInNs(CLOCK_MONOTONIC) - queuedNs) / 1e6;
+
+    AudioMixer_stats_t stats;
+    AudioMixer_getStatsAndClear(&stats);
+    AudioMixer_latencyInfo_t info;
+    AudioMixer_getLatencyInfo(&info);
+    printf("%-7s period %4lu  %-7s  CPU %6.3f%%  idle periods %6lld  parked %lld times  hit started after %.3f ms\n",
+        profile, info.periodFrames, parkMs ? "parked" : "writing", cpu,
+        stats.idlePeriods, stats.parks, resumeMs);
+    AudioMixer_cleanup();
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    int port = argc > 2 ? atoi(argv[2]) : 5004;
+
+    // Bound but never read: the kernel drops what does not fit, so the
+    // sink's sends succeed and nothing in this process receives.
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in local = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        fprintf(stderr, "Unable to listen on port %d: %s\n", port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    char target[32];
+    snprintf(target, sizeof(target), "127.0.0.1:%d", port);
+
+    // A short click, so the voice ends and the mixer can go idle again.
+    static short clickSamples[64];
+    for (int i = 0; i < 64; i++) clickSamples[i] = (short)(i % 2 ? 8000 : -8000);
+    wavedata_t click = { .numSamples = 64, .pData = clickSamples };
+
+    Period_init();
+    printf("Idle mixer over loopback, %d s per run\n", seconds);
+    static const char *profiles[] = { "default", "ultra" };
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++) {
+        run(profiles[i], target, 0, seconds, &click);
+        run(profiles[i], target, PARK_MS, seconds, &click);
+    }
+    Period_cleanup();
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,126 @@
+// Microbenchmark for the mixer's inner loop.
+//   legacy - the original fillPlaybackBuffer(): per voice, per sample
+//            add-and-clamp straight into the 16-bit output.
+//   kernel - MixKernel: accumulate into a 32-bit bus, saturate once.
+//   unclamped - MixKernel_add() straight into the 16-bit output, as the
+//            mixer does when the voices' block peaks rule out clipping.
+//            Timed on the same material, where it would wrap instead.
+// Mixes 8, 30 and 128 voices per period and reports ns per output sample.
+#include "mixKernel.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PERIOD_FRAMES 512
+#define SAMPLE_FRAMES 44100
+#define NUM_PERIODS 2000
+
+static short *samples;
+static short legacyOut[PERIOD_FRAMES];
+static short kernelOut[PERIOD_FRAMES];
+static short unclampedOut[PERIOD_FRAMES];
+static int32_t bus[PERIOD_FRAMES];
+
+static long long getTimeInNanoS(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+// Voice v reads from its own offset so voices don't share cache lines.
+static const short *voiceData(int voice, int period)
+{
+    int offset = (voice * 997 + period * PERIOD_FRAMES) % (SAMPLE_FRAMES - PERIOD_FRAMES);
+    return samples + offset;
+}
+
+static void mixLegacy(short *buff, int numVoices, int period)
+{
+    memset(buff, 0, PERIOD_FRAMES * sizeof(short));
+    for (int v = 0; v < numVoices; v++) {
+        const short *pData = voiceData(v, period);
+        for (int j = 0; j < PERIOD_FRAMES; j++) {
+            int sample = (int)buff[j] + (int)pData[j];
+            if (sample > SHRT_MAX) sample = SHRT_MAX;
+            else if (sample < SHRT_MIN) sample = SHRT_MIN;
+            buff[j] = (short)sample;
+        }
+    }
+}
+
+static void mixKernel(short *buff, int numVoices, int period)
+{
+    memset(bus, 0, sizeof(bus));
+    for (int v = 0; v < numVoices; v++) {
+        MixKernel_accumulate(bus, voiceData(v, period), PERIOD_FRAMES);
+    }
+    MixKernel_saturate(buff, bus, PERIOD_FRAMES);
+}
+
+static void mixUnclamped(short *buff, int numVoices, int period)
+{
+    memset(buff, 0, PERIOD_FRAMES * sizeof(short));
+    for (int v = 0; v < numVoices; v++) {
+        MixKernel_add(buff, voiceData(v, period), PERIOD_FRAMES);
+    }
+}
+
+static double timeMix(void (*mix)(short *, int, int), short *buff, int numVoices)
+{
+    long long start = getTimeInNanoS();
+    for (int p = 0; p < NUM_PERIODS; p++) {
+        mix(buff, numVoices, p);
+    }
+    long long elapsed = getTimeInNanoS() - start;
+    return (double)elapsed / ((double)NUM_PERIODS * PERIOD_FRAMES);
+}
+
+static void fillSamples(int shift)
+{
+    srand(351);
+    for (int i = 0; i < SAMPLE_FRAMES; i++) {
+        samples[i] = (short)((rand() % 65536 - 32768) >> shift);
+    }
+}
+
+int main(void)
+{
+    samples = malloc(SAMPLE_FRAMES * sizeof(*samples));
+    if (samples == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate samples.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Quiet material never clips, so all the mixes must agree exactly.
+    fillSamples(8);
+    mixLegacy(legacyOut, 128, 0);
+    mixKernel(kernelOut, 128, 0);
+    mixUnclamped(unclampedOut, 128, 0);
+    if (memcmp(legacyOut, kernelOut, sizeof(legacyOut)) != 0
+            || memcmp(legacyOut, unclampedOut, sizeof(legacyOut)) != 0) {
+        fprintf(stderr, "ERROR: %s kernel does not match legacy mix.\n", MixKernel_name());
+        return EXIT_FAILURE;
+    }
+
+    // Full-scale material for timing (clipping paths exercised).
+    fillSamples(0);
+    printf("Mix kernel: %s, %d frames/period, %d periods\n",
+        MixKernel_name(), PERIOD_FRAMES, NUM_PERIODS);
+    const int voiceCounts[] = { 8, 30, 128 };
+    for (size_t i = 0; i < sizeof(voiceCounts) / sizeof(voiceCounts[0]); i++) {
+        int n = voiceCounts[i];
+        double legacyNs = timeMix(mixLegacy, legacyOut, n);
+        double kernelNs = timeMix(mixKernel, kernelOut, n);
+        double unclampedNs = timeMix(mixUnclamped, unclampedOut, n);
+        printf("%3d voices: legacy %7.3f ns/sample  kernel %7.3f ns/sample  speedup %.2fx"
+            "  unclamped %7.3f ns/sample  %.2fx over kernel\n",
+            n, legacyNs, kernelNs, legacyNs / kernelNs, unclampedNs, kernelNs / unclampedNs);
+    }
+
+    free(samples);
+    return 0;
+}
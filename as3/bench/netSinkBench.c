@@ -0,0 +1,217 @@
+// Network sink over loopback. Plays the Rock beat through the mixer's
+// network sink to 127.0.0.1 in real time, receives the packets on a thread
+// of this process, and checks the stream against an offline render of the
+// same beat, frame for frame. Reports, per period size:
+//   packets/send - packets per sendmmsg() call (one call per period)
+//   kbps         - bitrate on the wire, RTP headers included
+//   lost         - gaps in the sequence numbers; reordered packets
+//   mismatched   - frames that differ from the offline render
+//   latency      - send to arrival, average/p99/max
+//
+// Usage: net_sink_bench [seconds per run] [port]
+//        (run from the as3 directory; writes and then removes
+//        net_sink_bench.wav in the current directory)
+#define _GNU_SOURCE
+#include "audioMixer.h"
+#include "netAudio.h"
+#include "periodTimer.h"
+#include "sequencer.h"
+#include "waveFile.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define KIT_DIR "beatbox-wav-files/"
+#define REFERENCE_FILE "net_sink_bench.wav"
+#define SAMPLE_RATE 44100
+#define BPM 120
+#define RECEIVE_BATCH 16
+#define RECEIVE_TIMEOUT_MS 200
+
+static Sequencer_pattern_t rock;
+// "127.0.0.1:port", listened on and streamed to.
+static char address[32];
+static int sock;
+static volatile bool receiving;
+
+// Filled in by the receive thread.
+static short *received;
+static bool *receivedFlags;
+static long long maxFrames;
+static long long packets, bytes, reordered, firstSequence = -1, lastSequence;
+static long long firstTimestamp = -1;
+static double *latenciesMs;
+static long long maxLatencies;
+
+static int compareDoubles(const void *pA, const void *pB)
+{
+    double a = *(const double *)pA, b = *(const double *)pB;
+    return (a > b) - (a < b);
+}
+
+static void *receiveThread(void *arg)
+{
+    (void)arg;
+    static uint8_t buffers[RECEIVE_BATCH][NETAUDIO_MAX_PACKET];
+    struct iovec iovecs[RECEIVE_BATCH];
+    struct mmsghdr messages[RECEIVE_BATCH];
+    for (int i = 0; i < RECEIVE_BATCH; i++) {
+        iovecs[i] = (struct iovec){ .iov_base = buffers[i], .iov_len = NETAUDIO_MAX_PACKET };
+        messages[i] = (struct mmsghdr){ .msg_hdr = { .msg_iov = &iovecs[i], .msg_iovlen = 1 } };
+    }
+    short samples[NETAUDIO_MAX_FRAMES];
+    while (receiving) {
+        int count = recvmmsg(sock, messages, RECEIVE_BATCH, MSG_WAITFORONE, NULL);
+        long long arrivedNs = NetAudio_getRealTimeNs();
+        for (int i = 0; i < count; i++) {
+            NetAudio_header_t header;
+            if (!NetAudio_parse(buffers[i], messages[i].msg_len, &header, samples)) continue;
+            // One short run: neither counter wraps relative to the first.
+            if (firstSequence < 0) {
+                firstSequence = lastSequence = header.sequence;
+                firstTimestamp = header.timestamp;
+            }
+            long long sequence = firstSequence + (uint16_t)(header.sequence - (uint16_t)firstSequence);
+            if (sequence < lastSequence) reordered++;
+            if (sequence > lastSequence) lastSequence = sequence;
+            if (packets < maxLatencies) {
+                latenciesMs[packets] = (arrivedNs - header.sentNs) / 1e6;
+            }
+            packets++;
+            bytes += messages[i].msg_len;
+
+            long long frame = (uint32_t)(header.timestamp - (uint32_t)firstTimestamp);
+            for (int f = 0; f < header.numFrames && frame + f < maxFrames; f++) {
+                received[frame + f] = samples[f];
+                receivedFlags[frame + f] = true;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void render(AudioMixer_sink_t sink, unsigned int periodFrames, long long frames)
+{
+    Sequencer_init(BPM);
+    Sequencer_setPattern(&rock);
+    AudioMixer_config_t config;
+    AudioMixer_getDefaultConfig(&config);
+    config.sink = sink;
+    config.outputFile = REFERENCE_FILE;
+    config.netTarget = address;
+    config.periodFrames = periodFrames;
+    config.numPeriods = 2;
+    config.renderFrames = frames;
+    config.renderCallback = Sequencer_renderPeriod;
+    AudioMixer_initWithConfig(&config);
+    AudioMixer_waitForRender();
+    AudioMixer_cleanup();
+    Sequencer_cleanup();
+}
+
+static void runPeriod(unsigned int periodFrames, int seconds)
+{
+    long long frames = (long long)seconds * SAMPLE_RATE;
+    render(AUDIOMIXER_SINK_WAVE_FILE, periodFrames, frames);
+    wavedata_t reference;
+    if (!WaveFile_map(REFERENCE_FILE, &reference)) {
+        exit(EXIT_FAILURE);
+    }
+
+    maxFrames = frames;
+    received = calloc(frames, sizeof(*received));
+    receivedFlags = calloc(frames, sizeof(*receivedFlags));
+    maxLatencies = frames;
+    latenciesMs = malloc(maxLatencies * sizeof(*latenciesMs));
+    if (received == NULL || receivedFlags == NULL || latenciesMs == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    packets = bytes = reordered = 0;
+    firstSequence = firstTimestamp = -1;
+    receiving = true;
+    pthread_t threadId;
+    pthread_create(&threadId, NULL, receiveThread, NULL);
+
+    render(AUDIOMIXER_SINK_NETWORK, periodFrames, frames);
+    AudioMixer_stats_t stats;
+    AudioMixer_getStatsAndClear(&stats);
+    // Let the last packets arrive.
+    usleep(RECEIVE_TIMEOUT_MS * 1000);
+    receiving = false;
+    pthread_join(threadId, NULL);
+
+    long long mismatched = 0, missing = 0;
+    for (long long i = 0; i < frames; i++) {
+        if (!receivedFlags[i]) {
+            missing++;
+        } else if (i >= reference.numSamples || received[i] != reference.pData[i]) {
+            mismatched++;
+        }
+    }
+    WaveFile_unmap(&reference);
+    unlink(REFERENCE_FILE);
+
+    long long expected = firstSequence < 0 ? 0 : lastSequence - firstSequence + 1;
+    long long n = packets < maxLatencies ? packets : maxLatencies;
+    qsort(latenciesMs, n, sizeof(*latenciesMs), compareDoubles);
+    double sum = 0;
+    for (long long i = 0; i < n; i++) sum += latenciesMs[i];
+    long long periods = (frames + periodFrames - 1) / periodFrames;
+    printf("period %4u  %6lld packets  %4.2f packets/send  %6.0f kbps  lost %lld reordered %lld"
+        "  missing %lld mismatched %lld frames  latency %.3f/%.3f/%.3f ms\n",
+        periodFrames, packets, (double)packets / periods, bytes * 8 / 1000.0 / seconds,
+        expected - packets, reordered, missing, mismatched,
+        n ? sum / n : 0, n ? latenciesMs[(long long)(0.99 * (n - 1))] : 0, n ? latenciesMs[n - 1] : 0);
+    if (stats.sendErrors > 0) {
+        printf("             %lld packets failed to send\n", stats.sendErrors);
+    }
+    free(received);
+    free(receivedFlags);
+    free(latenciesMs);
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    const char *port = argc > 2 ? argv[2] : "5004";
+    static const unsigned int periods[] = { 128, 551, 2048 };
+
+    snprintf(address, sizeof(address), "127.0.0.1:%s", port);
+    struct sockaddr_in local;
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = RECEIVE_TIMEOUT_MS * 1000 };
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (!NetAudio_parseAddress(address, &local) || sock < 0
+            || setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0
+            || bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", address, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    Period_init();
+    wavedata_t base, snare, hiHat;
+    AudioMixer_readWaveFileIntoMemory(KIT_DIR "100051__menegass__gui-drum-bd-hard.wav", &base);
+    AudioMixer_readWaveFileIntoMemory(KIT_DIR "100059__menegass__gui-drum-snare-soft.wav", &snare);
+    AudioMixer_readWaveFileIntoMemory(KIT_DIR "100053__menegass__gui-drum-cc.wav", &hiHat);
+    rock = (Sequencer_pattern_t){
+        .numSteps = 8, .stepsPerBeat = 2, .numTracks = 3,
+        .tracks = { { &hiHat, 0x55 }, { &base, 0x11 }, { &snare, 0x44 } },
+    };
+
+    printf("Rock at %d bpm over loopback, %d s per run\n", BPM, seconds);
+    for (size_t i = 0; i < sizeof(periods) / sizeof(periods[0]); i++) {
+        runPeriod(periods[i], seconds);
+    }
+
+    close(sock);
+    AudioMixer_freeWaveFileData(&base);
+    AudioMixer_freeWaveFileData(&snare);
+    AudioMixer_freeWaveFileData(&hiHat);
+    Period_cleanup();
+    return 0;
+}
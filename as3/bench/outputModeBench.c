@@ -0,0 +1,115 @@
+// Compares the mixer's ALSA output paths:
+//   writei - mix into playbackBuffer, snd_pcm_writei() copies it to the ring
+//   mmap   - mix straight into the ring via snd_pcm_mmap_begin/commit
+//   ahead2 - writei, with mixing pipelined two periods ahead of the writer
+// Reports process CPU time per period and the period cadence measured by
+// PERIOD_EVENT_AUDIO_BUFFER, plus mix time, render-ahead queue depth and
+// xruns. Defaults to the "null" PCM so it runs without a sound card; there
+// the loop is not paced by hardware, so compare CPU per period, and use a
+// real device (e.g. "default") to compare jitter and xruns.
+//
+// spike_ms stalls one mix pass in every SPIKE_INTERVAL periods by that much,
+// to see which paths ride out a slow period without an underrun.
+//
+// Usage: output_mode_bench [device] [seconds] [spike_ms]
+//        (run from the as3 directory)
+#include "audioMixer.h"
+#include "periodTimer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WAV_FILE "beatbox-wav-files/100051__menegass__gui-drum-bd-hard.wav"
+#define TRIGGER_INTERVAL_US 5000
+#define SPIKE_INTERVAL 50
+
+static double getTimeInMs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000.0 + spec.tv_nsec / 1000000.0;
+}
+
+// Runs on the mixing thread at the start of each period.
+static void injectSpike(long long firstFrame, unsigned long numFrames, void *pContext)
+{
+    int spikeMs = *(int *)pContext;
+    if (spikeMs > 0 && (firstFrame / numFrames) % SPIKE_INTERVAL == SPIKE_INTERVAL - 1) {
+        double end = getTimeInMs() + spikeMs;
+        while (getTimeInMs() < end) {
+        }
+    }
+}
+
+static double getCpuTimeInMs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &spec);
+    return spec.tv_sec * 1000.0 + spec.tv_nsec / 1000000.0;
+}
+
+static void runMode(const char *device, AudioMixer_outputMode_t mode, int renderAhead,
+        const char *name, int seconds, int spikeMs, wavedata_t *pSound)
+{
+    AudioMixer_config_t config;
+    AudioMixer_getDefaultConfig(&config);
+    config.device = device;
+    config.outputMode = mode;
+    config.renderAhead = renderAhead;
+    config.renderCallback = injectSpike;
+    config.pRenderContext = &spikeMs;
+    AudioMixer_initWithConfig(&config);
+
+    Period_statistics_t stats;
+    AudioMixer_stats_t pipeline;
+    Period_getStatisticsAndClear(PERIOD_EVENT_AUDIO_BUFFER, &stats);
+    AudioMixer_getStatsAndClear(&pipeline);
+    double cpuStart = getCpuTimeInMs();
+
+    // Keep a steady stream of overlapping voices going.
+    for (int elapsed = 0; elapsed < seconds * 1000000; elapsed += TRIGGER_INTERVAL_US) {
+        AudioMixer_queueSound(pSound);
+        usleep(TRIGGER_INTERVAL_US);
+    }
+
+    double cpuMs = getCpuTimeInMs() - cpuStart;
+    Period_getStatisticsAndClear(PERIOD_EVENT_AUDIO_BUFFER, &stats);
+    AudioMixer_getStatsAndClear(&pipeline);
+    AudioMixer_cleanup();
+
+    if (stats.numSamples == 0) {
+        printf("%-6s no periods completed\n", name);
+        return;
+    }
+    printf("%-6s periods %6d  cpu/period %8.4f ms  period [%.3f, %.3f] avg %.3f ms  jitter %.3f ms\n",
+        name, stats.numSamples, cpuMs / stats.numSamples,
+        stats.minPeriodInMs, stats.maxPeriodInMs, stats.avgPeriodInMs,
+        stats.maxPeriodInMs - stats.minPeriodInMs);
+    printf("       mix avg %.3f max %.3f ms  load avg %.1f%% max %.1f%%  queue min %d avg %.2f  xruns %lld (%.2f/s)\n",
+        pipeline.avgRenderMs, pipeline.maxRenderMs,
+        pipeline.avgDspLoad * 100, pipeline.maxDspLoad * 100, pipeline.minQueueDepth,
+        pipeline.avgQueueDepth, pipeline.xruns,
+        pipeline.seconds > 0 ? pipeline.xruns / pipeline.seconds : 0);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *device = argc > 1 ? argv[1] : "null";
+    int seconds = argc > 2 ? atoi(argv[2]) : 3;
+    int spikeMs = argc > 3 ? atoi(argv[3]) : 0;
+
+    Period_init();
+    wavedata_t sound;
+    AudioMixer_readWaveFileIntoMemory(WAV_FILE, &sound);
+
+    printf("Output path benchmark on \"%s\", %d s per mode, %d ms mix spikes\n",
+        device, seconds, spikeMs);
+    runMode(device, AUDIOMIXER_OUTPUT_WRITEI, 0, "writei", seconds, spikeMs, &sound);
+    runMode(device, AUDIOMIXER_OUTPUT_MMAP, 0, "mmap", seconds, spikeMs, &sound);
+    runMode(device, AUDIOMIXER_OUTPUT_WRITEI, 2, "ahead2", seconds, spikeMs, &sound);
+
+    AudioMixer_freeWaveFileData(&sound);
+    Period_cleanup();
+    return 0;
+}
@@ -0,0 +1,177 @@
+// The sequencer playing the Rock beat at each tempo from the render
+// callback, once hit by hit and once from the bar cache.
+//
+// Offline: drives the mixer with the null sink (or a WAV file) so the
+// playback loop runs unthrottled on its sample clock. Reports how many
+// frames the mixer renders per CPU-second (the bar renderer's CPU time
+// included), the speed-up over real time and how many bars came from the
+// cache. This is throughput, not the steady state: the "bars" thread
+// renders at normal priority and can fall behind the unthrottled loop, so
+// few bars may come from the cache.
+//
+// Real time: plays through the network sink, paced by the wall clock like
+// a sound card, to a socket of this process that is never read. From the
+// second bar on, once the cache has had its chance to catch up, measures
+// whole bars and reports CPU time (user + system, all threads) as a
+// percentage of one core, the mixer's average time per period (render
+// callback included) and how many bars came from the cache. Most of the
+// CPU time is the sink's; the time per period is the mix alone.
+//
+// Usage: render_bench [seconds of audio per tempo] [out.wav] [port]
+//        (run from the as3 directory; with out.wav, the first offline
+//        tempo is written to that file instead of being discarded)
+#include "audioMixer.h"
+#include "periodTimer.h"
+#include "sequencer.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define KIT_DIR "beatbox-wav-files/"
+#define SAMPLE_RATE 44100
+#define POLL_US 10000
+
+static double getTimeInS(clockid_t clock)
+{
+    struct timespec spec;
+    clock_gettime(clock, &spec);
+    return spec.tv_sec + spec.tv_nsec / 1e9;
+}
+
+static void runTempo(const Sequencer_pattern_t *pPattern, int bpm, bool barCache, int seconds,
+    const char *outputFile)
+{
+    Sequencer_setBarCache(barCache);
+    Sequencer_init(bpm);
+    Sequencer_setPattern(pPattern);
+    AudioMixer_config_t config;
+    AudioMixer_getDefaultConfig(&config);
+    config.sink = outputFile ? AUDIOMIXER_SINK_WAVE_FILE : AUDIOMIXER_SINK_NULL;
+    config.outputFile = outputFile;
+    config.renderFrames = (long long)seconds * SAMPLE_RATE;
+    config.renderCallback = Sequencer_renderPeriod;
+
+    double wallStart = getTimeInS(CLOCK_MONOTONIC);
+    double cpuStart = getTimeInS(CLOCK_PROCESS_CPUTIME_ID);
+    AudioMixer_initWithConfig(&config);
+    AudioMixer_waitForRender();
+    double cpuS = getTimeInS(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+    double wallS = getTimeInS(CLOCK_MONOTONIC) - wallStart;
+    long long frames = AudioMixer_getFramesRendered();
+    AudioMixer_cleanup();
+    Sequencer_stats_t stats;
+    Sequencer_getStats(&stats);
+    Sequencer_cleanup();
+
+    printf("%3d bpm  %-5s %-6s %9lld frames  wall %7.1f ms  cpu %7.1f ms  %6.2f Mframes/cpu-s"
+        "  %6.0fx real time  bars %lld/%lld cached\n",
+        bpm, outputFile ? "file" : "null", barCache ? "cached" : "hits", frames, wallS * 1000,
+        cpuS * 1000, frames / cpuS / 1e6, frames / (double)SAMPLE_RATE / wallS,
+        stats.cachedBars, stats.bars);
+}
+
+static double getCpuS(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void runRealTime(const Sequencer_pattern_t *pPattern, int bpm, bool barCache, int seconds,
+    const char *target)
+{
+    Sequencer_setBarCache(barCache);
+    Sequencer_init(bpm);
+    Sequencer_setPattern(pPattern);
+    AudioMixer_config_t config;
+    AudioMixer_getDefaultConfig(&config);
+    config.sink = AUDIOMIXER_SINK_NETWORK;
+    config.netTarget = target;
+    config.renderCallback = Sequencer_renderPeriod;
+    AudioMixer_initWithConfig(&config);
+
+    Sequencer_stats_t stats;
+    do {
+        usleep(POLL_US);
+        Sequencer_getStats(&stats);
+    } while (stats.bars < 2);
+    long long barsBefore = stats.bars;
+    long long cachedBefore = stats.cachedBars;
+    double barS = pPattern->numSteps * 60.0 / ((double)bpm * pPattern->stepsPerBeat);
+    int numBars = (int)(seconds / barS + 0.5);
+    if (numBars < 1) numBars = 1;
+
+    AudioMixer_stats_t mixer;
+    AudioMixer_getStatsAndClear(&mixer);
+    double wallStart = getTimeInS(CLOCK_MONOTONIC);
+    double cpuStart = getCpuS();
+    usleep((useconds_t)(numBars * barS * 1e6));
+    double cpu = (getCpuS() - cpuStart) * 100 / (getTimeInS(CLOCK_MONOTONIC) - wallStart);
+    AudioMixer_getStatsAndClear(&mixer);
+    Sequencer_getStats(&stats);
+    AudioMixer_cleanup();
+    Sequencer_cleanup();
+
+    printf("%3d bpm  %-6s %3d bars  CPU %6.3f%%  mix %7.4f ms/period  bars %lld/%lld cached\n",
+        bpm, barCache ? "cached" : "hits", numBars, cpu, mixer.avgRenderMs,
+        stats.cachedBars - cachedBefore, stats.bars - barsBefore);
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 60;
+    const char *outputFile = argc > 2 ? argv[2] : NULL;
+    int port = argc > 3 ? atoi(argv[3]) : 5004;
+
+    // Bound but never read: the kernel drops what does not fit, so the
+    // sink's sends succeed and nothing in this process receives.
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in local = { .sin_family = AF_INET, .sin_port = htons((uint16_t)port) };
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock < 0 || bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        fprintf(stderr, "Unable to listen on port %d: %s\n", port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    char target[32];
+    snprintf(target, sizeof(target), "127.0.0.1:%d", port);
+
+    static const int tempos[] = { 60, 120, 200, 300 };
+
+    Period_init();
+    wavedata_t base, snare, hiHat;
+    AudioMixer_readWaveFileIntoMemory(KIT_DIR "100051__menegass__gui-drum-bd-hard.wav", &base);
+    AudioMixer_readWaveFileIntoMemory(KIT_DIR "100059__menegass__gui-drum-snare-soft.wav", &snare);
+    AudioMixer_readWaveFileIntoMemory(KIT_DIR "100053__menegass__gui-drum-cc.wav", &hiHat);
+
+    // Steps 0-7 are bits 0-7: hi-hat on the beat, base on 1 and 3, snare
+    // on 2 and 4.
+    Sequencer_pattern_t rock = {
+        .numSteps = 8, .stepsPerBeat = 2, .numTracks = 3,
+        .tracks = { { &hiHat, 0x55 }, { &base, 0x11 }, { &snare, 0x44 } },
+    };
+    printf("Offline render of %d s of Rock per tempo\n", seconds);
+    for (size_t i = 0; i < sizeof(tempos) / sizeof(tempos[0]); i++) {
+        runTempo(&rock, tempos[i], false, seconds, i == 0 ? outputFile : NULL);
+        runTempo(&rock, tempos[i], true, seconds, NULL);
+    }
+    printf("Real time over loopback, about %d s of Rock per tempo\n", seconds);
+    for (size_t i = 0; i < sizeof(tempos) / sizeof(tempos[0]); i++) {
+        runRealTime(&rock, tempos[i], false, seconds, target);
+        runRealTime(&rock, tempos[i], true, seconds, target);
+    }
+
+    AudioMixer_freeWaveFileData(&base);
+    AudioMixer_freeWaveFileData(&snare);
+    AudioMixer_freeWaveFileData(&hiHat);
+    Period_cleanup();
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,131 @@
+// Per-voice cost of variable-rate playback against the integer-step path.
+//   unity     - MixKernel_accumulate() straight from the sample, as the
+//               mixer does for a voice at rate 1.0.
+//   resampled - MixKernel_resample() into a period buffer, then
+//               MixKernel_accumulate(), as the mixer does at any other rate.
+// First checks the kernel against a plain C phase accumulator at awkward
+// rates and phases, then reports ns per voice per output frame.
+#include "mixKernel.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PERIOD_FRAMES 512
+#define NUM_VOICES 30
+#define NUM_PERIODS 2000
+// Enough source for a period at the highest rate tested, from any voice.
+#define SAMPLE_FRAMES (44100 + PERIOD_FRAMES * 4 + 1)
+
+static short *samples;
+static short resampled[PERIOD_FRAMES];
+static short reference[PERIOD_FRAMES];
+static int32_t bus[PERIOD_FRAMES];
+
+static long long getTimeInNanoS(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+static void resampleReference(short *pOut, const short *pSrc, int count, uint32_t phase, uint32_t rate)
+{
+    uint64_t position = phase;
+    for (int i = 0; i < count; i++) {
+        const short *pPair = pSrc + (position >> 16);
+        int32_t weight = (int32_t)((position & 0xffff) >> 2);
+        pOut[i] = (short)((pPair[0] * (16384 - weight) + pPair[1] * weight) >> 14);
+        position += rate;
+    }
+}
+
+static bool checkKernel(void)
+{
+    static const double rates[] = { 0.25, 0.5, 0.9438743, 1.0, 1.0594631, 1.5, 2.0, 3.999 };
+    static const uint32_t phases[] = { 0, 1, 32768, 65535 };
+    // Odd counts exercise the scalar tail after the vector blocks.
+    static const int counts[] = { 1, 7, PERIOD_FRAMES - 3, PERIOD_FRAMES };
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        uint32_t rate = (uint32_t)(rates[r] * MIX_KERNEL_UNITY_RATE);
+        for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++) {
+            for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+                MixKernel_resample(resampled, samples + 17, counts[c], phases[p], rate);
+                resampleReference(reference, samples + 17, counts[c], phases[p], rate);
+                if (memcmp(resampled, reference, counts[c] * sizeof(short)) != 0) {
+                    fprintf(stderr, "ERROR: %s kernel differs at rate %.4f phase %u count %d.\n",
+                        MixKernel_name(), rates[r], phases[p], counts[c]);
+                    return false;
+                }
+            }
+        }
+    }
+    // A long block at the fastest rate crosses the kernel's rebasing.
+    static short longOut[8192];
+    static short longReference[8192];
+    uint32_t rate = 4 * MIX_KERNEL_UNITY_RATE - 1;
+    MixKernel_resample(longOut, samples, 8192, 12345, rate);
+    resampleReference(longReference, samples, 8192, 12345, rate);
+    if (memcmp(longOut, longReference, sizeof(longOut)) != 0) {
+        fprintf(stderr, "ERROR: %s kernel differs over a long block.\n", MixKernel_name());
+        return false;
+    }
+    return true;
+}
+
+// Voice v reads from its own offset so voices don't share cache lines.
+static const short *voiceData(int voice, int period)
+{
+    int offset = (voice * 997 + period * PERIOD_FRAMES) % 44100;
+    return samples + offset;
+}
+
+static double timeVoices(uint32_t rate)
+{
+    long long start = getTimeInNanoS();
+    for (int p = 0; p < NUM_PERIODS; p++) {
+        memset(bus, 0, sizeof(bus));
+        for (int v = 0; v < NUM_VOICES; v++) {
+            if (rate == MIX_KERNEL_UNITY_RATE) {
+                MixKernel_accumulate(bus, voiceData(v, p), PERIOD_FRAMES);
+            } else {
+                MixKernel_resample(resampled, voiceData(v, p), PERIOD_FRAMES, (uint32_t)v * 2179, rate);
+                MixKernel_accumulate(bus, resampled, PERIOD_FRAMES);
+            }
+        }
+    }
+    long long elapsed = getTimeInNanoS() - start;
+    return (double)elapsed / ((double)NUM_PERIODS * NUM_VOICES * PERIOD_FRAMES);
+}
+
+int main(void)
+{
+    samples = malloc(SAMPLE_FRAMES * sizeof(*samples));
+    if (samples == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate samples.\n");
+        return EXIT_FAILURE;
+    }
+    srand(351);
+    for (int i = 0; i < SAMPLE_FRAMES; i++) {
+        samples[i] = (short)(rand() % 65536 - 32768);
+    }
+    if (!checkKernel()) {
+        return EXIT_FAILURE;
+    }
+
+    printf("Mix kernel: %s, %d voices, %d frames/period, %d periods\n",
+        MixKernel_name(), NUM_VOICES, PERIOD_FRAMES, NUM_PERIODS);
+    double unityNs = timeVoices(MIX_KERNEL_UNITY_RATE);
+    printf("rate 1.0000 (integer step): %6.3f ns/voice/frame\n", unityNs);
+    static const double rates[] = { 0.5, 0.9438743, 1.0594631, 1.5, 2.0, 4.0 };
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        uint32_t rate = (uint32_t)(rates[i] * MIX_KERNEL_UNITY_RATE);
+        double ns = timeVoices(rate);
+        printf("rate %.4f (resampled):    %6.3f ns/voice/frame  %.2fx\n", rates[i], ns, ns / unityNs);
+    }
+
+    free(samples);
+    return 0;
+}
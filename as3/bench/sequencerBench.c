@@ -0,0 +1,230 @@
+// Inter-onset timing of the beat patterns. Plays the Custom pattern (a hit
+// on every half beat) through the mixer in real time, finds every hit in
+// the output and compares the gaps between them with the tempo's, for
+// three ways of sequencing it:
+//   sleep    - the original beat thread: queueSound() for each half beat,
+//              then usleep() for the length of one
+//   lookahead- a beat thread that places each hit on the sample clock with
+//              queueSoundAt(), sleeping until shortly before it is due
+//   callback - the sequencer, run from the mixer's render callback
+// The mixer writes a WAV file, paced to the wall clock by the render
+// callback, so the beat threads see the sample clock advance in real time.
+// Every sound is a single click, so each onset is found to the frame.
+// Optional busy threads compete for the CPU, as the rest of the app would.
+//
+// Usage: sequencer_bench [seconds per run] [busy threads]
+//        (writes and then removes sequencer_bench.wav in the current directory)
+#include "audioMixer.h"
+#include "periodTimer.h"
+#include "sequencer.h"
+#include "waveFile.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OUTPUT_FILE "sequencer_bench.wav"
+#define SAMPLE_RATE 44100
+#define HALF_BEATS_PER_BAR 8
+#define CLICK_FRAMES 32
+#define ONSET_THRESHOLD 8000
+
+typedef enum {
+    SEQUENCE_SLEEP,
+    SEQUENCE_LOOKAHEAD,
+    SEQUENCE_CALLBACK,
+} sequenceMethod_t;
+
+static const char *methodNames[] = { "sleep", "lookahead", "callback" };
+
+static short click[CLICK_FRAMES] = { 16000 };
+static wavedata_t base, snare, hiHat;
+static sequenceMethod_t method;
+static int bpm;
+static long long startNs;
+static volatile bool stopping;
+static volatile bool loadStopping;
+
+static long long getTimeInNs(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+static void sleepUntilNs(long long timeNs)
+{
+    struct timespec spec = { .tv_sec = timeNs / 1000000000LL, .tv_nsec = timeNs % 1000000000LL };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
+}
+
+// Custom pattern step i, at frameTime on the sample clock (0 = at once).
+static void queueCustomStep(int i, long long frameTime)
+{
+    if (i == 0 || i == 3 || i == 4) AudioMixer_queueSoundAt(&base, frameTime);
+    if (i == 2 || i == 6) AudioMixer_queueSoundAt(&snare, frameTime);
+    AudioMixer_queueSoundAt(&hiHat, frameTime);
+}
+
+static void *sleepThread(void *arg)
+{
+    (void)arg;
+    long delay_us = (60 * 1000 * 1000) / bpm / 2;
+    for (int step = 0; !stopping; step = (step + 1) % HALF_BEATS_PER_BAR) {
+        queueCustomStep(step, 0);
+        usleep(delay_us);
+    }
+    return NULL;
+}
+
+static void *lookaheadThread(void *arg)
+{
+    (void)arg;
+    AudioMixer_latencyInfo_t info;
+    AudioMixer_getLatencyInfo(&info);
+    long long leadFrames = 2 * (long long)info.periodFrames + info.rate / 100;
+    long long nextFrame = AudioMixer_getFramesRendered() + leadFrames;
+    for (int step = 0; !stopping; ) {
+        long long waitFrames = nextFrame - leadFrames - AudioMixer_getFramesRendered();
+        if (waitFrames > 0) {
+            usleep(waitFrames * 1000000 / info.rate);
+            continue;
+        }
+        queueCustomStep(step, nextFrame);
+        step = (step + 1) % HALF_BEATS_PER_BAR;
+        nextFrame += (long long)info.rate * 60 / bpm / 2;
+    }
+    return NULL;
+}
+
+static void *busyThread(void *arg)
+{
+    (void)arg;
+    volatile unsigned long spins = 0;
+    while (!loadStopping) {
+        spins++;
+    }
+    return NULL;
+}
+
+// Hold each period back until its time comes on the wall clock, so the
+// file sink runs in real time like the sound card would.
+static void pacePeriod(long long firstFrame, unsigned long numFrames, void *pContext)
+{
+    sleepUntilNs(startNs + firstFrame * 1000000000LL / SAMPLE_RATE);
+    if (method == SEQUENCE_CALLBACK) {
+        Sequencer_renderPeriod(firstFrame, numFrames, pContext);
+    }
+}
+
+static void runMethod(sequenceMethod_t newMethod, int newBPM, int seconds)
+{
+    method = newMethod;
+    bpm = newBPM;
+    stopping = false;
+    // queueCustomStep() as a pattern: steps 0-7 are bits 0-7.
+    Sequencer_pattern_t custom = {
+        .numSteps = HALF_BEATS_PER_BAR, .stepsPerBeat = 2, .numTracks = 3,
+        .tracks = { { &base, 0x19 }, { &snare, 0x44 }, { &hiHat, 0xff } },
+    };
+    Sequencer_init(bpm);
+    Sequencer_setPattern(method == SEQUENCE_CALLBACK ? &custom : NULL);
+
+    AudioMixer_config_t config;
+    AudioMixer_getDefaultConfig(&config);
+    config.sink = AUDIOMIXER_SINK_WAVE_FILE;
+    config.outputFile = OUTPUT_FILE;
+    config.renderFrames = (long long)seconds * SAMPLE_RATE;
+    config.renderCallback = pacePeriod;
+    startNs = getTimeInNs();
+    AudioMixer_initWithConfig(&config);
+
+    pthread_t threadId;
+    bool haveThread = method != SEQUENCE_CALLBACK;
+    if (haveThread) {
+        pthread_create(&threadId, NULL, method == SEQUENCE_SLEEP ? sleepThread : lookaheadThread, NULL);
+    }
+    AudioMixer_waitForRender();
+    stopping = true;
+    if (haveThread) {
+        pthread_join(threadId, NULL);
+    }
+    AudioMixer_cleanup();
+    Sequencer_cleanup();
+
+    wavedata_t output;
+    if (!WaveFile_map(OUTPUT_FILE, &output)) {
+        exit(EXIT_FAILURE);
+    }
+    // Clicks are isolated single samples: every one above the threshold is
+    // an onset.
+    double halfBeat = SAMPLE_RATE * 30.0 / bpm;
+    long long first = -1, previous = -1;
+    int intervals = 0;
+    double sumAbsError = 0, sumSquares = 0, maxAbsError = 0;
+    for (int i = 0; i < output.numSamples; i++) {
+        if (output.pData[i] < ONSET_THRESHOLD) continue;
+        if (previous >= 0) {
+            double error = (i - previous) - halfBeat;
+            sumAbsError += fabs(error);
+            sumSquares += error * error;
+            if (fabs(error) > maxAbsError) maxAbsError = fabs(error);
+            intervals++;
+        } else {
+            first = i;
+        }
+        previous = i;
+    }
+    WaveFile_unmap(&output);
+    unlink(OUTPUT_FILE);
+
+    if (intervals == 0) {
+        printf("%3d bpm  %-9s  no onsets found\n", bpm, methodNames[method]);
+        return;
+    }
+    double msPerFrame = 1000.0 / SAMPLE_RATE;
+    double drift = (previous - first) - intervals * halfBeat;
+    printf("%3d bpm  %-9s  %4d gaps  error mean %7.3f  rms %7.3f  max %7.3f ms  drift %8.2f ms\n",
+        bpm, methodNames[method], intervals,
+        sumAbsError / intervals * msPerFrame, sqrt(sumSquares / intervals) * msPerFrame,
+        maxAbsError * msPerFrame, drift * msPerFrame);
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 10;
+    int numBusy = argc > 2 ? atoi(argv[2]) : 0;
+    static const int tempos[] = { 120, 300 };
+    pthread_t *busyThreads = calloc(numBusy > 0 ? numBusy : 1, sizeof(pthread_t));
+    for (int i = 0; i < numBusy; i++) {
+        pthread_create(&busyThreads[i], NULL, busyThread, NULL);
+    }
+
+    Period_init();
+    base = (wavedata_t){ .numSamples = CLICK_FRAMES, .pData = click };
+    snare = (wavedata_t){ .numSamples = CLICK_FRAMES, .pData = click };
+    hiHat = (wavedata_t){ .numSamples = CLICK_FRAMES, .pData = click };
+
+    printf("Inter-onset error of the Custom pattern, %d s per run, %d busy threads\n"
+        "(drift: last onset against the tempo grid)\n", seconds, numBusy);
+    for (size_t t = 0; t < sizeof(tempos) / sizeof(tempos[0]); t++) {
+        for (int m = SEQUENCE_SLEEP; m <= SEQUENCE_CALLBACK; m++) {
+            runMethod(m, tempos[t], seconds);
+        }
+    }
+    loadStopping = true;
+    for (int i = 0; i < numBusy; i++) {
+        pthread_join(busyThreads[i], NULL);
+    }
+    free(busyThreads);
+
+    // Still describes the last run.
+    AudioMixer_latencyInfo_t info;
+    AudioMixer_getLatencyInfo(&info);
+    printf("Period %lu frames (%.1f ms)\n", info.periodFrames, info.periodFrames * 1000.0 / SAMPLE_RATE);
+    Period_cleanup();
+    return 0;
+}
@@ -0,0 +1,162 @@
+// Sounds streamed from disk against the same sound held in memory. Writes
+// a tone to a WAV file and plays it through the mixer's network sink to
+// 127.0.0.1, receiving the packets on this thread: first loaded into
+// memory, then as 1 and MAX_STREAMS streams at once. Before each stream is
+// opened the file's pages are dropped from the page cache, so its head
+// comes off the disk. Reports per run:
+//   first frame - queued to the first packet holding sound, by its send
+//                 time; the sink's buffer (as printed) comes on top, the
+//                 same for every run
+//   underruns   - frames of silence: a stream's reader fell behind
+//
+// Usage: stream_bench [seconds of tone] [port]
+//        (writes and then removes stream_bench.wav in the current directory)
+#include "audioMixer.h"
+#include "audioStream.h"
+#include "netAudio.h"
+#include "periodTimer.h"
+#include "waveFile.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define FILE_NAME "stream_bench.wav"
+#define MAX_STREAMS 4
+#define RECEIVE_TIMEOUT_MS 500
+
+static int sock;
+
+static bool writeTone(int seconds)
+{
+    FILE *pFile = fopen(FILE_NAME, "wb");
+    if (pFile == NULL) return false;
+    uint32_t numSamples = (uint32_t)seconds * WAVEFILE_SAMPLE_RATE;
+    bool ok = WaveFile_writeHeader(pFile, numSamples);
+    // A cosine, so the very first frame is already loud.
+    for (uint32_t i = 0; ok && i < numSamples; i++) {
+        short sample = (short)(8000 * cos(2 * M_PI * 440 * i / WAVEFILE_SAMPLE_RATE));
+        ok = fwrite(&sample, sizeof(sample), 1, pFile) == 1;
+    }
+    return fclose(pFile) == 0 && ok;
+}
+
+// Evict the file from the page cache (clean pages need no privileges).
+static void dropCache(void)
+{
+    int fd = open(FILE_NAME, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// Discard the packets of silence sent so far.
+static void drainSocket(void)
+{
+    uint8_t packet[NETAUDIO_MAX_PACKET];
+    while (recv(sock, packet, sizeof(packet), MSG_DONTWAIT) > 0) {
+    }
+}
+
+// Send time of the first packet with a sound frame in it, or 0 if none came.
+static long long receiveFirstSound(void)
+{
+    uint8_t packet[NETAUDIO_MAX_PACKET];
+    short samples[NETAUDIO_MAX_FRAMES];
+    for (;;) {
+        ssize_t size = recv(sock, packet, sizeof(packet), 0);
+        if (size < 0) return 0;
+        NetAudio_header_t header;
+        if (!NetAudio_parse(packet, (size_t)size, &header, samples)) continue;
+        for (int f = 0; f < header.numFrames; f++) {
+            if (samples[f] != 0) return header.sentNs;
+        }
+    }
+}
+
+static void run(const char *name, const char *target, wavedata_t *pSounds, int numSounds, int seconds)
+{
+    AudioMixer_config_t config;
+    AudioMixer_getDefaultConfig(&config);
+    config.sink = AUDIOMIXER_SINK_NETWORK;
+    config.netTarget = target;
+    AudioMixer_initWithConfig(&config);
+    usleep(200 * 1000);
+
+    drainSocket();
+    long long queuedNs = NetAudio_getRealTimeNs();
+    for (int i = 0; i < numSounds; i++) {
+        AudioMixer_queueSound(&pSounds[i]);
+    }
+    long long firstNs = receiveFirstSound();
+    // Let it play out, with the reader keeping up (or not).
+    sleep((unsigned int)seconds);
+
+    AudioMixer_stats_t stats;
+    AudioMixer_getStatsAndClear(&stats);
+    if (firstNs > 0) {
+        printf("%-10s first frame %7.3f ms  underruns %6lld frames\n",
+            name, (firstNs - queuedNs) / 1e6, stats.streamUnderruns);
+    } else {
+        printf("%-10s no sound received  underruns %6lld frames\n", name, stats.streamUnderruns);
+    }
+    AudioMixer_cleanup();
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    const char *port = argc > 2 ? argv[2] : "5004";
+
+    char address[32];
+    snprintf(address, sizeof(address), "127.0.0.1:%s", port);
+    struct sockaddr_in local;
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = RECEIVE_TIMEOUT_MS * 1000 };
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (!NetAudio_parseAddress(address, &local) || sock < 0
+            || setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0
+            || bind(sock, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", address, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (!writeTone(seconds)) {
+        fprintf(stderr, "Unable to write %s: %s\n", FILE_NAME, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    Period_init();
+    printf("%d s tone over loopback\n", seconds);
+
+    wavedata_t sounds[MAX_STREAMS];
+    AudioMixer_readWaveFileIntoMemory(FILE_NAME, &sounds[0]);
+    run("memory", address, sounds, 1, seconds);
+    AudioMixer_freeWaveFileData(&sounds[0]);
+
+    static const int counts[] = { 1, MAX_STREAMS };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        int opened = 0;
+        dropCache();
+        while (opened < counts[c] && AudioStream_open(FILE_NAME, &sounds[opened])) {
+            opened++;
+        }
+        if (opened == counts[c]) {
+            char name[32];
+            snprintf(name, sizeof(name), "stream x%d", counts[c]);
+            run(name, address, sounds, opened, seconds);
+        }
+        for (int i = 0; i < opened; i++) {
+            AudioStream_close(&sounds[i]);
+        }
+    }
+
+    Period_cleanup();
+    close(sock);
+    remove(FILE_NAME);
+    return 0;
+}
@@ -0,0 +1,258 @@
+// Beat timing accuracy, as a regression gate for the sequencing path.
+// Renders a number of bars of every beat mode at several tempos through
+// the app's own Beatbox/sequencer code and the real kit, offline (WAV sink,
+// no sound card, no wall clock), then finds the hits in the output with an
+// onset detector and compares each with its ideal place on the tempo grid:
+//   mean  - average signed deviation (late is positive)
+//   p99   - 99th percentile of the absolute deviation
+//   max   - largest absolute deviation
+//   drift - how far the deviation wanders over the run (least-squares
+//           slope times the length of the run)
+// The grid is exact: step k of the run is due k * 60 / (bpm * stepsPerBeat)
+// seconds after the first, however many frames that comes to, and the
+// first is due at frame 0. Deviations include the near-silence at the head
+// of each kit sample (about 0.7 ms with the built-in modes), which is the
+// same in every build.
+//
+// Exits with status 1 if any hit is missed, any onset is found off the
+// grid, or any deviation exceeds the limit, so it can gate a change.
+//
+// Usage: timing_bench [bars per run] [limit ms] [pattern file]
+//        (run from the as3 directory; the modes are the built-in ones plus
+//        any from the pattern file, as with beatbox -p; writes and then
+//        removes timing_bench.wav in the current directory)
+#include "audioLogic.h"
+#include "audioMixer.h"
+#include "pattern.h"
+#include "periodTimer.h"
+#include "waveFile.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OUTPUT_FILE "timing_bench.wav"
+#define SAMPLE_RATE 44100
+// Rendered past the last bar so its hits are not cut short.
+#define TAIL_FRAMES (SAMPLE_RATE / 2)
+
+// Onset detection works on the first difference of the signal, which
+// keeps a hit's attack and drops the low end of the drums ringing under
+// it. An onset is a local peak of the energy in the AFTER frames from a
+// frame over the mean energy of as many frames in the BEFORE frames up to
+// it, at least ONSET_RATIO to one. FLOOR_LEVEL keeps near-silence from
+// counting.
+#define AFTER 64
+#define BEFORE 512
+#define ONSET_RATIO 8.0
+#define FLOOR_LEVEL 64.0
+// Onsets closer together than this are one hit (~5 ms).
+#define MIN_ONSET_GAP 220
+#define MAX_MODES 16
+
+static const char *patternFile;
+
+typedef struct {
+    int hits;       // Steps with a hit on the grid
+    int found;      // ... matched by an onset
+    int extra;      // Onsets matching no such step
+    double mean;    // Frames
+    double p99;
+    double max;
+    double drift;
+} result_t;
+
+static int compareDoubles(const void *pA, const void *pB)
+{
+    double a = *(const double *)pA, b = *(const double *)pB;
+    return (a > b) - (a < b);
+}
+
+// Frame indexes of the onsets in samples[0, count), in order. Returns how
+// many were written to onsets[], at most maxOnsets.
+static int findOnsets(const short *samples, int count, int *onsets, int maxOnsets)
+{
+    double *energy = malloc((count + 1) * sizeof(*energy));
+    if (energy == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    energy[0] = 0;
+    for (int i = 0; i < count; i++) {
+        double difference = i > 0 ? samples[i] - samples[i - 1] : samples[i];
+        energy[i + 1] = energy[i] + difference * difference;
+    }
+
+    double floor = AFTER * FLOOR_LEVEL * FLOOR_LEVEL;
+    int numOnsets = 0;
+    int best = -1;
+    double bestRatio = 0;
+    // Silence before the first frame.
+    for (int i = 0; i + AFTER <= count; i++) {
+        double before = (energy[i] - energy[i > BEFORE ? i - BEFORE : 0]) * AFTER / BEFORE;
+        double after = energy[i + AFTER] - energy[i];
+        double ratio = after / (before + floor);
+        if (best >= 0 && i - best >= MIN_ONSET_GAP) {
+            if (numOnsets < maxOnsets) {
+                onsets[numOnsets++] = best;
+            }
+            best = -1;
+        }
+        if (ratio >= ONSET_RATIO && (best < 0 || ratio > bestRatio)) {
+            best = i;
+            bestRatio = ratio;
+        }
+    }
+    if (best >= 0 && numOnsets < maxOnsets) {
+        onsets[numOnsets++] = best;
+    }
+    free(energy);
+    return numOnsets;
+}
+
+// The modes as Beatbox_init() and the pattern file define them. Returns
+// false if the file has a bad line.
+static bool startBeatbox(void)
+{
+    Beatbox_init();
+    return patternFile == NULL || Beatbox_loadPatterns(patternFile);
+}
+
+static bool describeMode(int mode, Pattern_def_t *pDef)
+{
+    char text[1024];
+    char error[256];
+    return Beatbox_describePattern(mode, text, sizeof(text))
+        && Pattern_parse(text, pDef, error, sizeof(error));
+}
+
+static void runMode(int mode, const Pattern_def_t *pDef, int bpm, int bars, result_t *pResult)
+{
+    const Pattern_def_t def = *pDef;
+    uint64_t hitSteps = 0;
+    for (int t = 0; t < def.numTracks; t++) {
+        hitSteps |= def.tracks[t].steps;
+    }
+
+    double stepFrames = SAMPLE_RATE * 60.0 / ((double)bpm * def.stepsPerBeat);
+    int numSteps = bars * def.numSteps;
+    long long renderFrames = (long long)ceil(numSteps * stepFrames) + TAIL_FRAMES;
+
+    startBeatbox();
+    Beatbox_setMode(mode);
+    Beatbox_setBPM(bpm);
+    AudioMixer_config_t config;
+    AudioMixer_getDefaultConfig(&config);
+    config.sink = AUDIOMIXER_SINK_WAVE_FILE;
+    config.outputFile = OUTPUT_FILE;
+    config.renderFrames = renderFrames;
+    config.renderCallback = Sequencer_renderPeriod;
+    AudioMixer_initWithConfig(&config);
+    AudioMixer_waitForRender();
+    AudioMixer_cleanup();
+    Beatbox_cleanup();
+
+    wavedata_t output;
+    if (!WaveFile_map(OUTPUT_FILE, &output)) {
+        exit(EXIT_FAILURE);
+    }
+    int maxOnsets = numSteps + 1;
+    int *onsets = malloc(maxOnsets * sizeof(*onsets));
+    double *deviations = malloc(numSteps * sizeof(*deviations));
+    bool *matched = calloc(numSteps, sizeof(*matched));
+    if (onsets == NULL || deviations == NULL || matched == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    int numOnsets = findOnsets(output.pData, output.numSamples, onsets, maxOnsets);
+    WaveFile_unmap(&output);
+    unlink(OUTPUT_FILE);
+
+    // Each onset belongs to the nearest step, if that step has a hit and no
+    // onset yet. Steps are at least MIN_ONSET_GAP apart at any tempo the
+    // app allows, so a late hit cannot be taken for the next step's.
+    memset(pResult, 0, sizeof(*pResult));
+    for (int s = 0; s < numSteps; s++) {
+        if (hitSteps >> (s % def.numSteps) & 1) pResult->hits++;
+    }
+    double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    for (int o = 0; o < numOnsets; o++) {
+        int s = (int)lround(onsets[o] / stepFrames);
+        if (s >= numSteps) {
+            // The sequencer plays on into the tail.
+            break;
+        }
+        if (!(hitSteps >> (s % def.numSteps) & 1) || matched[s]) {
+            pResult->extra++;
+            continue;
+        }
+        matched[s] = true;
+        double ideal = s * stepFrames;
+        double deviation = onsets[o] - ideal;
+        deviations[pResult->found++] = fabs(deviation);
+        pResult->mean += deviation;
+        if (fabs(deviation) > pResult->max) pResult->max = fabs(deviation);
+        sumX += ideal;
+        sumY += deviation;
+        sumXX += ideal * ideal;
+        sumXY += ideal * deviation;
+    }
+    int n = pResult->found;
+    if (n > 0) {
+        pResult->mean /= n;
+        qsort(deviations, n, sizeof(*deviations), compareDoubles);
+        pResult->p99 = deviations[(int)ceil(0.99 * n) - 1];
+    }
+    double spread = n * sumXX - sumX * sumX;
+    if (n > 1 && spread > 0) {
+        pResult->drift = (n * sumXY - sumX * sumY) / spread * (numSteps * stepFrames);
+    }
+    free(onsets);
+    free(deviations);
+    free(matched);
+}
+
+int main(int argc, char *argv[])
+{
+    int bars = argc > 1 ? atoi(argv[1]) : 32;
+    double limitMs = argc > 2 ? atof(argv[2]) : 1.0;
+    patternFile = argc > 3 ? argv[3] : NULL;
+    // 137 and 250 bpm do not divide the sample rate into whole frames.
+    static const int tempos[] = { 60, 120, 137, 200, 250, 300 };
+
+    Period_init();
+    // Only to learn the modes; each run starts from a fresh init().
+    if (!startBeatbox()) {
+        return EXIT_FAILURE;
+    }
+    static Pattern_def_t modes[MAX_MODES];
+    int numModes = Beatbox_getNumPatterns();
+    for (int mode = 1; mode <= numModes; mode++) {
+        if (!describeMode(mode, &modes[mode - 1])) {
+            fprintf(stderr, "Unable to describe mode %d\n", mode);
+            return EXIT_FAILURE;
+        }
+    }
+    Beatbox_cleanup();
+
+    printf("Hit timing against the tempo grid, %d bars per run, limit %.3f ms\n"
+        "(mean signed, late positive; p99 and max absolute; drift over the run)\n", bars, limitMs);
+    double msPerFrame = 1000.0 / SAMPLE_RATE;
+    bool pass = true;
+    for (int mode = 1; mode <= numModes; mode++) {
+        for (size_t t = 0; t < sizeof(tempos) / sizeof(tempos[0]); t++) {
+            result_t result;
+            runMode(mode, &modes[mode - 1], tempos[t], bars, &result);
+            bool ok = result.found == result.hits && result.extra == 0
+                && result.max * msPerFrame <= limitMs;
+            pass = pass && ok;
+            printf("%-8s %3d bpm  %4d/%-4d hits %2d extra  mean %7.3f  p99 %7.3f  max %7.3f"
+                "  drift %7.3f ms  %s\n",
+                modes[mode - 1].name, tempos[t], result.found, result.hits, result.extra,
+                result.mean * msPerFrame, result.p99 * msPerFrame, result.max * msPerFrame,
+                result.drift * msPerFrame, ok ? "ok" : "FAIL");
+        }
+    }
+    Period_cleanup();
+    return pass ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,192 @@
+// Contention benchmark for AudioMixer_queueSound()'s submission path.
+//
+// Several producer threads trigger sounds as fast as a drummer never could,
+// while a consumer thread emulates the playback thread: once per period it
+// drains pending voices and then spends most of the period "mixing".
+//   mutex    - the original design: queueSound and the whole mix pass share
+//              one mutex, so producers wait for the mix to finish.
+//   lockfree - VoiceQueue push/pop; the mix pass holds nothing.
+// Reports the latency of each queueSound call as seen by the producers,
+// and how many hits each design dropped for want of room. The producers
+// sleep between triggers, as the real ones do, so a burst between two
+// drains is at most NUM_PRODUCERS * PERIOD_NS / TRIGGER_GAP_NS hits (plus
+// scheduling jitter), which both designs must hold. A latency figure only
+// counts if both dropped the same hits: the bench fails otherwise.
+#include "voiceQueue.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_PRODUCERS 4
+#define HITS_PER_PRODUCER 5000
+#define PERIOD_NS (1000 * 1000LL)   // 1 ms period
+#define MIX_NS (600 * 1000LL)       // 60% DSP load
+#define TRIGGER_GAP_NS (200 * 1000LL)
+#define MAX_SOUND_BITES 30
+// A period's worth of hits must fit both designs (the ring is the larger).
+_Static_assert(NUM_PRODUCERS * (PERIOD_NS / TRIGGER_GAP_NS) <= MAX_SOUND_BITES
+    && MAX_SOUND_BITES <= VOICE_QUEUE_CAPACITY, "burst does not fit the voice slots");
+
+typedef enum { MODE_MUTEX, MODE_LOCKFREE } benchMode_t;
+
+static benchMode_t mode;
+static atomic_bool producersDone;
+
+// Emulated mixer state for the mutex design
+static pthread_mutex_t audioMutex = PTHREAD_MUTEX_INITIALIZER;
+static wavedata_t *soundBites[MAX_SOUND_BITES];
+
+static voiceQueue_t voiceQueue;
+static wavedata_t dummySound = { .numSamples = 1, .pData = NULL };
+
+static long long latencyNs[NUM_PRODUCERS][HITS_PER_PRODUCER];
+static atomic_long droppedHits;
+
+static long long getTimeInNanoS(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+static void spinUntil(long long deadlineNs)
+{
+    while (getTimeInNanoS() < deadlineNs) {
+        // busy: emulates mixing
+    }
+}
+
+static void sleepUntil(long long deadlineNs)
+{
+    struct timespec ts = {
+        .tv_sec = deadlineNs / 1000000000LL,
+        .tv_nsec = deadlineNs % 1000000000LL
+    };
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+static void queueSoundMutex(wavedata_t *pSound)
+{
+    pthread_mutex_lock(&audioMutex);
+    for (int i = 0; i < MAX_SOUND_BITES; i++) {
+        if (soundBites[i] == NULL) {
+            soundBites[i] = pSound;
+            pthread_mutex_unlock(&audioMutex);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&audioMutex);
+    atomic_fetch_add(&droppedHits, 1);
+}
+
+static void queueSoundLockFree(wavedata_t *pSound)
+{
+    voiceCommand_t command = { .pSound = pSound };
+    if (!VoiceQueue_push(&voiceQueue, &command)) {
+        atomic_fetch_add(&droppedHits, 1);
+    }
+}
+
+static void *producerThread(void *arg)
+{
+    long long *pLatency = arg;
+    for (int i = 0; i < HITS_PER_PRODUCER; i++) {
+        long long start = getTimeInNanoS();
+        if (mode == MODE_MUTEX) {
+            queueSoundMutex(&dummySound);
+        } else {
+            queueSoundLockFree(&dummySound);
+        }
+        long long end = getTimeInNanoS();
+        pLatency[i] = end - start;
+        sleepUntil(end + TRIGGER_GAP_NS);
+    }
+    return NULL;
+}
+
+static void *consumerThread(void *arg)
+{
+    (void)arg;
+    long long nextPeriod = getTimeInNanoS();
+    while (!atomic_load(&producersDone)) {
+        long long start = getTimeInNanoS();
+        if (mode == MODE_MUTEX) {
+            // Original fillPlaybackBuffer(): lock held for the whole mix.
+            pthread_mutex_lock(&audioMutex);
+            memset(soundBites, 0, sizeof(soundBites));
+            spinUntil(start + MIX_NS);
+            pthread_mutex_unlock(&audioMutex);
+        } else {
+            voiceCommand_t command;
+            while (VoiceQueue_pop(&voiceQueue, &command)) {
+                // voice would start here
+            }
+            spinUntil(start + MIX_NS);
+        }
+
+        // Emulate blocking in snd_pcm_writei() until the next period.
+        nextPeriod += PERIOD_NS;
+        sleepUntil(nextPeriod);
+    }
+    return NULL;
+}
+
+static int compareLongLong(const void *a, const void *b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+// Returns the number of hits dropped.
+static long runBenchmark(benchMode_t benchMode, const char *name)
+{
+    mode = benchMode;
+    atomic_store(&producersDone, false);
+    atomic_store(&droppedHits, 0);
+    memset(soundBites, 0, sizeof(soundBites));
+    VoiceQueue_init(&voiceQueue);
+
+    pthread_t consumer;
+    pthread_t producers[NUM_PRODUCERS];
+    pthread_create(&consumer, NULL, consumerThread, NULL);
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_create(&producers[i], NULL, producerThread, latencyNs[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    atomic_store(&producersDone, true);
+    pthread_join(consumer, NULL);
+
+    const int count = NUM_PRODUCERS * HITS_PER_PRODUCER;
+    long long *pAll = &latencyNs[0][0];
+    qsort(pAll, count, sizeof(*pAll), compareLongLong);
+    long long sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += pAll[i];
+    }
+    long dropped = atomic_load(&droppedHits);
+    printf("%-9s calls %d  dropped %ld  mean %8.0f ns  p50 %8lld ns  p99 %8lld ns  max %9lld ns\n",
+        name, count, dropped, (double)sum / count,
+        pAll[count / 2], pAll[(count * 99) / 100], pAll[count - 1]);
+    return dropped;
+}
+
+int main(void)
+{
+    printf("queueSound latency: %d producers x %d hits, %lld us period, %lld us mix\n",
+        NUM_PRODUCERS, HITS_PER_PRODUCER, PERIOD_NS / 1000, MIX_NS / 1000);
+    long mutexDropped = runBenchmark(MODE_MUTEX, "mutex");
+    long lockFreeDropped = runBenchmark(MODE_LOCKFREE, "lockfree");
+    if (mutexDropped != lockFreeDropped) {
+        fprintf(stderr, "ERROR: the designs dropped different hits (%ld vs %ld): latencies not comparable.\n",
+            mutexDropped, lockFreeDropped);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
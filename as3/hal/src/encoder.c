@@ -1,5 +1,6 @@
 #define _GNU_SOURCE
 #include "hal/encoder.h"
+#include "hal/threadPolicy.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -44,6 +45,7 @@ static void invoke_button_callback(void) {
 // The background thread that polls the rotary encoder
 static void *encoder_thread(void *arg) {
     (void)arg;
+    ThreadPolicy_apply("encoder");
     struct gpiod_chip *chip_a = NULL;
     struct gpiod_chip *chip_b = NULL;
     struct gpiod_line_request *req_a = NULL;
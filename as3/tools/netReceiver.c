@@ -0,0 +1,403 @@
+// Receiver for the mixer's network sink (beatbox -n, see netAudio.h).
+// Plays the stream through ALSA or records it to a WAV file, through a
+// jitter buffer, and reports once a second on what arrived:
+//   kbps      - bitrate received, headers included
+//   lost      - packets never received since the stream started (gaps in
+//               the sequence numbers)
+//   late      - packets that arrived after their frames were played
+//   concealed - frames played as silence because their packet was missing
+//   skipped   - frames dropped to pull the buffer back to its target when
+//               the sender's clock runs fast against ours
+//   buffer    - frames waiting in the jitter buffer
+//   net       - send to arrival, average/max
+//   e2e       - send to playout (out of the device, or written), avg/max
+// The sender stamps each packet just after mixing it, so e2e is the whole
+// path from the mix to the speaker apart from the sender's one period.
+//
+// Usage: net_receiver [-p port] [-d alsa_device | -o out.wav] [-j jitter_ms] [-s seconds]
+#define _GNU_SOURCE
+#include "audioSink.h"
+#include "netAudio.h"
+#include "waveFile.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define SAMPLE_RATE WAVEFILE_SAMPLE_RATE
+#define PERIOD_FRAMES 256
+#define DEVICE_PERIODS 4
+#define DEFAULT_JITTER_MS 40
+// Jitter buffer ring: ~1.5 s, a power of two.
+#define RING_FRAMES 65536
+#define RING_MASK (RING_FRAMES - 1)
+// Packets per recvmmsg() call.
+#define RECEIVE_BATCH 16
+// How often the receive thread looks up to see if it should stop.
+#define RECEIVE_TIMEOUT_MS 100
+
+static volatile sig_atomic_t stopping = false;
+static int sock = -1;
+static int targetFrames = 0;
+
+// The jitter buffer, under bufferMutex. Frame positions are RTP
+// timestamps extended to 64 bits. Playout runs from playFrame, once
+// `targetFrames` have arrived past primeFrame; until then playFrame is -1.
+static pthread_mutex_t bufferMutex = PTHREAD_MUTEX_INITIALIZER;
+static short ring[RING_FRAMES];
+static bool filled[RING_FRAMES];
+// Send time of the packet starting at each frame, 0 if none.
+static long long sentAt[RING_FRAMES];
+static bool haveStream = false;
+static uint32_t ssrc = 0;
+static long long lastTimestamp = 0;
+static long long primeFrame = 0;
+static long long playFrame = -1;
+static long long receivedEnd = 0;
+static long long firstSequence = 0;
+static long long highestSequence = 0;
+static long long streamPackets = 0;
+
+// Reception counters, under bufferMutex. Interval ones are cleared by
+// each report.
+typedef struct {
+    long long packets;
+    long long bytes;
+    long long late;
+    long long concealed;
+    long long skipped;
+    long long netSumNs;
+    long long netMaxNs;
+    long long e2eSumNs;
+    long long e2eMaxNs;
+    long long e2eCount;
+} counters_t;
+static counters_t interval;
+static counters_t total;
+
+static long long getTimeInNs(clockid_t clock)
+{
+    struct timespec spec;
+    clock_gettime(clock, &spec);
+    return spec.tv_sec * 1000000000LL + spec.tv_nsec;
+}
+
+static void onSignal(int signal)
+{
+    (void)signal;
+    stopping = true;
+}
+
+static void resetStream(const NetAudio_header_t *pHeader)
+{
+    memset(filled, 0, sizeof(filled));
+    memset(sentAt, 0, sizeof(sentAt));
+    haveStream = true;
+    ssrc = pHeader->ssrc;
+    lastTimestamp = pHeader->timestamp;
+    primeFrame = lastTimestamp;
+    playFrame = -1;
+    receivedEnd = lastTimestamp;
+    firstSequence = highestSequence = pHeader->sequence;
+    streamPackets = 0;
+}
+
+// 32-bit RTP counters extended against the last value seen, which
+// packets are assumed to be within half the range of.
+static long long extend(long long last, uint32_t value, int bits)
+{
+    if (bits == 16) {
+        return last + (int16_t)((uint16_t)value - (uint16_t)last);
+    }
+    return last + (int32_t)(value - (uint32_t)last);
+}
+
+// Caller holds bufferMutex.
+static void addPacket(const NetAudio_header_t *pHeader, const short *samples, size_t bytes, long long arrivedNs)
+{
+    if (!haveStream || pHeader->ssrc != ssrc) {
+        // First packet, or the sender has restarted.
+        resetStream(pHeader);
+    }
+    long long frame = extend(lastTimestamp, pHeader->timestamp, 32);
+    long long start = playFrame >= 0 ? playFrame : primeFrame;
+    if (frame >= start + RING_FRAMES) {
+        // Too far ahead to keep: start over from here.
+        resetStream(pHeader);
+        frame = start = primeFrame;
+    }
+    lastTimestamp = frame;
+    long long sequence = extend(highestSequence, pHeader->sequence, 16);
+    if (sequence > highestSequence) highestSequence = sequence;
+    if (sequence < firstSequence) firstSequence = sequence;
+    streamPackets++;
+
+    long long netNs = arrivedNs - pHeader->sentNs;
+    for (counters_t *p = &interval; p; p = p == &interval ? &total : NULL) {
+        p->packets++;
+        p->bytes += bytes;
+        p->netSumNs += netNs;
+        if (netNs > p->netMaxNs) p->netMaxNs = netNs;
+    }
+    if (frame + pHeader->numFrames <= start) {
+        interval.late++;
+        total.late++;
+        return;
+    }
+    if (frame >= start) {
+        sentAt[frame & RING_MASK] = pHeader->sentNs;
+    }
+    for (int i = 0; i < pHeader->numFrames; i++) {
+        long long at = frame + i;
+        if (at < start || at >= start + RING_FRAMES) continue;
+        ring[at & RING_MASK] = samples[i];
+        filled[at & RING_MASK] = true;
+    }
+    if (frame + pHeader->numFrames > receivedEnd) {
+        receivedEnd = frame + pHeader->numFrames;
+    }
+}
+
+static void *receiveThread(void *arg)
+{
+    (void)arg;
+    static uint8_t packets[RECEIVE_BATCH][NETAUDIO_MAX_PACKET];
+    struct iovec iovecs[RECEIVE_BATCH];
+    struct mmsghdr messages[RECEIVE_BATCH];
+    for (int i = 0; i < RECEIVE_BATCH; i++) {
+        iovecs[i] = (struct iovec){ .iov_base = packets[i], .iov_len = NETAUDIO_MAX_PACKET };
+        messages[i] = (struct mmsghdr){ .msg_hdr = { .msg_iov = &iovecs[i], .msg_iovlen = 1 } };
+    }
+    short samples[NETAUDIO_MAX_FRAMES];
+    while (!stopping) {
+        int count = recvmmsg(sock, messages, RECEIVE_BATCH, MSG_WAITFORONE, NULL);
+        if (count < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("recvmmsg");
+                stopping = true;
+            }
+            continue;
+        }
+        long long arrivedNs = NetAudio_getRealTimeNs();
+        pthread_mutex_lock(&bufferMutex);
+        for (int i = 0; i < count; i++) {
+            NetAudio_header_t header;
+            if (NetAudio_parse(packets[i], messages[i].msg_len, &header, samples)) {
+                addPacket(&header, samples, messages[i].msg_len, arrivedNs);
+            }
+        }
+        pthread_mutex_unlock(&bufferMutex);
+    }
+    return NULL;
+}
+
+// Take the next `frames` frames out of the jitter buffer into pBuffer.
+// Returns false while it is still filling up. Records the send time of
+// each packet played, by its offset into pBuffer, in sentNs[].
+static bool takeFrames(short *pBuffer, int frames, long long *sentNs)
+{
+    pthread_mutex_lock(&bufferMutex);
+    if (playFrame < 0) {
+        if (!haveStream || receivedEnd - primeFrame < targetFrames) {
+            pthread_mutex_unlock(&bufferMutex);
+            return false;
+        }
+        playFrame = primeFrame;
+    }
+    // Hold the buffer near its target: the two ends' clocks never quite
+    // agree.
+    long long level = receivedEnd - playFrame;
+    if (level > 2 * targetFrames + PERIOD_FRAMES) {
+        long long skip = level - targetFrames;
+        for (long long at = playFrame; at < playFrame + skip; at++) {
+            filled[at & RING_MASK] = false;
+            sentAt[at & RING_MASK] = 0;
+        }
+        playFrame += skip;
+        interval.skipped += skip;
+        total.skipped += skip;
+    }
+    for (int i = 0; i < frames; i++) {
+        int slot = (playFrame + i) & RING_MASK;
+        pBuffer[i] = filled[slot] ? ring[slot] : 0;
+        if (!filled[slot]) {
+            interval.concealed++;
+            total.concealed++;
+        }
+        sentNs[i] = sentAt[slot];
+        filled[slot] = false;
+        sentAt[slot] = 0;
+    }
+    playFrame += frames;
+    if (playFrame > receivedEnd) {
+        // Ran dry: fill up to the target again before going on.
+        primeFrame = receivedEnd = playFrame;
+        playFrame = -1;
+    }
+    pthread_mutex_unlock(&bufferMutex);
+    return true;
+}
+
+// Frame i of the period just written plays at playedNs(i).
+static void recordLatency(const long long *sentNs, int frames, long long firstPlayedNs)
+{
+    pthread_mutex_lock(&bufferMutex);
+    for (int i = 0; i < frames; i++) {
+        if (sentNs[i] == 0) continue;
+        long long e2eNs = firstPlayedNs + i * 1000000000LL / SAMPLE_RATE - sentNs[i];
+        for (counters_t *p = &interval; p; p = p == &interval ? &total : NULL) {
+            p->e2eSumNs += e2eNs;
+            p->e2eCount++;
+            if (e2eNs > p->e2eMaxNs) p->e2eMaxNs = e2eNs;
+        }
+    }
+    pthread_mutex_unlock(&bufferMutex);
+}
+
+static void printCounters(const counters_t *pCounters, double seconds, long long bufferFrames)
+{
+    pthread_mutex_lock(&bufferMutex);
+    long long expected = haveStream ? highestSequence - firstSequence + 1 : 0;
+    long long lost = expected - streamPackets;
+    pthread_mutex_unlock(&bufferMutex);
+    if (lost < 0) lost = 0;
+    printf("%6.0f kbps  packets %lld  lost %lld (%.2f%%)  late %lld  concealed %lld  skipped %lld"
+        "  buffer %5.1f ms  net %.2f/%.2f ms  e2e %.1f/%.1f ms\n",
+        seconds > 0 ? pCounters->bytes * 8 / 1000.0 / seconds : 0, pCounters->packets,
+        lost, expected ? 100.0 * lost / expected : 0, pCounters->late, pCounters->concealed,
+        pCounters->skipped, bufferFrames * 1000.0 / SAMPLE_RATE,
+        pCounters->packets ? pCounters->netSumNs / 1e6 / pCounters->packets : 0, pCounters->netMaxNs / 1e6,
+        pCounters->e2eCount ? pCounters->e2eSumNs / 1e6 / pCounters->e2eCount : 0, pCounters->e2eMaxNs / 1e6);
+    fflush(stdout);
+}
+
+static long long getBufferFrames(void)
+{
+    pthread_mutex_lock(&bufferMutex);
+    long long frames = playFrame >= 0 ? receivedEnd - playFrame : receivedEnd - primeFrame;
+    pthread_mutex_unlock(&bufferMutex);
+    return frames;
+}
+
+static void printUsage(const char *progName)
+{
+    printf("Usage: %s [-p port] [-d alsa_device | -o out.wav] [-j jitter_ms] [-s seconds]\n", progName);
+    printf("  -p  UDP port to listen on (default %d)\n", NETAUDIO_DEFAULT_PORT);
+    printf("  -d  ALSA playback device (default \"default\")\n");
+    printf("  -o  record to this WAV file instead of playing\n");
+    printf("  -j  jitter buffer target (default %d ms)\n", DEFAULT_JITTER_MS);
+    printf("  -s  stop after this many seconds (default: on Ctrl-C)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    AudioMixer_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.sink = AUDIOMIXER_SINK_ALSA;
+    config.device = "default";
+    config.outputMode = AUDIOMIXER_OUTPUT_WRITEI;
+    config.periodFrames = PERIOD_FRAMES;
+    config.numPeriods = DEVICE_PERIODS;
+    char listen[32];
+    snprintf(listen, sizeof(listen), ":%d", NETAUDIO_DEFAULT_PORT);
+    const char *listenAddress = listen;
+    int jitterMs = DEFAULT_JITTER_MS;
+    double runSeconds = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:d:o:j:s:h")) != -1) {
+        switch (opt) {
+            case 'p': snprintf(listen, sizeof(listen), ":%s", optarg); break;
+            case 'd': config.device = optarg; break;
+            case 'o':
+                config.sink = AUDIOMIXER_SINK_WAVE_FILE;
+                config.outputFile = optarg;
+                break;
+            case 'j': jitterMs = atoi(optarg); break;
+            case 's': runSeconds = atof(optarg); break;
+            default:
+                printUsage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    targetFrames = jitterMs * SAMPLE_RATE / 1000;
+    if (targetFrames < PERIOD_FRAMES) targetFrames = PERIOD_FRAMES;
+    if (targetFrames > RING_FRAMES / 4) targetFrames = RING_FRAMES / 4;
+
+    struct sockaddr_in address;
+    if (!NetAudio_parseAddress(listenAddress, &address)) {
+        return 1;
+    }
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = RECEIVE_TIMEOUT_MS * 1000 };
+    if (sock < 0 || setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0
+            || bind(sock, (struct sockaddr *)&address, sizeof(address)) < 0) {
+        fprintf(stderr, "ERROR: Unable to listen on UDP port %d: %s.\n", ntohs(address.sin_port), strerror(errno));
+        return 1;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    AudioMixer_latencyInfo_t info;
+    const audioSink_t *pSink = AudioSink_open(&config, &info);
+    printf("Listening on UDP port %d, jitter buffer %d ms, %s %s\n", ntohs(address.sin_port),
+        targetFrames * 1000 / SAMPLE_RATE, config.sink == AUDIOMIXER_SINK_ALSA ? "playing on" : "recording to",
+        config.sink == AUDIOMIXER_SINK_ALSA ? config.device : config.outputFile);
+    pthread_t receiveThreadId;
+    pthread_create(&receiveThreadId, NULL, receiveThread, NULL);
+
+    // Played by the device clock, or written by the wall clock.
+    static short buffer[PERIOD_FRAMES];
+    static long long sentNs[PERIOD_FRAMES];
+    long long startNs = getTimeInNs(CLOCK_MONOTONIC);
+    long long reportNs = startNs;
+    long long periods = 0;
+    while (!stopping) {
+        long long nowNs = getTimeInNs(CLOCK_MONOTONIC);
+        if (runSeconds > 0 && nowNs - startNs >= runSeconds * 1e9) {
+            break;
+        }
+        if (nowNs - reportNs >= 1000000000LL) {
+            pthread_mutex_lock(&bufferMutex);
+            counters_t counters = interval;
+            memset(&interval, 0, sizeof(interval));
+            pthread_mutex_unlock(&bufferMutex);
+            printCounters(&counters, (nowNs - reportNs) / 1e9, getBufferFrames());
+            reportNs = nowNs;
+        }
+
+        bool playing = takeFrames(buffer, PERIOD_FRAMES, sentNs);
+        if (pSink->realtime) {
+            // Keep the device running on silence until the stream starts.
+            if (!playing) memset(buffer, 0, sizeof(buffer));
+            pSink->write(buffer, PERIOD_FRAMES);
+            long long playedNs = NetAudio_getRealTimeNs()
+                + (pSink->getDelay() - PERIOD_FRAMES) * 1000000000LL / SAMPLE_RATE;
+            if (playing) recordLatency(sentNs, PERIOD_FRAMES, playedNs);
+        } else {
+            if (playing) {
+                pSink->write(buffer, PERIOD_FRAMES);
+                recordLatency(sentNs, PERIOD_FRAMES, NetAudio_getRealTimeNs());
+            }
+            periods++;
+            long long dueNs = startNs + periods * PERIOD_FRAMES * 1000000000LL / SAMPLE_RATE;
+            struct timespec spec = { .tv_sec = dueNs / 1000000000LL, .tv_nsec = dueNs % 1000000000LL };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL);
+        }
+    }
+
+    stopping = true;
+    pthread_join(receiveThreadId, NULL);
+    pSink->close();
+    close(sock);
+    printf("Total:\n");
+    printCounters(&total, (getTimeInNs(CLOCK_MONOTONIC) - startNs) / 1e9, getBufferFrames());
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef THREAD_POLICY_H_
+#define THREAD_POLICY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Per-thread scheduling policy, applied by each time-critical thread to
+// itself from a table supplied by the application.
+
+typedef struct {
+    const char *name;   // Thread role, as passed to ThreadPolicy_apply()
+    int priority;       // SCHED_FIFO priority (1-99), or 0 for SCHED_OTHER
+    int cpu;            // CPU to pin the thread to, or -1 for any
+    bool lockMemory;    // mlockall() the process and pre-fault this stack
+} ThreadPolicy_config_t;
+
+// Install the policy table (copied by pointer; keep it alive).
+// Threads whose name is not in the table keep the default policy.
+void ThreadPolicy_init(const ThreadPolicy_config_t *pTable, int count);
+void ThreadPolicy_cleanup(void);
+
+// Call at the top of a thread function. Applies the table entry for
+// `name`, falling back gracefully (with a message) if the process lacks
+// CAP_SYS_NICE / CAP_IPC_LOCK, and registers the thread for reporting.
+void ThreadPolicy_apply(const char *name);
+
+// Describe every registered thread: the policy actually applied, plus the
+// minor/major page faults and involuntary context switches it took since
+// the previous report. A thread that has exited is listed as such, until
+// another thread applies the same role.
+void ThreadPolicy_report(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include "hal/threadPolicy.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MAX_THREADS 16
+#define STACK_PREFAULT_BYTES (64 * 1024)
+
+typedef struct {
+    const char *name;
+    pid_t tid;
+    bool fifo;
+    int priority;
+    int cpu;
+    bool locked;
+    bool exited;        // Seen gone by a report
+    // Counters at the previous report, to print deltas.
+    long minorFaults;
+    long majorFaults;
+    long involuntarySwitches;
+} threadRecord_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static const ThreadPolicy_config_t *policyTable = NULL;
+static int policyCount = 0;
+static threadRecord_t threads[MAX_THREADS];
+static int numThreads = 0;
+static bool memoryLocked = false;
+
+// Read this thread's counters from /proc so any thread can report them.
+// Returns false once the thread has exited.
+static bool readThreadCounters(pid_t tid, long *pMinor, long *pMajor, long *pInvoluntary)
+{
+    char path[64];
+    char line[256];
+    *pMinor = *pMajor = *pInvoluntary = 0;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int)tid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    // Fields after "(comm)": state ppid pgrp session tty tpgid flags minflt cminflt majflt
+    if (fgets(line, sizeof(line), file)) {
+        char *pAfterComm = strrchr(line, ')');
+        if (pAfterComm) {
+            sscanf(pAfterComm + 2, "%*c %*d %*d %*d %*d %*d %*u %ld %*u %ld",
+                pMinor, pMajor);
+        }
+    }
+    fclose(file);
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int)tid);
+    file = fopen(path, "r");
+    if (file) {
+        while (fgets(line, sizeof(line), file)) {
+            if (sscanf(line, "nonvoluntary_ctxt_switches: %ld", pInvoluntary) == 1) {
+                break;
+            }
+        }
+        fclose(file);
+    }
+    return true;
+}
+
+static const ThreadPolicy_config_t *findPolicy(const char *name)
+{
+    for (int i = 0; i < policyCount; i++) {
+        if (strcmp(policyTable[i].name, name) == 0) {
+            return &policyTable[i];
+        }
+    }
+    return NULL;
+}
+
+// Lock current and future pages, but only as they are touched: thread
+// stacks are 8 MB mappings and should not be fully populated.
+static bool lockProcessMemory(void)
+{
+    if (memoryLocked) return true;
+    int flags = MCL_CURRENT | MCL_FUTURE;
+#ifdef MCL_ONFAULT
+    flags |= MCL_ONFAULT;
+#endif
+    if (mlockall(flags) != 0) {
+        printf("ThreadPolicy: mlockall failed (%s); memory stays pageable\n", strerror(errno));
+        return false;
+    }
+    memoryLocked = true;
+    return true;
+}
+
+// Touch a block of stack below the caller so its pages are mapped (and
+// locked) now rather than on the first deep call in the real-time loop.
+static void prefaultStack(void)
+{
+    volatile char stack[STACK_PREFAULT_BYTES];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
+
+void ThreadPolicy_init(const ThreadPolicy_config_t *pTable, int count)
+{
+    pthread_mutex_lock(&lock);
+    policyTable = pTable;
+    policyCount = count;
+    numThreads = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void ThreadPolicy_cleanup(void)
+{
+    pthread_mutex_lock(&lock);
+    policyTable = NULL;
+    policyCount = 0;
+    numThreads = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void ThreadPolicy_apply(const char *name)
+{
+    pthread_setname_np(pthread_self(), name);
+
+    pthread_mutex_lock(&lock);
+    const ThreadPolicy_config_t *pPolicy = findPolicy(name);
+    threadRecord_t record = { .name = name, .tid = (pid_t)syscall(SYS_gettid), .cpu = -1 };
+
+    if (pPolicy && pPolicy->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(pPolicy->cpu, &cpus);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err == 0) {
+            record.cpu = pPolicy->cpu;
+        } else {
+            printf("ThreadPolicy: %s: cannot pin to CPU %d (%s)\n", name, pPolicy->cpu, strerror(err));
+        }
+    }
+
+    if (pPolicy && pPolicy->priority > 0) {
+        struct sched_param param = { .sched_priority = pPolicy->priority };
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err == 0) {
+            record.fifo = true;
+            record.priority = pPolicy->priority;
+        } else {
+            // Typically EPERM without CAP_SYS_NICE (or an RLIMIT_RTPRIO of 0).
+            printf("ThreadPolicy: %s: SCHED_FIFO %d denied (%s); staying SCHED_OTHER\n",
+                name, pPolicy->priority, strerror(err));
+        }
+    }
+
+    if (pPolicy && pPolicy->lockMemory) {
+        record.locked = lockProcessMemory();
+        prefaultStack();
+    }
+
+    readThreadCounters(record.tid, &record.minorFaults, &record.majorFaults,
+        &record.involuntarySwitches);
+    // A role started again (e.g. the mixer's threads after a re-init) takes
+    // over its exited predecessor's entry, counting from its own start.
+    int slot = numThreads;
+    for (int i = 0; i < numThreads; i++) {
+        long unused;
+        if (strcmp(threads[i].name, name) == 0 && (threads[i].exited
+                || !readThreadCounters(threads[i].tid, &unused, &unused, &unused))) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < MAX_THREADS) {
+        threads[slot] = record;
+        if (slot == numThreads) numThreads++;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void ThreadPolicy_report(char *buffer, size_t size)
+{
+    size_t used = 0;
+    buffer[0] = '\0';
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < numThreads && used < size; i++) {
+        threadRecord_t *pThread = &threads[i];
+        long minor, major, involuntary;
+        if (pThread->exited || !readThreadCounters(pThread->tid, &minor, &major, &involuntary)) {
+            // Its counters went with it.
+            pThread->exited = true;
+            int n = snprintf(buffer + used, size - used, "%-8s exited\n", pThread->name);
+            if (n < 0) break;
+            used += (size_t)n;
+            continue;
+        }
+
+        char cpu[16] = "any";
+        if (pThread->cpu >= 0) {
+            snprintf(cpu, sizeof(cpu), "%d", pThread->cpu);
+        }
+        int n = snprintf(buffer + used, size - used,
+            "%-8s %s/%-2d cpu %-3s %-8s minflt +%ld majflt +%ld nivcsw +%ld\n",
+            pThread->name, pThread->fifo ? "FIFO" : "OTHER", pThread->priority, cpu,
+            pThread->locked ? "locked" : "pageable",
+            minor - pThread->minorFaults, major - pThread->majorFaults,
+            involuntary - pThread->involuntarySwitches);
+        if (n < 0) break;
+        used += (size_t)n;
+
+        pThread->minorFaults = minor;
+        pThread->majorFaults = major;
+        pThread->involuntarySwitches = involuntary;
+    }
+    pthread_mutex_unlock(&lock);
+}